@@ -0,0 +1,79 @@
+#!/bin/sh
+# Builds libwebview_dll.so with profile-guided optimization on Linux:
+#
+#   1. a plain release build, the baseline
+#   2. an instrumented build, trained with bench/pgo_train under xvfb-run
+#   3. a release build using the profile
+#
+# then runs the training workload on the baseline and on the optimized build
+# and prints the calls per second of both. Works with GCC and Clang, set CXX
+# to choose. The optimized library ends up in pgo/use/libwebview_dll.so.
+#
+#   CXX=clang++ WEBKIT=webkit2gtk-4.1 bench/pgo.sh [--calls 20000]
+set -e
+cd "$(dirname "$0")/.."
+
+cxx=${CXX:-g++}
+webkit=${WEBKIT:-webkit2gtk-4.0}
+gtk_cflags=$(pkg-config --cflags gtk+-3.0 "$webkit")
+gtk_libs=$(pkg-config --libs gtk+-3.0 "$webkit")
+flags="-std=c++17 -O2 -DNDEBUG -flto -fPIC -fvisibility=hidden -fvisibility-inlines-hidden -I./webview/incl"
+
+case $($cxx --version) in
+*clang*)
+	clang=1
+	# LTO objects of Clang need its own linker
+	flags="$flags -fuse-ld=lld"
+	;;
+*) clang= ;;
+esac
+
+# The object is always compiled to pgo/webview_dll.o, GCC finds its profile
+# next to it.
+build() {
+	mkdir -p "pgo/$1"
+	$cxx $flags $2 -DBUILDWEBVIEWDLL -c webview_dll.cc -o pgo/webview_dll.o $gtk_cflags
+	$cxx -shared $flags $2 pgo/webview_dll.o -o "pgo/$1/libwebview_dll.so" -Wl,--as-needed $gtk_libs -pthread
+	$cxx -std=c++17 -O2 -I. bench/pgo_train.cc -o "pgo/$1/pgo_train" -L"pgo/$1" -lwebview_dll '-Wl,-rpath,$ORIGIN' -pthread
+}
+
+train() {
+	xvfb-run -a -s "-screen 0 1280x800x24" "pgo/$1/pgo_train" $2
+}
+
+calls_per_sec() {
+	sed -n 's/.*"calls_per_sec":\([0-9.]*\).*/\1/p'
+}
+
+rm -rf pgo
+mkdir -p pgo
+
+build base ""
+
+if [ -n "$clang" ]; then
+	build gen "-fprofile-instr-generate -fprofile-update=atomic"
+	export LLVM_PROFILE_FILE=pgo/%p.profraw
+	train gen "$*"
+	llvm-profdata merge -o pgo/webview.profdata pgo/*.profraw
+	build use "-fprofile-instr-use=pgo/webview.profdata -Wno-profile-instr-unprofiled"
+else
+	build gen "-fprofile-generate -fprofile-update=atomic"
+	train gen "$*"
+	build use "-fprofile-use -fprofile-partial-training -Wno-missing-profile"
+fi
+
+# Alternate the runs so that both builds see the same machine load, and keep
+# the best of three.
+for run in 1 2 3; do
+	train base "$*" | calls_per_sec >>pgo/base.txt
+	train use "$*" | calls_per_sec >>pgo/use.txt
+done
+
+awk -v label="$(git rev-parse --short HEAD 2>/dev/null || echo unknown)" '
+	FNR == 1 { file++ }
+	file == 1 && $1 > base { base = $1 }
+	file == 2 && $1 > use { use = $1 }
+	END {
+		printf "{\"label\":\"%s\",\"base_calls_per_sec\":%.1f,\"pgo_calls_per_sec\":%.1f,\"delta_percent\":%.1f}\n",
+			label, base, use, base > 0 ? (use - base) * 100 / base : 0
+	}' pgo/base.txt pgo/use.txt
@@ -0,0 +1,189 @@
+// Training workload of the profile-guided build, see bench/pgo.sh. It goes
+// through the exported API of libwebview_dll.so only, so that the profile
+// covers the code the shared library ships: message parsing, bound
+// callbacks, returns from the UI thread and from a worker thread, and events.
+//
+// It prints one line of JSON with the calls per second, which pgo.sh compares
+// between the plain and the optimized build.
+//
+//   pgo_train [--calls 20000]
+
+#include "webview_dll.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace
+{
+
+  const char *page = R""(
+<!doctype html>
+<html>
+<body>
+<script>
+  window.runTraining = async function(calls) {
+    var events = 0;
+    window._rpc.subscribe('progress', function() {
+      events++;
+    });
+    var item = function(i) {
+      return {
+        id: i,
+        name: 'item "' + i + '"\n\ttabbed \\ slashed /',
+        tags: ['a', 'b', 'c'],
+        nested: {values: [1, 2.5, -3e2, true, false, null], empty: {}},
+      };
+    };
+    var big = 'x'.repeat(65536);
+    var run = async function(fn, n, payload) {
+      for (var i = 0; i < n; i++) {
+        await fn(payload(i), i);
+      }
+    };
+    var workers = function(fn, n, payload) {
+      var all = [];
+      for (var c = 0; c < 8; c++) {
+        all.push(run(fn, n / 8, payload));
+      }
+      return Promise.all(all);
+    };
+    var start = performance.now();
+    await workers(window.echo, calls / 2, item);
+    await workers(window.echoAsync, calls / 2, item);
+    await run(window.echo, calls / 100, function() {
+      return big;
+    });
+    var elapsed = performance.now() - start;
+    await window.done({calls: calls + calls / 100, elapsed: elapsed, events: events});
+  };
+  window.ready();
+</script>
+</body>
+</html>
+)"";
+
+  struct training
+  {
+    WebViewHandle handle = HANDLE_ERROR;
+    int calls = 20000;
+    int returned = 0;
+    std::string report;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::pair<std::string, std::string>> async_calls;
+    bool stopped = false;
+  };
+
+  void echo(const char *seq, const char *req, void *arg)
+  {
+    auto t = static_cast<training *>(arg);
+    ReturnWebView(t->handle, seq, 0, req);
+    if (++t->returned % 100 == 0)
+    {
+      EmitWebViewEvent(t->handle, "progress", std::to_string(t->returned).c_str());
+    }
+  }
+
+  void echo_async(const char *seq, const char *req, void *arg)
+  {
+    auto t = static_cast<training *>(arg);
+    {
+      std::lock_guard<std::mutex> lock(t->mutex);
+      t->async_calls.emplace_back(seq, req);
+    }
+    t->cv.notify_all();
+  }
+
+  void ready(const char *seq, const char *, void *arg)
+  {
+    auto t = static_cast<training *>(arg);
+    ReturnWebView(t->handle, seq, 0, "null");
+    EvalWebView(t->handle, ("window.runTraining(" + std::to_string(t->calls) + ")").c_str());
+  }
+
+  void done(const char *seq, const char *req, void *arg)
+  {
+    auto t = static_cast<training *>(arg);
+    t->report = req;
+    ReturnWebView(t->handle, seq, 0, "null");
+    TerminateWebView(t->handle);
+  }
+
+  void resolve_async(training *t)
+  {
+    std::unique_lock<std::mutex> lock(t->mutex);
+    while (true)
+    {
+      t->cv.wait(lock, [t]()
+                 { return t->stopped || !t->async_calls.empty(); });
+      if (t->stopped)
+      {
+        return;
+      }
+      auto call = std::move(t->async_calls.front());
+      t->async_calls.pop_front();
+      lock.unlock();
+      ReturnWebView(t->handle, call.first.c_str(), 0, call.second.c_str());
+      lock.lock();
+    }
+  }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  training t;
+  if (argc == 3 && std::strcmp(argv[1], "--calls") == 0)
+  {
+    // Whole batches of 8 workers and of 100 large calls.
+    t.calls = std::max(800, std::atoi(argv[2]) / 800 * 800);
+  }
+  else if (argc != 1)
+  {
+    std::fprintf(stderr, "usage: %s [--calls n]\n", argv[0]);
+    return 2;
+  }
+
+  t.handle = CreateWebViewInstance(0, nullptr);
+  if (t.handle == HANDLE_ERROR)
+  {
+    std::fprintf(stderr, "pgo_train: cannot create a webview, is there a display?\n");
+    return 1;
+  }
+
+  const WebViewBinding bindings[] = {
+      {"echo", echo, &t},
+      {"echoAsync", echo_async, &t},
+      {"ready", ready, &t},
+      {"done", done, &t},
+  };
+  BindWebViewMany(t.handle, bindings, sizeof(bindings) / sizeof(bindings[0]));
+
+  std::thread resolver(resolve_async, &t);
+  SetWebViewHTML(t.handle, page);
+  RunWebView(t.handle);
+  {
+    std::lock_guard<std::mutex> lock(t.mutex);
+    t.stopped = true;
+  }
+  t.cv.notify_all();
+  resolver.join();
+  DestroyWebView(t.handle);
+
+  // The page reports {"calls":n,"elapsed":ms,"events":n} as the only argument.
+  std::string report = t.report.size() > 2 ? t.report.substr(1, t.report.size() - 2) : "{}";
+  auto elapsed = report.find("\"elapsed\":");
+  auto ms = elapsed == std::string::npos ? 0.0 : std::atof(report.c_str() + elapsed + 10);
+  std::printf("{\"report\":%s,\"calls_per_sec\":%.1f}\n", report.c_str(),
+              ms > 0 ? (t.calls + t.calls / 100) * 1000.0 / ms : 0.0);
+  return 0;
+}
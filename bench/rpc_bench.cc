@@ -0,0 +1,441 @@
+// End-to-end benchmark of the RPC path through a real browser engine:
+// window.external.invoke -> on_message -> bound callback -> resolve -> eval.
+//
+// The page runs each scenario and measures every call with performance.now();
+// the results are written as JSON with latency percentiles and sustained calls
+// per second, so runs can be compared across commits. On Linux it needs an X
+// server, see bench/run_xvfb.sh.
+//
+//   rpc_bench [--payloads 16,1024,65536] [--concurrency 1,16]
+//             [--modes sync,async] [--calls 2000] [--warmup 200]
+//             [--label name] [--out results.json]
+
+#include "webview.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+  struct scenario
+  {
+    std::size_t payload;
+    int concurrency;
+    // Calls are resolved inside the callback when sync, or from a worker
+    // thread when async.
+    bool async;
+  };
+
+  struct result
+  {
+    scenario s;
+    std::string error;
+    std::vector<double> latencies_us;
+    double elapsed_ms = 0;
+    // Smallest step of performance.now() seen, engines coarsen it.
+    double resolution_us = 0;
+  };
+
+  struct options
+  {
+    std::vector<std::size_t> payloads{16, 1024, 65536};
+    std::vector<int> concurrency{1, 16};
+    std::vector<bool> modes{false, true};
+    int calls = 2000;
+    int warmup = 200;
+    std::string label;
+    std::string out;
+  };
+
+  const char *page = R""(
+<!doctype html>
+<html>
+<body>
+<script>
+  window.runScenario = async function(s) {
+    var payload = 'x'.repeat(s.payload);
+    var latencies = [];
+    var resolution = Infinity;
+    var worker = async function(n, record) {
+      for (var i = 0; i < n; i++) {
+        var start = performance.now();
+        var echoed = await window.echo(payload);
+        var end = performance.now();
+        if (echoed.length !== payload.length) {
+          throw new Error('Echo returned ' + echoed.length + ' bytes');
+        }
+        if (end > start) {
+          resolution = Math.min(resolution, end - start);
+        }
+        if (record) {
+          latencies.push(end - start);
+        }
+      }
+    };
+    var phase = function(total, record) {
+      var workers = [];
+      for (var c = 0; c < s.concurrency; c++) {
+        var n = Math.floor(total / s.concurrency) +
+                (c < total % s.concurrency ? 1 : 0);
+        workers.push(worker(n, record));
+      }
+      return Promise.all(workers);
+    };
+    try {
+      await phase(s.warmup, false);
+      var start = performance.now();
+      await phase(s.calls, true);
+      var elapsed = performance.now() - start;
+      await window.report(
+          {elapsed: elapsed, resolution: resolution, latencies: latencies});
+    } catch (e) {
+      await window.report({error: String(e)});
+    }
+  };
+  window.ready();
+</script>
+</body>
+</html>
+)"";
+
+  std::vector<std::string> split(const std::string &list)
+  {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+      if (!item.empty())
+      {
+        items.push_back(item);
+      }
+    }
+    return items;
+  }
+
+  bool parse_options(int argc, char **argv, options &opts)
+  {
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+      std::string flag = argv[i];
+      std::string value = argv[i + 1];
+      if (flag == "--payloads")
+      {
+        opts.payloads.clear();
+        for (const auto &item : split(value))
+        {
+          opts.payloads.push_back(std::strtoull(item.c_str(), nullptr, 10));
+        }
+      }
+      else if (flag == "--concurrency")
+      {
+        opts.concurrency.clear();
+        for (const auto &item : split(value))
+        {
+          opts.concurrency.push_back(std::max(1, std::atoi(item.c_str())));
+        }
+      }
+      else if (flag == "--modes")
+      {
+        opts.modes.clear();
+        for (const auto &item : split(value))
+        {
+          if (item != "sync" && item != "async")
+          {
+            return false;
+          }
+          opts.modes.push_back(item == "async");
+        }
+      }
+      else if (flag == "--calls")
+      {
+        opts.calls = std::max(1, std::atoi(value.c_str()));
+      }
+      else if (flag == "--warmup")
+      {
+        opts.warmup = std::max(0, std::atoi(value.c_str()));
+      }
+      else if (flag == "--label")
+      {
+        opts.label = value;
+      }
+      else if (flag == "--out")
+      {
+        opts.out = value;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    return argc % 2 == 1;
+  }
+
+  // Parses a JSON array of numbers, which is all the page reports.
+  std::vector<double> parse_numbers(const std::string &json)
+  {
+    std::vector<double> numbers;
+    const char *p = json.c_str();
+    while (*p != '\0')
+    {
+      if (*p == '[' || *p == ',' || *p == ' ' || *p == ']')
+      {
+        p++;
+        continue;
+      }
+      char *end = nullptr;
+      numbers.push_back(std::strtod(p, &end));
+      if (end == p)
+      {
+        break;
+      }
+      p = end;
+    }
+    return numbers;
+  }
+
+  double percentile(const std::vector<double> &sorted, double p)
+  {
+    if (sorted.empty())
+    {
+      return 0;
+    }
+    auto rank = static_cast<std::size_t>(p / 100.0 * sorted.size() + 0.5);
+    return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+  }
+
+  std::string to_json(const options &opts, const std::vector<result> &results)
+  {
+    std::ostringstream out;
+    out << "{\"label\":" << webview::detail::json_escape(opts.label)
+        << ",\"backend\":";
+#if defined(WEBVIEW_GTK)
+    out << "\"webkit2gtk " << webkit_get_major_version() << "."
+        << webkit_get_minor_version() << "." << webkit_get_micro_version()
+        << "\"";
+#elif defined(WEBVIEW_COCOA)
+    out << "\"wkwebview\"";
+#elif defined(WEBVIEW_EDGE)
+    out << "\"webview2\"";
+#else
+    out << "\"headless\"";
+#endif
+    out << ",\"calls\":" << opts.calls << ",\"warmup\":" << opts.warmup
+        << ",\"scenarios\":[";
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+      const auto &r = results[i];
+      auto sorted = r.latencies_us;
+      std::sort(sorted.begin(), sorted.end());
+      double sum = 0;
+      for (auto latency : sorted)
+      {
+        sum += latency;
+      }
+      out << (i > 0 ? "," : "") << "{\"payload\":" << r.s.payload
+          << ",\"concurrency\":" << r.s.concurrency << ",\"mode\":\""
+          << (r.s.async ? "async" : "sync") << "\"";
+      if (!r.error.empty())
+      {
+        out << ",\"error\":" << webview::detail::json_escape(r.error) << "}";
+        continue;
+      }
+      out << ",\"calls_per_sec\":"
+          << (r.elapsed_ms > 0 ? sorted.size() * 1000.0 / r.elapsed_ms : 0)
+          << ",\"timer_resolution_us\":" << r.resolution_us
+          << ",\"latency_us\":{\"min\":" << (sorted.empty() ? 0 : sorted.front())
+          << ",\"mean\":" << (sorted.empty() ? 0 : sum / sorted.size())
+          << ",\"p50\":" << percentile(sorted, 50)
+          << ",\"p90\":" << percentile(sorted, 90)
+          << ",\"p99\":" << percentile(sorted, 99)
+          << ",\"p999\":" << percentile(sorted, 99.9)
+          << ",\"max\":" << (sorted.empty() ? 0 : sorted.back()) << "}}";
+    }
+    out << "]}";
+    return out.str();
+  }
+
+  // Resolves calls of async scenarios off the UI thread.
+  class resolver
+  {
+  public:
+    explicit resolver(webview::webview &w)
+        : m_webview(w), m_thread([this]()
+                                 { run(); }) {}
+
+    ~resolver()
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopped = true;
+      }
+      m_cv.notify_all();
+      m_thread.join();
+    }
+
+    void push(std::string seq, std::string result)
+    {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls.emplace_back(std::move(seq), std::move(result));
+      }
+      m_cv.notify_all();
+    }
+
+  private:
+    void run()
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      while (true)
+      {
+        m_cv.wait(lock, [this]()
+                  { return m_stopped || !m_calls.empty(); });
+        if (m_stopped)
+        {
+          return;
+        }
+        auto call = std::move(m_calls.front());
+        m_calls.pop_front();
+        lock.unlock();
+        m_webview.resolve(call.first, 0, call.second);
+        lock.lock();
+      }
+    }
+
+    webview::webview &m_webview;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::pair<std::string, std::string>> m_calls;
+    bool m_stopped = false;
+    std::thread m_thread;
+  };
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  options opts;
+  if (!parse_options(argc, argv, opts))
+  {
+    std::fprintf(stderr,
+                 "usage: %s [--payloads 16,1024] [--concurrency 1,16] "
+                 "[--modes sync,async] [--calls n] [--warmup n] "
+                 "[--label name] [--out file]\n",
+                 argv[0]);
+    return 2;
+  }
+
+  std::vector<scenario> scenarios;
+  for (auto payload : opts.payloads)
+  {
+    for (auto concurrency : opts.concurrency)
+    {
+      for (auto async : opts.modes)
+      {
+        scenarios.push_back({payload, concurrency, async});
+      }
+    }
+  }
+
+  webview::webview w(false, nullptr);
+  if (!w.window())
+  {
+    std::fprintf(stderr, "rpc_bench: cannot create a webview, is there a display?\n");
+    return 1;
+  }
+  w.set_title("rpc_bench");
+  w.set_size(480, 320, WEBVIEW_HINT_NONE);
+
+  resolver async_resolver(w);
+  std::vector<result> results;
+  std::size_t next = 0;
+  bool started = false;
+
+  auto run_next = [&]()
+  {
+    if (next == scenarios.size())
+    {
+      w.terminate();
+      return;
+    }
+    const auto &s = scenarios[next];
+    results.push_back({s, {}, {}, 0, 0});
+    w.eval("window.runScenario({payload:" + std::to_string(s.payload) +
+           ",concurrency:" + std::to_string(s.concurrency) +
+           ",calls:" + std::to_string(opts.calls) +
+           ",warmup:" + std::to_string(opts.warmup) + "})");
+    next++;
+  };
+
+  w.bind(
+      "echo", [&](const std::string &seq, const std::string &req, void *)
+      {
+        // The only argument is echoed back as the result, so the result
+        // crosses the bridge with the same size as the request.
+        auto payload = webview::detail::json_parse(req, "", 0);
+        auto echoed = webview::detail::json_escape(payload);
+        if (scenarios[next - 1].async)
+        {
+          async_resolver.push(seq, std::move(echoed));
+        }
+        else
+        {
+          w.resolve(seq, 0, echoed);
+        } },
+      nullptr);
+  w.bind(
+      "report", [&](const std::string &seq, const std::string &req, void *)
+      {
+        auto report = webview::detail::json_parse(req, "", 0);
+        auto &r = results.back();
+        r.error = webview::detail::json_parse(report, "error", 0);
+        r.elapsed_ms = std::atof(webview::detail::json_parse(report, "elapsed", 0).c_str());
+        r.resolution_us = std::atof(webview::detail::json_parse(report, "resolution", 0).c_str()) * 1000.0;
+        for (auto ms : parse_numbers(webview::detail::json_parse(report, "latencies", 0)))
+        {
+          r.latencies_us.push_back(ms * 1000.0);
+        }
+        w.resolve(seq, 0, "null");
+        w.dispatch(run_next); },
+      nullptr);
+  w.bind(
+      "ready", [&](const std::string &seq, const std::string &, void *)
+      {
+        w.resolve(seq, 0, "null");
+        // A reload must not restart the scenarios.
+        if (!started)
+        {
+          started = true;
+          w.dispatch(run_next);
+        } },
+      nullptr);
+
+  w.set_html(page);
+  w.run();
+
+  auto json = to_json(opts, results);
+  if (opts.out.empty())
+  {
+    std::printf("%s\n", json.c_str());
+    return 0;
+  }
+  auto file = std::fopen(opts.out.c_str(), "wb");
+  if (file == nullptr)
+  {
+    std::fprintf(stderr, "rpc_bench: cannot write %s\n", opts.out.c_str());
+    return 1;
+  }
+  std::fputs(json.c_str(), file);
+  std::fclose(file);
+  return 0;
+}
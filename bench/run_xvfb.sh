@@ -0,0 +1,10 @@
+#!/bin/sh
+# Builds the RPC benchmark and runs it on a virtual X server, labelled with
+# the current commit. Extra arguments are passed to rpc_bench, ex:
+#
+#   bench/run_xvfb.sh --payloads 16,65536 --out before.json
+set -e
+cd "$(dirname "$0")/.."
+make bench
+label=$(git rev-parse --short HEAD 2>/dev/null || echo unknown)
+exec xvfb-run -a -s "-screen 0 1280x800x24" ./bench/rpc_bench --label "$label" "$@"
@@ -0,0 +1,391 @@
+// Tests of the RPC, cancellation, streaming and channel paths, driven
+// through the headless engine so that they run without a display. A driver
+// thread plays the page with the simulate_* functions while the main thread
+// runs the loop.
+//
+//   make test
+
+#include "webview.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+
+  int failures = 0;
+
+#define CHECK(cond)                                                   \
+  do                                                                  \
+  {                                                                   \
+    if (!(cond))                                                      \
+    {                                                                 \
+      std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,     \
+                   __LINE__, #cond);                                  \
+      failures++;                                                     \
+    }                                                                 \
+  } while (0)
+
+  struct call_result
+  {
+    int status;
+    std::string value;
+    std::vector<std::string> chunks;
+  };
+
+  // Runs f on the loop thread and waits for it.
+  template <typename F>
+  void on_loop(webview::webview &w, F f)
+  {
+    std::promise<void> done;
+    w.dispatch([&]()
+               { f(); done.set_value(); });
+    done.get_future().wait();
+  }
+
+  // Waits until the tasks queued so far and the evaluations they cause have
+  // run. A result goes through resolve, eval and the simulated page, each on
+  // its own loop iteration.
+  void drain(webview::webview &w)
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      on_loop(w, [] {});
+    }
+  }
+
+  // Calls a binding from the simulated page and waits for the result. A
+  // status of -1 means the call was not settled in time.
+  call_result call(webview::webview &w, const std::string &method,
+                   const std::string &params)
+  {
+    auto settled = std::make_shared<std::promise<call_result>>();
+    auto chunks = std::make_shared<std::vector<std::string>>();
+    w.simulate_call(
+        method, params,
+        [settled, chunks](int status, const std::string &value)
+        { settled->set_value({status, value, *chunks}); },
+        [chunks](const std::string &chunk)
+        { chunks->push_back(chunk); });
+    auto result = settled->get_future();
+    if (result.wait_for(std::chrono::seconds(5)) != std::future_status::ready)
+    {
+      return {-1, "", {}};
+    }
+    return result.get();
+  }
+
+  void test_call(webview::webview &w)
+  {
+    w.bind("add", [](const std::string &args)
+           {
+      auto a = std::atoi(webview::detail::json_parse(args, "", 0).c_str());
+      auto b = std::atoi(webview::detail::json_parse(args, "", 1).c_str());
+      return std::to_string(a + b); });
+    auto result = call(w, "add", "[1,2]");
+    CHECK(result.status == 0);
+    CHECK(result.value == "3");
+
+    webview_binding_stats_t stats;
+    CHECK(w.binding_stats("add", stats));
+    CHECK(stats.calls == 1);
+    CHECK(stats.in_flight == 0);
+  }
+
+  void test_unknown(webview::webview &w)
+  {
+    auto result = call(w, "missing", "[]");
+    CHECK(result.status == 1);
+    CHECK(result.value.find("Binding not found") != std::string::npos);
+
+    webview_binding_stats_t stats;
+    CHECK(!w.binding_stats("missing", stats));
+    CHECK(webview_binding_stats(&w, nullptr, &stats) == 1);
+    CHECK(stats.calls == 1);
+    CHECK(stats.errors == 1);
+  }
+
+  void test_cancel(webview::webview &w)
+  {
+    std::string held;
+    std::string cancelled;
+    w.bind(
+        "hold", [&](const std::string &seq, const std::string &, void *)
+        { held = seq; },
+        nullptr);
+    w.set_binding_cancel("hold", [&](const std::string &seq, void *)
+                         { cancelled = seq; });
+    auto settled = std::make_shared<bool>(false);
+    auto id = w.simulate_call("hold", "[]", [settled](int, const std::string &)
+                              { *settled = true; });
+    drain(w);
+    CHECK(!held.empty());
+    CHECK(!w.is_cancelled(held));
+
+    w.simulate_cancel(id);
+    drain(w);
+    CHECK(cancelled == held);
+    CHECK(w.is_cancelled(held));
+
+    // A late result of a cancelled call goes nowhere.
+    w.resolve(held, 0, "1");
+    drain(w);
+    on_loop(w, [&]
+            { CHECK(!*settled); });
+
+    webview_binding_stats_t stats;
+    CHECK(w.binding_stats("hold", stats));
+    CHECK(stats.cancelled == 1);
+    CHECK(stats.in_flight == 0);
+    w.unbind("hold");
+  }
+
+  void test_navigate(webview::webview &w)
+  {
+    std::string held;
+    std::string cancelled;
+    w.bind(
+        "pending", [&](const std::string &seq, const std::string &, void *)
+        { held = seq; },
+        nullptr);
+    w.set_binding_cancel("pending", [&](const std::string &seq, void *)
+                         { cancelled = seq; });
+    w.simulate_call("pending", "[]", nullptr);
+    drain(w);
+    auto old = held;
+    CHECK(!old.empty());
+
+    // The new document numbers its calls from 1 again, so the old call must
+    // not be confused with the first call of the new page.
+    w.navigate("about:blank");
+    drain(w);
+    CHECK(cancelled == old);
+    CHECK(w.is_cancelled(old));
+
+    std::vector<std::string> evals;
+    w.set_eval_observer([&](const std::string &js)
+                        { evals.push_back(js); });
+    auto settled = std::make_shared<std::promise<call_result>>();
+    w.simulate_call("pending", "[]", [settled](int status, const std::string &value)
+                    { settled->set_value({status, value, {}}); });
+    drain(w);
+    CHECK(held != old);
+    w.resolve(old, 0, "\"old\"");
+    w.resolve(held, 0, "\"new\"");
+    auto result = settled->get_future();
+    CHECK(result.wait_for(std::chrono::seconds(5)) ==
+          std::future_status::ready);
+    CHECK(result.get().value == "\"new\"");
+    on_loop(w, [&]
+            {
+      CHECK(evals.size() == 1);
+      CHECK(!evals.empty() && evals[0].find("window._rpc.settle(") == 0 &&
+            evals[0].find("\",1,0,") != std::string::npos); });
+    w.set_eval_observer(nullptr);
+
+    webview_binding_stats_t stats;
+    CHECK(w.binding_stats("pending", stats));
+    CHECK(stats.cancelled == 1);
+    CHECK(stats.in_flight == 0);
+    w.unbind("pending");
+  }
+
+  void test_stale_result(webview::webview &w)
+  {
+    std::string held;
+    w.bind(
+        "later", [&](const std::string &seq, const std::string &, void *)
+        { held = seq; },
+        nullptr);
+    w.navigate("about:blank");
+    auto old_settled = std::make_shared<bool>(false);
+    w.simulate_call("later", "[]", [old_settled](int, const std::string &)
+                    { *old_settled = true; });
+    drain(w);
+    auto old = held;
+    CHECK(!old.empty());
+
+    // The old page's result is queued before the navigation but evaluated
+    // after the new page has made its first call, which has the same JS seq.
+    auto settled = std::make_shared<std::promise<call_result>>();
+    on_loop(w, [&]
+            {
+      w.navigate("about:blank");
+      w.simulate_call("later", "[]", [settled](int status, const std::string &value)
+                      { settled->set_value({status, value, {}}); });
+      w.resolve(old, 0, "\"old\""); });
+    drain(w);
+    CHECK(held != old);
+    w.resolve(held, 0, "\"new\"");
+    auto result = settled->get_future();
+    CHECK(result.wait_for(std::chrono::seconds(5)) ==
+          std::future_status::ready);
+    CHECK(result.get().value == "\"new\"");
+    on_loop(w, [&]
+            { CHECK(!*old_settled); });
+    w.unbind("later");
+  }
+
+  void test_stream(webview::webview &w)
+  {
+    // The main thread cannot wait for credits, so chunks over the window are
+    // refused until the page has consumed some.
+    int accepted = 0;
+    w.bind(
+        "burst", [&](const std::string &seq, const std::string &, void *)
+        {
+      for (int i = 0; i < 20; i++)
+      {
+        accepted += w.resolve_chunk(seq, std::to_string(i)) ? 1 : 0;
+      }
+      w.resolve(seq, 0, "null"); },
+        nullptr);
+    auto result = call(w, "burst", "[]");
+    CHECK(result.status == 0);
+    CHECK(accepted == static_cast<int>(webview::detail::stream_window));
+    CHECK(result.chunks.size() == webview::detail::stream_window);
+
+    // Other threads wait for credits and send every chunk in order.
+    std::thread producer;
+    w.bind(
+        "rows", [&](const std::string &seq, const std::string &, void *)
+        {
+      producer = std::thread([&w, seq]()
+                             {
+        for (int i = 0; i < 100; i++)
+        {
+          w.resolve_chunk(seq, std::to_string(i));
+        }
+        w.resolve(seq, 0, "100"); }); },
+        nullptr);
+    result = call(w, "rows", "[]");
+    producer.join();
+    CHECK(result.status == 0);
+    CHECK(result.value == "100");
+    CHECK(result.chunks.size() == 100);
+    for (std::size_t i = 0; i < result.chunks.size(); i++)
+    {
+      CHECK(result.chunks[i] == std::to_string(i));
+    }
+    w.unbind("burst");
+    w.unbind("rows");
+  }
+
+  void test_channel(webview::webview &w)
+  {
+    CHECK(webview_channel_open(&w, "bad", 3, 4, 2) == 0);
+    CHECK(webview_channel_open(&w, "feed", WEBVIEW_CHANNEL_BLOCK, 4, 2) == 1);
+
+    // Messages received, and the largest batch, only touched on the loop
+    // thread.
+    std::vector<int> received;
+    int largest_batch = 0;
+    w.simulate_listen("feed", [&](const std::string &batch)
+                      {
+      int i = 0;
+      for (;; i++)
+      {
+        auto item = webview::detail::json_parse(batch, "", i);
+        if (item.empty())
+        {
+          break;
+        }
+        received.push_back(std::atoi(item.c_str()));
+      }
+      largest_batch = std::max(largest_batch, i); });
+    drain(w);
+
+    // Blocking posters from several threads are all delivered, each in the
+    // order it posted.
+    const int threads = 4;
+    const int messages = 50;
+    std::vector<std::thread> posters;
+    for (int t = 0; t < threads; t++)
+    {
+      posters.emplace_back([&w, t]()
+                           {
+        for (int i = 0; i < messages; i++)
+        {
+          w.post("feed", "", std::to_string(t * 1000 + i));
+        } });
+    }
+    for (auto &poster : posters)
+    {
+      poster.join();
+    }
+    // The last messages still take a few credit round trips.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    std::size_t count = 0;
+    while (count < threads * messages &&
+           std::chrono::steady_clock::now() < deadline)
+    {
+      on_loop(w, [&]
+              { count = received.size(); });
+    }
+
+    on_loop(w, [&]
+            {
+      CHECK(received.size() == threads * messages);
+      // No more messages than the window are in flight at once.
+      CHECK(largest_batch <= 2);
+      std::vector<int> last(threads, -1);
+      bool ordered = true;
+      for (auto value : received)
+      {
+        ordered = ordered && value % 1000 > last[value / 1000];
+        last[value / 1000] = value % 1000;
+      }
+      CHECK(ordered); });
+
+    webview_channel_stats_t stats;
+    CHECK(webview_channel_stats(&w, "feed", &stats) == 1);
+    CHECK(stats.delivered == static_cast<unsigned long long>(threads * messages));
+    CHECK(stats.depth == 0);
+
+    // A new document drops the listener, which refers to this frame.
+    w.navigate("about:blank");
+    drain(w);
+  }
+
+  void test_missing_html_file(webview::webview &w)
+  {
+    // A file that cannot be opened starts no navigation.
+    auto before = w.timing().id;
+    CHECK(!w.set_html_file("/nonexistent/index.html"));
+    CHECK(w.timing().id == before);
+  }
+
+} // namespace
+
+int main()
+{
+  webview::webview w(false, nullptr);
+  std::thread driver([&]()
+                     {
+    test_call(w);
+    test_unknown(w);
+    test_cancel(w);
+    test_navigate(w);
+    test_stale_result(w);
+    test_stream(w);
+    test_channel(w);
+    test_missing_html_file(w);
+    w.dispatch([&]()
+               { w.terminate(); }); });
+  w.run();
+  driver.join();
+  if (failures > 0)
+  {
+    std::fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  std::printf("ok\n");
+  return 0;
+}
@@ -25,6 +25,8 @@
 #ifndef WEBVIEW_H
 #define WEBVIEW_H
 
+#include <stddef.h>
+
 #ifndef WEBVIEW_API
 #define WEBVIEW_API extern
 #endif
@@ -111,6 +113,25 @@ extern "C"
   // Destroys a webview and closes the native window.
   WEBVIEW_API void webview_destroy(webview_t w);
 
+  // Keeps size hidden webviews ready for webview_pool_acquire, so that
+  // opening a window does not wait for the engine to start. They are created
+  // one at a time when the main loop is idle. prepare, if not NULL, is called
+  // with each new webview to bind the functions and add the init scripts
+  // every window needs, and discard, if not NULL, after each idle webview the
+  // pool destroys when its size is lowered, to release what was kept for it;
+  // the webview is gone by then and w only identifies it. A size of 0
+  // destroys all idle webviews. Must be called on the UI thread.
+  WEBVIEW_API void webview_pool_set_size(int size, int debug,
+                                         void (*prepare)(webview_t w, void *arg),
+                                         void (*discard)(webview_t w, void *arg),
+                                         void *arg);
+
+  // Returns a ready webview from the pool, shows its window and starts
+  // creating its replacement. If none is ready, one is created on the spot.
+  // Returns NULL if it cannot be created. The webview is destroyed with
+  // webview_destroy. Must be called on the UI thread.
+  WEBVIEW_API webview_t webview_pool_acquire(void);
+
   // Runs the main loop until it's terminated. After this function exits - you
   // must destroy the webview.
   WEBVIEW_API void webview_run(webview_t w);
@@ -158,11 +179,25 @@ extern "C"
   // Example: webview_set_html(w, "<h1>Hello</h1>");
   WEBVIEW_API void webview_set_html(webview_t w, const char *html);
 
+  // Set webview HTML content from a UTF-8 file. The file is memory-mapped and
+  // handed to the browser engine without copying where the engine allows it.
+  // Returns 0 if the file cannot be opened.
+  WEBVIEW_API int webview_set_html_file(webview_t w, const char *path);
+
   // Injects JavaScript code at the initialization of the new page. Every time
   // the webview will open a the new page - this initialization code will be
   // executed. It is guaranteed that code is executed before window.onload.
   WEBVIEW_API void webview_init(webview_t w, const char *js);
 
+  // Adds an init script under the given id, or replaces the script that was
+  // previously registered with the same id. Like webview_init(), the script is
+  // executed at the initialization of every new page.
+  WEBVIEW_API void webview_set_init_script(webview_t w, const char *id,
+                                           const char *js);
+
+  // Removes an init script that was previously set by webview_set_init_script.
+  WEBVIEW_API void webview_remove_init_script(webview_t w, const char *id);
+
   // Evaluates arbitrary JavaScript code. Evaluation happens asynchronously, also
   // the result of the expression is ignored. Use RPC bindings if you want to
   // receive notifications about the results of the evaluation.
@@ -178,9 +213,255 @@ extern "C"
                                            void *arg),
                                 void *arg);
 
+  // A single native C callback binding, see webview_bind.
+  typedef struct
+  {
+    const char *name;
+    void (*fn)(const char *seq, const char *req, void *arg);
+    void *arg;
+  } webview_binding_t;
+
+  // Binds several native C callbacks at once. Equivalent to calling
+  // webview_bind for every entry, but the bindings are injected into the
+  // page in one go.
+  WEBVIEW_API void webview_bind_many(webview_t w,
+                                     const webview_binding_t *bindings,
+                                     size_t count);
+
+  // Exposes the bound functions as members of the given global object instead
+  // of as global functions. Members are created lazily on first access so the
+  // cost of a new page does not depend on the number of bindings. Pass an
+  // empty string to go back to global functions.
+  WEBVIEW_API void webview_set_binding_namespace(webview_t w, const char *ns);
+
   // Removes a native C callback that was previously set by webview_bind.
   WEBVIEW_API void webview_unbind(webview_t w, const char *name);
 
+  // Sends one chunk of the result of a streaming call, which JS started with
+  // fn.stream(...) and consumes as an async iterator. result must be a valid
+  // JSON value. The call is ended with webview_return: status zero ends the
+  // iteration, non-zero makes it throw the result. At most 16 chunks can be
+  // waiting for the iterator; called from another thread than the main
+  // thread, this function then blocks until the page has consumed a chunk.
+  // Returns 0 if the chunk was not sent, because the call is no longer
+  // pending or, on the main thread, because the page lags behind.
+  WEBVIEW_API int webview_return_chunk(webview_t w, const char *seq,
+                                       const char *result);
+
+  // Emits an event to the page, which receives it with
+  // window._rpc.subscribe(topic, fn). Events of topics without subscribers
+  // are dropped without being evaluated, and emits of a topic that have not
+  // reached the page yet are coalesced so that only the latest is delivered.
+  // It is safe to call this function from any thread. Returns 0 if the event
+  // was dropped.
+  WEBVIEW_API int webview_emit(webview_t w, const char *topic,
+                               const char *json);
+
+  // Returns 1 if the page has subscribed to the topic. Callers can use it to
+  // avoid serializing events nobody listens to. It is safe to call this
+  // function from any thread.
+  WEBVIEW_API int webview_has_subscribers(webview_t w, const char *topic);
+
+// Push channel overflow policies
+#define WEBVIEW_CHANNEL_BLOCK 0       // Posting waits while the queue is full
+#define WEBVIEW_CHANNEL_DROP_OLDEST 1 // The oldest queued message is dropped
+#define WEBVIEW_CHANNEL_COALESCE 2    // Queued messages are replaced by key
+
+  // Counters of a push channel, see webview_channel_stats.
+  typedef struct
+  {
+    // Messages posted by native code.
+    unsigned long long posted;
+    // Messages handed to the page.
+    unsigned long long delivered;
+    // Messages dropped because the queue was full.
+    unsigned long long dropped;
+    // Messages replaced by a newer message with the same key.
+    unsigned long long coalesced;
+    // Messages currently waiting in the queue.
+    size_t depth;
+    // Largest number of messages that waited in the queue at once.
+    size_t max_depth;
+    // Messages the page can still receive before it has to grant credits.
+    unsigned int credits;
+    // Messages handed to the page but not consumed yet.
+    unsigned int in_flight;
+  } webview_channel_stats_t;
+
+  // Opens a flow-controlled channel for pushing messages to the page, which
+  // receives them with window._rpc.listen(name, fn). At most window messages
+  // are in flight to the page; it grants a credit back for every message it
+  // has handled. Until then new messages wait in a queue of the given capacity
+  // that overflows according to the policy, see WEBVIEW_CHANNEL constants.
+  // Returns 0 if the policy is not one of them.
+  WEBVIEW_API int webview_channel_open(webview_t w, const char *name,
+                                       int policy, int capacity, int window);
+
+  // Posts a JSON message to a channel. key may be null; with the
+  // WEBVIEW_CHANNEL_COALESCE policy a queued message is replaced by a newer one
+  // with the same key. With WEBVIEW_CHANNEL_BLOCK this waits while the queue is
+  // full, so it must not be called from the UI thread. It is safe to call this
+  // function from any thread. Returns 0 if the channel does not exist.
+  WEBVIEW_API int webview_channel_post(webview_t w, const char *name,
+                                       const char *key, const char *json);
+
+  // Posts one message to the channel with the given name of every webview in
+  // the array. The JSON is copied once and shared by all queues, and each
+  // webview applies the policy its channel was opened with. With
+  // WEBVIEW_CHANNEL_BLOCK a full queue of one webview delays the following
+  // ones. Returns the number of webviews that accepted the message.
+  WEBVIEW_API int webview_channel_broadcast(const webview_t *ws, size_t count,
+                                            const char *name, const char *key,
+                                            const char *json);
+
+  // Reads the counters of a channel. Returns 0 if the channel does not exist.
+  WEBVIEW_API int webview_channel_stats(webview_t w, const char *name,
+                                        webview_channel_stats_t *stats);
+
+  // Sets the default timeout in milliseconds of calls to a bound function. A
+  // timeout of zero disables it. Timed out calls are rejected in JS and
+  // cancelled on the native side. JS can override the timeout per call with
+  // fn.withOptions({timeout: ms, signal: abortSignal})(...).
+  WEBVIEW_API void webview_bind_timeout(webview_t w, const char *name,
+                                        int timeout_ms);
+
+  // Sets a callback invoked when JS abandons a pending call of a bound
+  // function, either because it timed out or because its AbortSignal fired.
+  // The callback receives the seq of the call and the argument the function
+  // was bound with.
+  WEBVIEW_API void webview_bind_cancel(webview_t w, const char *name,
+                                       void (*fn)(const char *seq, void *arg));
+
+// Number of buckets of the latency histograms
+#define WEBVIEW_LATENCY_BUCKETS 24
+
+  // Counters of a bound function, see webview_binding_stats.
+  typedef struct
+  {
+    // Calls received from JS.
+    unsigned long long calls;
+    // Calls returned with a non-zero status.
+    unsigned long long errors;
+    // Calls cancelled by JS.
+    unsigned long long cancelled;
+    // Bytes of the received call messages.
+    unsigned long long bytes_in;
+    // Bytes of the returned results, including streamed chunks.
+    unsigned long long bytes_out;
+    // Calls received but not returned or cancelled yet.
+    unsigned int in_flight;
+    // Sum of the latencies of all returned calls in microseconds.
+    unsigned long long latency_total_us;
+    // Number of returned calls by latency, from receiving the call to
+    // evaluating its result in the page. Bucket 0 counts latencies below 2us,
+    // bucket i those in [2^i, 2^(i+1)) us, the last bucket all longer ones.
+    unsigned long long latency_histogram[WEBVIEW_LATENCY_BUCKETS];
+  } webview_binding_stats_t;
+
+  // Counters of the dispatch queue, see webview_dispatch_stats.
+  typedef struct
+  {
+    // Tasks posted with webview_dispatch or internally.
+    unsigned long long posted;
+    // Tasks that have run.
+    unsigned long long run;
+    // Tasks waiting in the queue.
+    unsigned long long depth;
+    // Largest number of tasks that waited in the queue at once.
+    unsigned long long max_depth;
+    // Sum of the waits of all tasks that have run in microseconds.
+    unsigned long long wait_total_us;
+    // Number of tasks by wait from posting to running, in the same buckets as
+    // webview_binding_stats_t::latency_histogram.
+    unsigned long long wait_histogram[WEBVIEW_LATENCY_BUCKETS];
+    // Number of times the queue drained by the number of tasks run since it
+    // was last empty: bucket 0 counts single tasks, bucket i batches of
+    // [2^i, 2^(i+1)) tasks.
+    unsigned long long batch_histogram[WEBVIEW_LATENCY_BUCKETS];
+  } webview_dispatch_stats_t;
+
+  // Reads the counters of the dispatch queue. They are kept for the lifetime
+  // of the webview, so compare two reads to measure an interval.
+  WEBVIEW_API void webview_dispatch_stats(webview_t w,
+                                          webview_dispatch_stats_t *stats);
+
+  // Reads the counters of a bound function. Returns 0 if it is not bound.
+  // A NULL name reads the counters of the calls to names that are not bound.
+  // Safe to call from any thread.
+  WEBVIEW_API int webview_binding_stats(webview_t w, const char *name,
+                                        webview_binding_stats_t *stats);
+
+  // Counters of the stall watchdog, see webview_set_stall_watchdog.
+  typedef struct
+  {
+    // Bound callbacks and dispatched functions that ran over the threshold.
+    unsigned long long stalls;
+    // Main loop heartbeats that waited over the threshold outside of them.
+    unsigned long long main_loop_stalls;
+    // Longest stall seen in milliseconds.
+    long long longest_ms;
+  } webview_stall_stats_t;
+
+  // Starts a watchdog thread that reports bound callbacks and dispatched
+  // functions blocking the UI thread for threshold_ms or longer. fn is called
+  // on the watchdog thread with the site ("binding:<name>", "dispatch:<site>"
+  // or "main loop"), the elapsed milliseconds and finished set to 0 when the
+  // stall is detected and to 1 when the stalled function returns. A threshold
+  // of 0 or a NULL fn stops the watchdog. Must be called on the UI thread.
+  WEBVIEW_API void webview_set_stall_watchdog(
+      webview_t w, int threshold_ms,
+      void (*fn)(webview_t w, const char *site, long long elapsed_ms,
+                 int finished, void *arg),
+      void *arg);
+
+  // Reads the counters of the stall watchdog.
+  WEBVIEW_API void webview_stall_stats(webview_t w,
+                                       webview_stall_stats_t *stats);
+
+// Navigation milestones, see webview_set_navigation_timing_callback
+#define WEBVIEW_NAVIGATION_STARTED 0            // Navigation or set_html called
+#define WEBVIEW_NAVIGATION_COMMITTED 1          // The new document started
+#define WEBVIEW_NAVIGATION_DOM_CONTENT_LOADED 2 // DOMContentLoaded fired
+#define WEBVIEW_NAVIGATION_LOAD_FINISHED 3      // The load event fired
+#define WEBVIEW_NAVIGATION_FIRST_PAINT 4        // The first content was painted
+
+  // Timing of the latest navigation, see webview_navigation_timing.
+  typedef struct
+  {
+    // Increases with every navigation, from native code or from the page.
+    unsigned long long id;
+    // Milliseconds from the start of the navigation, -1 until reached.
+    double committed_ms;
+    double dom_content_loaded_ms;
+    double load_finished_ms;
+    double first_paint_ms;
+  } webview_navigation_timing_t;
+
+  // Reads the timing of the latest navigation. A navigation starts when
+  // webview_navigate or webview_set_html is called, or when the page itself
+  // navigates. Committed and load finished come from the engine's load
+  // events where it has them (WebKitGTK), the other milestones from a script
+  // injected into every document. It is safe to call this function from any
+  // thread.
+  WEBVIEW_API void webview_navigation_timing(webview_t w,
+                                             webview_navigation_timing_t *timing);
+
+  // Calls fn on the UI thread whenever the latest navigation reaches a
+  // milestone, one of the WEBVIEW_NAVIGATION_* constants, with the URL of
+  // the navigation (empty for webview_set_html until the engine reports it).
+  // Each milestone is reported at most once per navigation. A NULL fn
+  // removes the callback.
+  WEBVIEW_API void webview_set_navigation_timing_callback(
+      webview_t w,
+      void (*fn)(webview_t w, int milestone, const char *url,
+                 const webview_navigation_timing_t *timing, void *arg),
+      void *arg);
+
+  // Returns 1 if the call identified by seq is no longer pending, because JS
+  // cancelled it or because it was already returned. Long running bindings
+  // can poll this to stop early. It is safe to call from any thread.
+  WEBVIEW_API int webview_is_cancelled(webview_t w, const char *seq);
+
   // Allows to return a value from the native binding. Original request pointer
   // must be provided to help internal RPC engine match requests with responses.
   // If status is zero - result is expected to be a valid JSON result value.
@@ -195,16 +476,121 @@ extern "C"
   // return 0 if the operation failed
   WEBVIEW_API int webview_set_virtual_host_name(webview_t w, const char *url, const char *folder, const int option);
 
+  // Like webview_set_virtual_host_name, but serves the host from an asset
+  // bundle built by tools/bundle: the bundle is mapped once and entries are
+  // looked up by path hash, without opening files. Returns 0 if the bundle
+  // is invalid or the backend has no custom schemes, see
+  // webview_register_scheme.
+  WEBVIEW_API int webview_set_virtual_host_bundle(webview_t w, const char *host,
+                                                  const char *bundle,
+                                                  const int option);
+
+  // Watches folder, served at host by webview_set_virtual_host_name, and
+  // updates the page when files in it are written: linked stylesheets are
+  // swapped in place, modules that called
+  // window._webviewHot.accept(import.meta.url, fn) are imported again and
+  // passed to fn, and any other change reloads the page. A NULL or empty
+  // folder stops watching host. Returns 0 if the folder cannot be watched,
+  // which is always the case on the backends other than WebKitGTK.
+  WEBVIEW_API int webview_hot_reload(webview_t w, const char *host,
+                                     const char *folder);
+
+  // Counters of the cache of files served from virtual host folders, which
+  // all webviews of the process share.
+  typedef struct
+  {
+    unsigned long long hits;
+    unsigned long long misses;
+    // Entries dropped to stay within the capacity.
+    unsigned long long evictions;
+    // Entries dropped because the file or its directory changed on disk.
+    unsigned long long invalidations;
+    unsigned long long entries;
+    unsigned long long bytes;
+    unsigned long long capacity;
+  } webview_asset_cache_stats_t;
+
+  // Bounds the cache of files served from virtual host folders to bytes, 32
+  // MiB by default, 0 disables it. Files larger than 1/16 of the capacity are
+  // never cached. The cache watches the folders with inotify, so it is only
+  // used on Linux.
+  WEBVIEW_API void webview_set_asset_cache_capacity(size_t bytes);
+
+  // Reads the counters of the asset cache.
+  WEBVIEW_API void webview_asset_cache_stats(webview_asset_cache_stats_t *stats);
+
+  // A request to a custom URI scheme, see webview_register_scheme.
+  typedef struct webview_scheme_request webview_scheme_request_t;
+
+  // Serves every URI of scheme (ex: "app" for app://assets/logo.png) from fn,
+  // so pages can fetch() binary data from native code without JSON or base64.
+  // fn is called on the UI thread and must answer each request exactly once
+  // with webview_scheme_respond, webview_scheme_respond_stream or
+  // webview_scheme_fail, before returning or later on the UI thread. The
+  // scheme is treated as secure and CORS enabled. Returns 0 if the backend
+  // cannot register custom schemes, currently only WebKitGTK can.
+  WEBVIEW_API int webview_register_scheme(
+      webview_t w, const char *scheme,
+      void (*fn)(webview_t w, webview_scheme_request_t *req, void *arg),
+      void *arg);
+
+  // Returns the URI of a scheme request and its path.
+  WEBVIEW_API const char *webview_scheme_request_uri(webview_scheme_request_t *req);
+  WEBVIEW_API const char *webview_scheme_request_path(webview_scheme_request_t *req);
+
+  // Adds a header to the response, before answering. Headers and status codes
+  // other than 200 need WebKitGTK 2.36 or newer.
+  WEBVIEW_API void webview_scheme_set_header(webview_scheme_request_t *req,
+                                             const char *name,
+                                             const char *value);
+
+  // Answers with size bytes of data. If release is NULL the data is copied,
+  // otherwise it is used in place and release(arg) is called once the engine
+  // no longer needs it.
+  WEBVIEW_API void webview_scheme_respond(webview_scheme_request_t *req,
+                                          int status, const char *mime,
+                                          const void *data, size_t size,
+                                          void (*release)(void *arg),
+                                          void *arg);
+
+  // Answers with a stream of size bytes, or -1 if the length is unknown.
+  // read(buf, size, arg) fills buf and returns the number of bytes read, 0 at
+  // the end or -1 on error; it may be called on a worker thread. close(arg)
+  // is called once the engine is done with the stream.
+  WEBVIEW_API void webview_scheme_respond_stream(
+      webview_scheme_request_t *req, int status, const char *mime,
+      long long size, long long (*read)(void *buf, size_t size, void *arg),
+      void (*close)(void *arg), void *arg);
+
+  // Fails the request, the page sees a network error.
+  WEBVIEW_API void webview_scheme_fail(webview_scheme_request_t *req,
+                                       const char *message);
+
   // Get the library's version information.
   // @since 0.10
   WEBVIEW_API const webview_version_info_t *webview_version();
 
+  // Starts recording spans of the native hot path (on_message, bindings,
+  // resolve, dispatch, eval, navigate, set_html) in every webview of the
+  // process. Each thread keeps its last events_per_thread spans. Anything
+  // recorded before is dropped.
+  WEBVIEW_API void webview_trace_start(size_t events_per_thread);
+
+  // Stops recording spans. Recorded spans are kept until the next start.
+  WEBVIEW_API void webview_trace_stop(void);
+
+  // Writes the recorded spans to path as Chrome trace-event JSON, which can be
+  // opened in Perfetto or chrome://tracing. Returns 0 if the file could not be
+  // written.
+  WEBVIEW_API int webview_trace_dump(const char *path);
+
 #ifdef __cplusplus
 }
 
 #ifndef WEBVIEW_HEADER
 
-#if !defined(WEBVIEW_GTK) && !defined(WEBVIEW_COCOA) && !defined(WEBVIEW_EDGE)
+#if !defined(WEBVIEW_GTK) && !defined(WEBVIEW_COCOA) && !defined(WEBVIEW_EDGE) && \
+    !defined(WEBVIEW_HEADLESS)
 #if defined(__APPLE__)
 #define WEBVIEW_COCOA
 #elif defined(__unix__)
@@ -231,17 +617,64 @@ extern "C"
   WEBVIEW_DEPRECATED("Private API should not be used")
 #endif
 
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <future>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 
+// Static user-level tracepoints for bpftrace and perf on Linux, see
+// tools/bpftrace. Each probe is a single nop until a tracer attaches to it.
+// They are only built when <sys/sdt.h> is available and WEBVIEW_NO_USDT is
+// not defined. Probes of the "webview" provider, all starting with the
+// webview pointer:
+//   message(handle, bytes)                  a message arrived from JS
+//   callback__entry(handle, seq, name, bytes) a bound function is called
+//   callback__return(handle, seq)           the bound function returned
+//   resolve(handle, seq, status, bytes)     a call is returned to JS
+//   dispatch__post(handle, id)              a function is queued to the UI thread
+//   dispatch__run(handle, id)               the queued function starts
+//   dispatch__done(handle, id)              the queued function finished
+//   eval(handle, bytes)                     a script is submitted to the page
+#if defined(__linux__) && !defined(WEBVIEW_NO_USDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define WEBVIEW_USDT
+#endif
+#endif
+
+#ifdef WEBVIEW_USDT
+#define WEBVIEW_PROBE2(name, a1, a2) DTRACE_PROBE2(webview, name, a1, a2)
+#define WEBVIEW_PROBE3(name, a1, a2, a3) \
+  DTRACE_PROBE3(webview, name, a1, a2, a3)
+#define WEBVIEW_PROBE4(name, a1, a2, a3, a4) \
+  DTRACE_PROBE4(webview, name, a1, a2, a3, a4)
+#else
+#define WEBVIEW_PROBE2(name, a1, a2) ((void)0)
+#define WEBVIEW_PROBE3(name, a1, a2, a3) ((void)0)
+#define WEBVIEW_PROBE4(name, a1, a2, a3, a4) ((void)0)
+#endif
+
 namespace webview
 {
 
@@ -457,8 +890,45 @@ namespace webview
 
     inline std::string json_escape(const std::string &s)
     {
-      // TODO: implement
-      return '"' + s + '"';
+      static constexpr char hex[] = "0123456789abcdef";
+      std::string r;
+      r.reserve(s.size() + 2);
+      r += '"';
+      for (auto c : s)
+      {
+        auto uc = static_cast<unsigned char>(c);
+        switch (c)
+        {
+        case '"':
+          r += "\\\"";
+          break;
+        case '\\':
+          r += "\\\\";
+          break;
+        case '\n':
+          r += "\\n";
+          break;
+        case '\r':
+          r += "\\r";
+          break;
+        case '\t':
+          r += "\\t";
+          break;
+        default:
+          if (uc < 0x20)
+          {
+            r += "\\u00";
+            r += hex[uc >> 4];
+            r += hex[uc & 0xf];
+          }
+          else
+          {
+            r += c;
+          }
+        }
+      }
+      r += '"';
+      return r;
     }
 
     inline int json_unescape(const char *s, size_t n, char *out)
@@ -557,686 +1027,926 @@ namespace webview
       return "";
     }
 
-  } // namespace detail
-
-  WEBVIEW_DEPRECATED_PRIVATE
-  inline int json_parse_c(const char *s, size_t sz, const char *key, size_t keysz,
-                          const char **value, size_t *valuesz)
-  {
-    return detail::json_parse_c(s, sz, key, keysz, value, valuesz);
-  }
-
-  WEBVIEW_DEPRECATED_PRIVATE
-  inline std::string json_escape(const std::string &s)
-  {
-    return detail::json_escape(s);
-  }
-
-  WEBVIEW_DEPRECATED_PRIVATE
-  inline int json_unescape(const char *s, size_t n, char *out)
-  {
-    return detail::json_unescape(s, n, out);
-  }
-
-  WEBVIEW_DEPRECATED_PRIVATE
-  inline std::string json_parse(const std::string &s, const std::string &key,
-                                const int index)
-  {
-    return detail::json_parse(s, key, index);
-  }
-
-} // namespace webview
-
-#if defined(WEBVIEW_GTK)
-//
-// ====================================================================
-//
-// This implementation uses webkit2gtk backend. It requires gtk+3.0 and
-// webkit2gtk-4.0 libraries. Proper compiler flags can be retrieved via:
-//
-//   pkg-config --cflags --libs gtk+-3.0 webkit2gtk-4.0
-//
-// ====================================================================
-//
-#include <JavaScriptCore/JavaScript.h>
-#include <gtk/gtk.h>
-#include <webkit2/webkit2.h>
-
-namespace webview
-{
-  namespace detail
-  {
-
-    class gtk_webkit_engine
+    // Ordered collection of the scripts injected at the start of every new
+    // document. Engines remove all installed user scripts and add the live
+    // entries again whenever the collection changes, so the work done per
+    // navigation is proportional to the live set rather than to the history
+    // of init() calls. Each entry stays a user script of its own: top-level
+    // let, const and class declarations remain global, and a script that
+    // throws does not stop the following ones.
+    class user_script_registry
     {
     public:
-      gtk_webkit_engine(bool debug, void *window)
-          : m_window(static_cast<GtkWidget *>(window))
+      // Appends an anonymous script. Anonymous scripts live as long as the
+      // webview itself.
+      void add(const std::string &js) { m_scripts.emplace_back(std::string(), js); }
+
+      // Adds the script with the given id, or replaces it in place if the id
+      // is already known. Returns false if nothing changed.
+      bool set(const std::string &id, const std::string &js)
       {
-        if (gtk_init_check(nullptr, nullptr) == FALSE)
+        for (auto &script : m_scripts)
         {
-          return;
+          if (!id.empty() && script.first == id)
+          {
+            if (script.second == js)
+            {
+              return false;
+            }
+            script.second = js;
+            return true;
+          }
         }
-        m_window = static_cast<GtkWidget *>(window);
-        if (m_window == nullptr)
+        m_scripts.emplace_back(id, js);
+        return true;
+      }
+
+      // Removes the script with the given id. Returns false if there was none.
+      bool remove(const std::string &id)
+      {
+        for (auto it = m_scripts.begin(); it != m_scripts.end(); ++it)
         {
-          m_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+          if (!id.empty() && it->first == id)
+          {
+            m_scripts.erase(it);
+            return true;
+          }
         }
-        g_signal_connect(G_OBJECT(m_window), "destroy",
-                         G_CALLBACK(+[](GtkWidget *, gpointer arg)
-                                    {
-                                      static_cast<gtk_webkit_engine *>(arg)->terminate();
-                                    }),
-                         this);
-        // Initialize webview widget
-        m_webview = webkit_web_view_new();
-        WebKitUserContentManager *manager =
-            webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(m_webview));
-        g_signal_connect(manager, "script-message-received::external",
-                         G_CALLBACK(+[](WebKitUserContentManager *,
-                                        WebKitJavascriptResult *r, gpointer arg)
-                                    {
-                                      auto *w = static_cast<gtk_webkit_engine *>(arg);
-                                      char *s = get_string_from_js_result(r);
-                                      w->on_message(s);
-                                      g_free(s);
-                                    }),
-                         this);
-        webkit_user_content_manager_register_script_message_handler(manager,
-                                                                    "external");
-        init("window.external={invoke:function(s){window.webkit.messageHandlers."
-             "external.postMessage(s);}}");
+        return false;
+      }
 
-        gtk_container_add(GTK_CONTAINER(m_window), GTK_WIDGET(m_webview));
-        gtk_widget_grab_focus(GTK_WIDGET(m_webview));
+      std::size_t size() const { return m_scripts.size(); }
 
-        WebKitSettings *settings =
-            webkit_web_view_get_settings(WEBKIT_WEB_VIEW(m_webview));
-        webkit_settings_set_javascript_can_access_clipboard(settings, true);
-        if (debug)
+      // The sources of all scripts, in order.
+      std::vector<std::string> scripts() const
+      {
+        std::vector<std::string> sources;
+        sources.reserve(m_scripts.size());
+        for (const auto &script : m_scripts)
         {
-          webkit_settings_set_enable_write_console_messages_to_stdout(settings,
-                                                                      true);
-          webkit_settings_set_enable_developer_extras(settings, true);
+          sources.push_back(script.second);
         }
+        return sources;
+      }
 
-        gtk_widget_show_all(m_window);
+    private:
+      std::vector<std::pair<std::string, std::string>> m_scripts;
+    };
+
+    // A request to a custom URI scheme. The handler answers it exactly once,
+    // on the UI thread, either before returning or later. Engines subclass it
+    // and the request deletes itself once answered.
+    class scheme_request
+    {
+    public:
+      // Called with the argument given along with the data or the reader.
+      using release_fn_t = void (*)(void *arg);
+      // Reads up to size bytes into buf. Returns the number of bytes read, 0
+      // at the end of the stream or -1 on error.
+      using read_fn_t = long long (*)(void *buf, std::size_t size, void *arg);
+
+      virtual ~scheme_request() = default;
+
+      const std::string &uri() const { return m_uri; }
+      const std::string &path() const { return m_path; }
+
+      // Returns the value of a request header, or an empty string if it is
+      // absent or the engine does not expose request headers.
+      virtual std::string header(const std::string &name) const = 0;
+
+      // Adds a header to the response, before answering.
+      void set_header(const std::string &name, const std::string &value)
+      {
+        m_headers.emplace_back(name, value);
       }
-      virtual ~gtk_webkit_engine() = default;
-      void *window() { return (void *)m_window; }
-      void run() { gtk_main(); }
-      void terminate() { gtk_main_quit(); }
-      void dispatch(std::function<void()> f)
+
+      // Answers with size bytes of data. The data is copied unless release is
+      // given, in which case it is used in place until release(arg).
+      virtual void respond(int status, const std::string &mime,
+                           const void *data, std::size_t size,
+                           release_fn_t release, void *arg) = 0;
+
+      // Answers with the bytes of read, size is -1 if the length is unknown.
+      // close(arg) is called once the engine is done with the stream.
+      virtual void respond_stream(int status, const std::string &mime,
+                                  long long size, read_fn_t read,
+                                  release_fn_t close, void *arg) = 0;
+
+      // Answers with data compressed with encoding ("gzip" or "br"), which
+      // decodes to decoded_size bytes, or -1 if unknown. Engines that cannot
+      // hand a compressed body to the page decode it as the page reads it.
+      // Returns false without answering if the encoding is not supported.
+      virtual bool respond_encoded(int status, const std::string &mime,
+                                   const std::string &encoding,
+                                   const void *data, std::size_t size,
+                                   long long decoded_size, release_fn_t release,
+                                   void *arg) = 0;
+
+      // Fails the request, the page sees a network error.
+      virtual void fail(const std::string &message) = 0;
+
+    protected:
+      std::string m_uri;
+      std::string m_path;
+      std::vector<std::pair<std::string, std::string>> m_headers;
+    };
+
+    using scheme_handler_t = std::function<void(scheme_request *)>;
+
+    // A histogram with power of two buckets: bucket 0 counts values below 2,
+    // bucket i those in [2^i, 2^(i+1)) and the last bucket everything larger.
+    // Durations are recorded in microseconds. Recording is a couple of relaxed
+    // atomic increments, so it can stay enabled in production.
+    class log2_histogram
+    {
+    public:
+      static constexpr std::size_t buckets = 24;
+
+      void record(unsigned long long value)
       {
-        g_idle_add_full(G_PRIORITY_HIGH_IDLE, (GSourceFunc)([](void *f) -> int
-                                                            {
-                      (*static_cast<dispatch_fn_t *>(f))();
-                      return G_SOURCE_REMOVE; }),
-                        new std::function<void()>(f),
-                        [](void *f)
-                        { delete static_cast<dispatch_fn_t *>(f); });
+        m_total.fetch_add(value, std::memory_order_relaxed);
+        std::size_t bucket = 0;
+        while (value > 1 && bucket < buckets - 1)
+        {
+          value >>= 1;
+          bucket++;
+        }
+        m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
       }
 
-      void set_title(const std::string &title)
+      void record(std::chrono::steady_clock::duration d)
       {
-        gtk_window_set_title(GTK_WINDOW(m_window), title.c_str());
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(d);
+        record(static_cast<unsigned long long>(std::max<long long>(us.count(), 0)));
       }
 
-      void set_size(int width, int height, int hints)
+      void snapshot(unsigned long long *out, unsigned long long *total) const
       {
-        gtk_window_set_resizable(GTK_WINDOW(m_window), hints != WEBVIEW_HINT_FIXED);
-        if (hints == WEBVIEW_HINT_NONE)
+        for (std::size_t i = 0; i < buckets; i++)
         {
-          gtk_window_resize(GTK_WINDOW(m_window), width, height);
+          out[i] = m_buckets[i].load(std::memory_order_relaxed);
         }
-        else if (hints == WEBVIEW_HINT_FIXED)
+        *total = m_total.load(std::memory_order_relaxed);
+      }
+
+    private:
+      std::array<std::atomic<unsigned long long>, buckets> m_buckets{};
+      std::atomic<unsigned long long> m_total{0};
+    };
+
+    // Counters of the dispatch queue of a webview. Tasks are timestamped when
+    // posted; the wait until they run, the queue depth and the number of tasks
+    // run back to back before the queue drains are recorded with relaxed
+    // atomics.
+    struct dispatch_stats
+    {
+      std::atomic<unsigned long long> posted{0};
+      std::atomic<unsigned long long> run{0};
+      std::atomic<unsigned long long> max_depth{0};
+      // Microseconds from posting a task to running it.
+      log2_histogram wait;
+      // Tasks run between the queue becoming non-empty and empty again.
+      log2_histogram batch;
+      // Only touched on the UI thread.
+      unsigned long long current_batch = 0;
+      // Set on the UI thread when the webview is destroyed. The tasks still
+      // queued in the engine then run nothing, since they refer to it.
+      bool closed = false;
+
+      void on_post()
+      {
+        auto depth = posted.fetch_add(1, std::memory_order_relaxed) + 1 -
+                     run.load(std::memory_order_relaxed);
+        auto max = max_depth.load(std::memory_order_relaxed);
+        while (depth > max &&
+               !max_depth.compare_exchange_weak(max, depth,
+                                                std::memory_order_relaxed))
         {
-          gtk_widget_set_size_request(m_window, width, height);
         }
-        else
+      }
+
+      void on_run(std::chrono::steady_clock::duration waited)
+      {
+        wait.record(waited);
+        current_batch++;
+        auto done = run.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (done >= posted.load(std::memory_order_relaxed))
         {
-          GdkGeometry g;
-          g.min_width = g.max_width = width;
-          g.min_height = g.max_height = height;
-          GdkWindowHints h =
-              (hints == WEBVIEW_HINT_MIN ? GDK_HINT_MIN_SIZE : GDK_HINT_MAX_SIZE);
-          // This defines either MIN_SIZE, or MAX_SIZE, but not both:
-          gtk_window_set_geometry_hints(GTK_WINDOW(m_window), nullptr, &g, h);
+          batch.record(current_batch);
+          current_batch = 0;
         }
       }
+    };
 
-      void navigate(const std::string &url)
+    // Records spans of the native hot path into per-thread ring buffers and
+    // writes them out as Chrome trace-event JSON, which Perfetto and
+    // chrome://tracing can load. Each thread only ever writes to its own ring,
+    // so recording takes no lock; the registry lock is only taken the first
+    // time a thread records after start(). While stopped a span costs one
+    // relaxed load and a branch.
+    class tracer
+    {
+    public:
+      using clock = std::chrono::steady_clock;
+
+      struct event
+      {
+        const char *name;
+        char detail[40];
+        // Optional numeric argument, printed when num_key is set.
+        const char *num_key;
+        long long num;
+        clock::time_point start;
+        clock::duration duration;
+      };
+
+      static bool enabled()
       {
-        webkit_web_view_load_uri(WEBKIT_WEB_VIEW(m_webview), url.c_str());
+        return s_enabled.load(std::memory_order_relaxed);
       }
 
-      void set_html(const std::string &html)
+      // Drops everything recorded so far and starts recording, keeping the
+      // last events_per_thread events of every thread.
+      static void start(std::size_t events_per_thread)
       {
-        webkit_web_view_load_html(WEBKIT_WEB_VIEW(m_webview), html.c_str(),
-                                  nullptr);
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_rings.clear();
+        s_capacity = events_per_thread > 0 ? events_per_thread : 1;
+        s_generation.fetch_add(1, std::memory_order_release);
+        s_enabled.store(true, std::memory_order_relaxed);
       }
 
-      void init(const std::string &js)
+      static void stop() { s_enabled.store(false, std::memory_order_relaxed); }
+
+      static void record(const char *name, const char *detail,
+                         std::size_t detail_len, const char *num_key,
+                         long long num, clock::time_point start,
+                         clock::time_point end)
       {
-        WebKitUserContentManager *manager =
-            webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(m_webview));
-        webkit_user_content_manager_add_script(
-            manager,
-            webkit_user_script_new(js.c_str(), WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
-                                   WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START,
-                                   nullptr, nullptr));
+        auto r = local_ring();
+        auto head = r->head.load(std::memory_order_relaxed);
+        auto &e = r->events[head % r->events.size()];
+        e.name = name;
+        detail_len = std::min(detail_len, sizeof(e.detail) - 1);
+        std::memcpy(e.detail, detail, detail_len);
+        e.detail[detail_len] = '\0';
+        e.num_key = num_key;
+        e.num = num;
+        e.start = start;
+        e.duration = end - start;
+        r->head.store(head + 1, std::memory_order_release);
       }
 
-      void eval(const std::string &js)
+      // Returns the recorded events as a trace-event JSON document. Rings are
+      // overwritten while recording, so call stop() first for a consistent
+      // snapshot.
+      static std::string dump()
       {
-        webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(m_webview), js.c_str(),
-                                       nullptr, nullptr, nullptr);
+        std::lock_guard<std::mutex> lock(s_mutex);
+        std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+        out += "{\"ph\":\"M\",\"pid\":1,\"tid\":0,\"name\":\"process_name\","
+               "\"args\":{\"name\":\"webview\"}}";
+        for (const auto &r : s_rings)
+        {
+          out += ",{\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(r->tid) +
+                 ",\"name\":\"thread_name\",\"args\":{\"name\":\"webview " +
+                 std::to_string(r->tid) + "\"}}";
+          auto head = r->head.load(std::memory_order_acquire);
+          auto size = r->events.size();
+          for (auto i = head > size ? head - size : 0; i < head; i++)
+          {
+            const auto &e = r->events[i % size];
+            out += ",{\"ph\":\"X\",\"cat\":\"webview\",\"pid\":1,\"tid\":" +
+                   std::to_string(r->tid) + ",\"name\":\"" + e.name +
+                   "\",\"ts\":" + micros(e.start.time_since_epoch()) +
+                   ",\"dur\":" + micros(e.duration) + ",\"args\":{";
+            out += "\"detail\":" + json_escape(e.detail);
+            if (e.num_key != nullptr)
+            {
+              out += ",\"" + std::string(e.num_key) +
+                     "\":" + std::to_string(e.num);
+            }
+            out += "}}";
+          }
+        }
+        out += "]}";
+        return out;
       }
 
     private:
-      virtual void on_message(const std::string &msg) = 0;
+      struct ring
+      {
+        std::vector<event> events;
+        std::atomic<std::size_t> head{0};
+        unsigned int tid = 0;
+        unsigned int generation = 0;
+      };
 
-      static char *get_string_from_js_result(WebKitJavascriptResult *r)
+      static std::string micros(clock::duration d)
       {
-        char *s;
-#if WEBKIT_MAJOR_VERSION >= 2 && WEBKIT_MINOR_VERSION >= 22
-        JSCValue *value = webkit_javascript_result_get_js_value(r);
-        s = jsc_value_to_string(value);
-#else
-        JSGlobalContextRef ctx = webkit_javascript_result_get_global_context(r);
-        JSValueRef value = webkit_javascript_result_get_value(r);
-        JSStringRef js = JSValueToStringCopy(ctx, value, nullptr);
-        size_t n = JSStringGetMaximumUTF8CStringSize(js);
-        s = g_new(char, n);
-        JSStringGetUTF8CString(js, s, n);
-        JSStringRelease(js);
-#endif
-        return s;
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        return std::to_string(ns / 1000) + "." +
+               std::to_string(1000 + ns % 1000).substr(1);
       }
 
-      GtkWidget *m_window;
-      GtkWidget *m_webview;
-    };
-
-  } // namespace detail
-
-  using browser_engine = detail::gtk_webkit_engine;
+      static ring *local_ring()
+      {
+        thread_local std::shared_ptr<ring> local;
+        auto generation = s_generation.load(std::memory_order_acquire);
+        if (!local || local->generation != generation)
+        {
+          std::lock_guard<std::mutex> lock(s_mutex);
+          local = std::make_shared<ring>();
+          local->events.resize(s_capacity);
+          local->tid = static_cast<unsigned int>(s_rings.size()) + 1;
+          local->generation = generation;
+          s_rings.push_back(local);
+        }
+        return local.get();
+      }
 
-} // namespace webview
+      inline static std::atomic<bool> s_enabled{false};
+      inline static std::atomic<unsigned int> s_generation{0};
+      inline static std::mutex s_mutex;
+      inline static std::vector<std::shared_ptr<ring>> s_rings;
+      inline static std::size_t s_capacity = 1;
+    };
 
-#elif defined(WEBVIEW_COCOA)
-
-//
-// ====================================================================
-//
-// This implementation uses Cocoa WKWebView backend on macOS. It is
-// written using ObjC runtime and uses WKWebView class as a browser runtime.
-// You should pass "-framework Webkit" flag to the compiler.
-//
-// ====================================================================
-//
-
-#include <CoreGraphics/CoreGraphics.h>
-#include <objc/NSObjCRuntime.h>
-#include <objc/objc-runtime.h>
-
-namespace webview
-{
-  namespace detail
-  {
-    namespace objc
+    // Records the lifetime of a scope as a trace span when tracing is on. The
+    // detail string is copied when the span ends, so it must outlive the span.
+    class trace_span
     {
-
-      // A convenient template function for unconditionally casting the specified
-      // C-like function into a function that can be called with the given return
-      // type and arguments. Caller takes full responsibility for ensuring that
-      // the function call is valid. It is assumed that the function will not
-      // throw exceptions.
-      template <typename Result, typename Callable, typename... Args>
-      Result invoke(Callable callable, Args... args) noexcept
+    public:
+      explicit trace_span(const char *name, const char *num_key = nullptr,
+                          long long num = 0)
       {
-        return reinterpret_cast<Result (*)(Args...)>(callable)(args...);
+        if (tracer::enabled())
+        {
+          m_name = name;
+          m_num_key = num_key;
+          m_num = num;
+          m_start = tracer::clock::now();
+        }
       }
-
-      // Calls objc_msgSend.
-      template <typename Result, typename... Args>
-      Result msg_send(Args... args) noexcept
+      trace_span(const char *name, const std::string &detail,
+                 const char *num_key = nullptr, long long num = 0)
+          : trace_span(name, num_key, num)
       {
-        return invoke<Result>(objc_msgSend, args...);
+        m_detail = detail.data();
+        m_detail_len = detail.size();
       }
+      trace_span(const char *name, std::string &&detail,
+                 const char *num_key = nullptr, long long num = 0) = delete;
+      ~trace_span()
+      {
+        if (m_name != nullptr)
+        {
+          tracer::record(m_name, m_detail, m_detail_len, m_num_key, m_num,
+                         m_start, tracer::clock::now());
+        }
+      }
+      trace_span(const trace_span &) = delete;
+      trace_span &operator=(const trace_span &) = delete;
 
-    } // namespace objc
-
-    enum NSBackingStoreType : NSUInteger
-    {
-      NSBackingStoreBuffered = 2
-    };
-
-    enum NSWindowStyleMask : NSUInteger
-    {
-      NSWindowStyleMaskTitled = 1,
-      NSWindowStyleMaskClosable = 2,
-      NSWindowStyleMaskMiniaturizable = 4,
-      NSWindowStyleMaskResizable = 8
+    private:
+      const char *m_name = nullptr;
+      const char *m_detail = "";
+      std::size_t m_detail_len = 0;
+      const char *m_num_key = nullptr;
+      long long m_num = 0;
+      tracer::clock::time_point m_start;
     };
 
-    enum NSApplicationActivationPolicy : NSInteger
+    // Watches the UI thread for functions that keep it busy longer than a
+    // threshold. The UI thread marks the start and end of every bound callback
+    // and dispatched function, and a watchdog thread polls those marks. It
+    // also posts heartbeats to the main loop to catch stalls outside of them.
+    // Reports are made on the watchdog thread, so they arrive while the UI
+    // thread is still stuck.
+    class stall_watchdog
     {
-      NSApplicationActivationPolicyRegular = 0
-    };
+    public:
+      using clock = std::chrono::steady_clock;
+      // Called with the site, the elapsed milliseconds and whether the stalled
+      // function has finished. A stall is reported once when it crosses the
+      // threshold and once more when it finishes.
+      using report_t = std::function<void(const std::string &, long long, bool)>;
+      using post_t = std::function<void(std::function<void()>)>;
+
+      struct counters
+      {
+        // Callbacks and dispatched functions that ran over the threshold
+        unsigned long long stalls = 0;
+        // Heartbeats that waited over the threshold outside of those
+        unsigned long long main_loop_stalls = 0;
+        long long longest_ms = 0;
+      };
 
-    enum WKUserScriptInjectionTime : NSInteger
-    {
-      WKUserScriptInjectionTimeAtDocumentStart = 0
-    };
+    private:
+      struct activity
+      {
+        std::string site;
+        clock::time_point start;
+        bool reported;
+      };
 
-    enum NSModalResponse : NSInteger
-    {
-      NSModalResponseOK = 1
-    };
+      struct report
+      {
+        std::string site;
+        long long elapsed_ms;
+        bool finished;
+      };
 
-    // Convenient conversion of string literals.
-    inline id operator"" _cls(const char *s, std::size_t)
-    {
-      return (id)objc_getClass(s);
-    }
-    inline SEL operator"" _sel(const char *s, std::size_t)
-    {
-      return sel_registerName(s);
-    }
-    inline id operator"" _str(const char *s, std::size_t)
-    {
-      return objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel, s);
-    }
+      struct state
+      {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stopped = false;
+        clock::duration threshold;
+        report_t on_report;
+        post_t post;
+        // Functions running on the UI thread, innermost last.
+        std::vector<activity> running;
+        bool heartbeat_pending = false;
+        bool heartbeat_reported = false;
+        clock::time_point heartbeat_posted;
+        // Stalls found on the UI thread, waiting to be reported.
+        std::vector<report> reports;
+        counters totals;
+      };
 
-    class cocoa_wkwebview_engine
-    {
     public:
-      cocoa_wkwebview_engine(bool debug, void *window)
-          : m_debug{debug}, m_parent_window{window}
+      // Ends the watched function when it goes out of scope.
+      class scope
       {
-        auto app = get_shared_application();
-        auto delegate = create_app_delegate();
-        objc_setAssociatedObject(delegate, "webview", (id)this,
-                                 OBJC_ASSOCIATION_ASSIGN);
-        objc::msg_send<void>(app, "setDelegate:"_sel, delegate);
-
-        // See comments related to application lifecycle in create_app_delegate().
-        if (window)
+      public:
+        scope() = default;
+        explicit scope(std::shared_ptr<state> s) : m_state(std::move(s)) {}
+        scope(const scope &) = delete;
+        scope &operator=(const scope &) = delete;
+        ~scope()
         {
-          on_application_did_finish_launching(delegate, app);
+          if (m_state)
+          {
+            end(*m_state);
+          }
         }
-        else
+
+      private:
+        std::shared_ptr<state> m_state;
+      };
+
+      ~stall_watchdog() { stop(); }
+
+      bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+      // Starts or restarts the watchdog thread. Counters are kept across
+      // restarts. Must be called on the UI thread.
+      void start(clock::duration threshold, report_t on_report, post_t post)
+      {
+        stop();
+        auto s = std::make_shared<state>();
+        if (m_state)
         {
-          // Start the main run loop so that the app delegate gets the
-          // NSApplicationDidFinishLaunchingNotification notification after the run
-          // loop has started in order to perform further initialization.
-          // We need to return from this constructor so this run loop is only
-          // temporary.
-          objc::msg_send<void>(app, "run"_sel);
+          s->totals = stats();
         }
+        s->threshold = threshold;
+        s->on_report = std::move(on_report);
+        s->post = std::move(post);
+        m_state = s;
+        m_thread = std::thread([s]()
+                               { run(s); });
+        m_enabled.store(true, std::memory_order_relaxed);
       }
-      virtual ~cocoa_wkwebview_engine() = default;
-      void *window() { return (void *)m_window; }
-      void terminate()
-      {
-        auto app = get_shared_application();
-        objc::msg_send<void>(app, "terminate:"_sel, nullptr);
-      }
-      void run()
-      {
-        auto app = get_shared_application();
-        objc::msg_send<void>(app, "run"_sel);
-      }
-      void dispatch(std::function<void()> f)
-      {
-        dispatch_async_f(dispatch_get_main_queue(), new dispatch_fn_t(f),
-                         (dispatch_function_t)([](void *arg)
-                                               {
-                       auto f = static_cast<dispatch_fn_t *>(arg);
-                       (*f)();
-                       delete f; }));
-      }
-      void set_title(const std::string &title)
-      {
-        objc::msg_send<void>(m_window, "setTitle:"_sel,
-                             objc::msg_send<id>("NSString"_cls,
-                                                "stringWithUTF8String:"_sel,
-                                                title.c_str()));
-      }
-      void set_size(int width, int height, int hints)
+
+      // Stops the watchdog thread. Must be called on the UI thread.
+      void stop()
       {
-        auto style = static_cast<NSWindowStyleMask>(
-            NSWindowStyleMaskTitled | NSWindowStyleMaskClosable |
-            NSWindowStyleMaskMiniaturizable);
-        if (hints != WEBVIEW_HINT_FIXED)
+        if (!m_thread.joinable())
         {
-          style =
-              static_cast<NSWindowStyleMask>(style | NSWindowStyleMaskResizable);
+          return;
         }
-        objc::msg_send<void>(m_window, "setStyleMask:"_sel, style);
-
-        if (hints == WEBVIEW_HINT_MIN)
+        m_enabled.store(false, std::memory_order_relaxed);
         {
-          objc::msg_send<void>(m_window, "setContentMinSize:"_sel,
-                               CGSizeMake(width, height));
+          std::lock_guard<std::mutex> lock(m_state->mutex);
+          m_state->stopped = true;
         }
-        else if (hints == WEBVIEW_HINT_MAX)
+        m_state->cv.notify_all();
+        m_thread.join();
+      }
+
+      // Marks the start of a function on the UI thread, which ends with the
+      // returned scope. Does nothing while the watchdog is stopped.
+      scope watch(const char *kind, const char *name)
+      {
+        if (!enabled())
         {
-          objc::msg_send<void>(m_window, "setContentMaxSize:"_sel,
-                               CGSizeMake(width, height));
+          return scope();
         }
-        else
         {
-          objc::msg_send<void>(m_window, "setFrame:display:animate:"_sel,
-                               CGRectMake(0, 0, width, height), YES, NO);
+          std::lock_guard<std::mutex> lock(m_state->mutex);
+          m_state->running.push_back(
+              {std::string(kind) + ":" + name, clock::now(), false});
         }
-        objc::msg_send<void>(m_window, "center"_sel);
+        return scope(m_state);
       }
-      void navigate(const std::string &url)
-      {
-        auto nsurl = objc::msg_send<id>(
-            "NSURL"_cls, "URLWithString:"_sel,
-            objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel,
-                               url.c_str()));
 
-        objc::msg_send<void>(
-            m_webview, "loadRequest:"_sel,
-            objc::msg_send<id>("NSURLRequest"_cls, "requestWithURL:"_sel, nsurl));
-      }
-      void set_html(const std::string &html)
+      counters stats()
       {
-        objc::msg_send<void>(m_webview, "loadHTMLString:baseURL:"_sel,
-                             objc::msg_send<id>("NSString"_cls,
-                                                "stringWithUTF8String:"_sel,
-                                                html.c_str()),
-                             nullptr);
+        if (!m_state)
+        {
+          return {};
+        }
+        std::lock_guard<std::mutex> lock(m_state->mutex);
+        return m_state->totals;
       }
-      void init(const std::string &js)
+
+    private:
+      static long long to_ms(clock::duration d)
       {
-        // Equivalent Obj-C:
-        // [m_manager addUserScript:[[WKUserScript alloc] initWithSource:[NSString stringWithUTF8String:js.c_str()] injectionTime:WKUserScriptInjectionTimeAtDocumentStart forMainFrameOnly:YES]]
-        objc::msg_send<void>(
-            m_manager, "addUserScript:"_sel,
-            objc::msg_send<id>(objc::msg_send<id>("WKUserScript"_cls, "alloc"_sel),
-                               "initWithSource:injectionTime:forMainFrameOnly:"_sel,
-                               objc::msg_send<id>("NSString"_cls,
-                                                  "stringWithUTF8String:"_sel,
-                                                  js.c_str()),
-                               WKUserScriptInjectionTimeAtDocumentStart, YES));
+        return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
       }
-      void eval(const std::string &js)
+
+      static void end(state &s)
       {
-        objc::msg_send<void>(m_webview, "evaluateJavaScript:completionHandler:"_sel,
-                             objc::msg_send<id>("NSString"_cls,
-                                                "stringWithUTF8String:"_sel,
-                                                js.c_str()),
-                             nullptr);
+        auto now = clock::now();
+        {
+          std::lock_guard<std::mutex> lock(s.mutex);
+          auto finished = std::move(s.running.back());
+          s.running.pop_back();
+          // The main loop was accounted for until now, so a heartbeat queued
+          // behind this function starts waiting from here.
+          s.heartbeat_posted = now;
+          auto elapsed = now - finished.start;
+          if (elapsed < s.threshold)
+          {
+            return;
+          }
+          if (!finished.reported)
+          {
+            s.totals.stalls++;
+          }
+          s.totals.longest_ms = std::max(s.totals.longest_ms, to_ms(elapsed));
+          s.reports.push_back({std::move(finished.site), to_ms(elapsed), true});
+        }
+        s.cv.notify_all();
       }
 
-    private:
-      virtual void on_message(const std::string &msg) = 0;
-      id create_app_delegate()
+      static void run(std::shared_ptr<state> s)
       {
-        // Note: Avoid registering the class name "AppDelegate" as it is the
-        // default name in projects created with Xcode, and using the same name
-        // causes objc_registerClassPair to crash.
-        auto cls = objc_allocateClassPair((Class) "NSResponder"_cls,
-                                          "WebviewAppDelegate", 0);
-        class_addProtocol(cls, objc_getProtocol("NSTouchBarProvider"));
-        class_addMethod(cls, "applicationShouldTerminateAfterLastWindowClosed:"_sel,
-                        (IMP)(+[](id, SEL, id) -> BOOL
-                              { return 1; }),
-                        "c@:@");
-        // If the library was not initialized with an existing window then the user
-        // is likely managing the application lifecycle and we would not get the
-        // "applicationDidFinishLaunching:" message and therefore do not need to
-        // add this method.
-        if (!m_parent_window)
+        auto poll = std::max<clock::duration>(s->threshold / 4,
+                                              std::chrono::milliseconds(1));
+        std::unique_lock<std::mutex> lock(s->mutex);
+        while (!s->stopped)
         {
-          class_addMethod(cls, "applicationDidFinishLaunching:"_sel,
-                          (IMP)(+[](id self, SEL, id notification)
-                                {
-                                  auto app =
-                                      objc::msg_send<id>(notification, "object"_sel);
-                                  auto w = get_associated_webview(self);
-                                  w->on_application_did_finish_launching(self, app);
-                                }),
-                          "v@:@");
+          s->cv.wait_for(lock, poll, [&]()
+                         { return s->stopped || !s->reports.empty(); });
+          if (s->stopped)
+          {
+            break;
+          }
+          auto now = clock::now();
+          auto reports = std::move(s->reports);
+          s->reports.clear();
+          if (!s->running.empty())
+          {
+            auto &top = s->running.back();
+            if (!top.reported && now - top.start >= s->threshold)
+            {
+              top.reported = true;
+              s->totals.stalls++;
+              s->totals.longest_ms =
+                  std::max(s->totals.longest_ms, to_ms(now - top.start));
+              reports.push_back({top.site, to_ms(now - top.start), false});
+            }
+          }
+          else if (s->heartbeat_pending && !s->heartbeat_reported &&
+                   now - s->heartbeat_posted >= s->threshold)
+          {
+            s->heartbeat_reported = true;
+            s->totals.main_loop_stalls++;
+            reports.push_back({"main loop", to_ms(now - s->heartbeat_posted),
+                               false});
+          }
+          auto post_heartbeat = !s->heartbeat_pending;
+          if (post_heartbeat)
+          {
+            s->heartbeat_pending = true;
+            s->heartbeat_reported = false;
+            s->heartbeat_posted = now;
+          }
+          lock.unlock();
+          if (post_heartbeat)
+          {
+            s->post([s]()
+                    { heartbeat(*s); });
+          }
+          for (const auto &r : reports)
+          {
+            s->on_report(r.site, r.elapsed_ms, r.finished);
+          }
+          lock.lock();
         }
-        objc_registerClassPair(cls);
-        return objc::msg_send<id>((id)cls, "new"_sel);
       }
-      id create_script_message_handler()
+
+      static void heartbeat(state &s)
       {
-        auto cls = objc_allocateClassPair((Class) "NSResponder"_cls,
-                                          "WebkitScriptMessageHandler", 0);
-        class_addProtocol(cls, objc_getProtocol("WKScriptMessageHandler"));
-        class_addMethod(
-            cls, "userContentController:didReceiveScriptMessage:"_sel,
-            (IMP)(+[](id self, SEL, id, id msg)
-                  {
-                    auto w = get_associated_webview(self);
-                    w->on_message(objc::msg_send<const char *>(
-                        objc::msg_send<id>(msg, "body"_sel), "UTF8String"_sel));
-                  }),
-            "v@:@@");
-        objc_registerClassPair(cls);
-        auto instance = objc::msg_send<id>((id)cls, "new"_sel);
-        objc_setAssociatedObject(instance, "webview", (id)this,
-                                 OBJC_ASSOCIATION_ASSIGN);
-        return instance;
+        {
+          std::lock_guard<std::mutex> lock(s.mutex);
+          s.heartbeat_pending = false;
+          if (!s.heartbeat_reported)
+          {
+            return;
+          }
+          auto elapsed = to_ms(clock::now() - s.heartbeat_posted);
+          s.totals.longest_ms = std::max(s.totals.longest_ms, elapsed);
+          s.reports.push_back({"main loop", elapsed, true});
+        }
+        s.cv.notify_all();
       }
-      static id create_webkit_ui_delegate()
-      {
-        auto cls =
-            objc_allocateClassPair((Class) "NSObject"_cls, "WebkitUIDelegate", 0);
-        class_addProtocol(cls, objc_getProtocol("WKUIDelegate"));
-        class_addMethod(
-            cls,
-            "webView:runOpenPanelWithParameters:initiatedByFrame:completionHandler:"_sel,
-            (IMP)(+[](id, SEL, id, id parameters, id, id completion_handler)
-                  {
-                    auto allows_multiple_selection =
-                        objc::msg_send<BOOL>(parameters, "allowsMultipleSelection"_sel);
-                    auto allows_directories =
-                        objc::msg_send<BOOL>(parameters, "allowsDirectories"_sel);
 
-                    // Show a panel for selecting files.
-                    auto panel = objc::msg_send<id>("NSOpenPanel"_cls, "openPanel"_sel);
-                    objc::msg_send<void>(panel, "setCanChooseFiles:"_sel, YES);
-                    objc::msg_send<void>(panel, "setCanChooseDirectories:"_sel,
-                                         allows_directories);
-                    objc::msg_send<void>(panel, "setAllowsMultipleSelection:"_sel,
-                                         allows_multiple_selection);
-                    auto modal_response =
-                        objc::msg_send<NSModalResponse>(panel, "runModal"_sel);
+      std::atomic<bool> m_enabled{false};
+      std::shared_ptr<state> m_state;
+      std::thread m_thread;
+    };
 
-                    // Get the URLs for the selected files. If the modal was canceled
-                    // then we pass null to the completion handler to signify
-                    // cancellation.
-                    id urls = modal_response == NSModalResponseOK
-                                  ? objc::msg_send<id>(panel, "URLs"_sel)
-                                  : nullptr;
+    // Milestones of a navigation, in milliseconds from its start, -1 until
+    // reached. See the WEBVIEW_NAVIGATION_* constants.
+    struct navigation_timing
+    {
+      unsigned long long id = 0;
+      std::string url;
+      double committed_ms = -1;
+      double dom_content_loaded_ms = -1;
+      double load_finished_ms = -1;
+      double first_paint_ms = -1;
+    };
 
-                    // Invoke the completion handler block.
-                    auto sig = objc::msg_send<id>("NSMethodSignature"_cls,
-                                                  "signatureWithObjCTypes:"_sel, "v@?@");
-                    auto invocation = objc::msg_send<id>(
-                        "NSInvocation"_cls, "invocationWithMethodSignature:"_sel, sig);
-                    objc::msg_send<void>(invocation, "setTarget:"_sel,
-                                         completion_handler);
-                    objc::msg_send<void>(invocation, "setArgument:atIndex:"_sel, &urls,
-                                         1);
-                    objc::msg_send<void>(invocation, "invoke"_sel);
-                  }),
-            "v@:@@@@");
-        objc_registerClassPair(cls);
-        return objc::msg_send<id>((id)cls, "new"_sel);
-      }
-      static id get_shared_application()
-      {
-        return objc::msg_send<id>("NSApplication"_cls, "sharedApplication"_sel);
-      }
-      static cocoa_wkwebview_engine *get_associated_webview(id object)
+    // Called with the milestone reached and the timing so far.
+    using timing_fn_t = std::function<void(int, const navigation_timing &)>;
+
+    // Counters of a single binding. They are updated with relaxed atomics from
+    // whichever thread handles the call and read as a snapshot.
+    struct binding_stats
+    {
+      std::atomic<unsigned long long> calls{0};
+      std::atomic<unsigned long long> errors{0};
+      std::atomic<unsigned long long> cancelled{0};
+      std::atomic<unsigned long long> bytes_in{0};
+      std::atomic<unsigned long long> bytes_out{0};
+      std::atomic<unsigned int> in_flight{0};
+      // Time from receiving a call to evaluating its result in the page.
+      log2_histogram latency;
+    };
+
+    // Chunks of a streaming call that can be sent before the async iterator
+    // in the page has consumed them.
+    constexpr unsigned int stream_window = 16;
+
+    // A flow-controlled queue of messages pushed from native code to JS. JS
+    // grants credits as it consumes messages and only as many messages as
+    // there are credits are handed to the engine. The remaining messages wait
+    // here, and the overflow policy bounds how many of them there can be.
+    // Payloads are reference counted so that one message can be queued on
+    // many channels without copying it.
+    class push_channel
+    {
+    public:
+      using payload_t = std::shared_ptr<const std::string>;
+
+      enum class policy
       {
-        auto w =
-            (cocoa_wkwebview_engine *)objc_getAssociatedObject(object, "webview");
-        assert(w);
-        return w;
-      }
-      static id get_main_bundle() noexcept
+        // Posting to a full queue waits until JS has consumed messages.
+        block = 0,
+        // Posting to a full queue drops the oldest queued message.
+        drop_oldest = 1,
+        // A queued message is replaced by a newer one with the same key.
+        // Posting to a full queue drops the oldest queued message.
+        coalesce = 2
+      };
+
+      struct stats
       {
-        return objc::msg_send<id>("NSBundle"_cls, "mainBundle"_sel);
-      }
-      static bool is_app_bundled() noexcept
+        unsigned long long posted = 0;
+        unsigned long long delivered = 0;
+        unsigned long long dropped = 0;
+        unsigned long long coalesced = 0;
+        std::size_t depth = 0;
+        std::size_t max_depth = 0;
+        unsigned int credits = 0;
+        unsigned int in_flight = 0;
+      };
+
+      push_channel(policy p, std::size_t capacity, unsigned int window)
+          : m_policy(p), m_capacity(std::max<std::size_t>(capacity, 1)),
+            m_window(std::max(window, 1u)) {}
+
+      // Queues a message. Returns false if the channel has been closed.
+      bool post(const std::string &key, const payload_t &json)
       {
-        auto bundle = get_main_bundle();
-        if (!bundle)
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_closed)
         {
           return false;
         }
-        auto bundle_path = objc::msg_send<id>(bundle, "bundlePath"_sel);
-        auto bundled =
-            objc::msg_send<BOOL>(bundle_path, "hasSuffix:"_sel, ".app"_str);
-        return !!bundled;
-      }
-      void on_application_did_finish_launching(id /*delegate*/, id app)
-      {
-        // See comments related to application lifecycle in create_app_delegate().
-        if (!m_parent_window)
+        m_stats.posted++;
+        if (m_policy == policy::coalesce && !key.empty())
         {
-          // Stop the main run loop so that we can return
-          // from the constructor.
-          objc::msg_send<void>(app, "stop:"_sel, nullptr);
+          auto found = m_keyed.find(key);
+          if (found != m_keyed.end())
+          {
+            found->second->second = json;
+            m_stats.coalesced++;
+            return true;
+          }
         }
-
-        // Activate the app if it is not bundled.
-        // Bundled apps launched from Finder are activated automatically but
-        // otherwise not. Activating the app even when it has been launched from
-        // Finder does not seem to be harmful but calling this function is rarely
-        // needed as proper activation is normally taken care of for us.
-        // Bundled apps have a default activation policy of
-        // NSApplicationActivationPolicyRegular while non-bundled apps have a
-        // default activation policy of NSApplicationActivationPolicyProhibited.
-        if (!is_app_bundled())
+        if (m_queue.size() >= m_capacity)
         {
-          // "setActivationPolicy:" must be invoked before
-          // "activateIgnoringOtherApps:" for activation to work.
-          objc::msg_send<void>(app, "setActivationPolicy:"_sel,
-                               NSApplicationActivationPolicyRegular);
-          // Activate the app regardless of other active apps.
-          // This can be obtrusive so we only do it when necessary.
-          objc::msg_send<void>(app, "activateIgnoringOtherApps:"_sel, YES);
+          if (m_policy == policy::block)
+          {
+            m_space.wait(lock, [this]
+                         { return m_closed || m_queue.size() < m_capacity; });
+            if (m_closed)
+            {
+              return false;
+            }
+          }
+          else
+          {
+            pop_front();
+            m_stats.dropped++;
+          }
         }
-
-        // Main window
-        if (!m_parent_window)
+        m_queue.emplace_back(key, json);
+        if (m_policy == policy::coalesce && !key.empty())
         {
-          m_window = objc::msg_send<id>("NSWindow"_cls, "alloc"_sel);
-          auto style = NSWindowStyleMaskTitled;
-          m_window = objc::msg_send<id>(
-              m_window, "initWithContentRect:styleMask:backing:defer:"_sel,
-              CGRectMake(0, 0, 0, 0), style, NSBackingStoreBuffered, NO);
+          m_keyed[key] = std::prev(m_queue.end());
         }
-        else
+        m_stats.max_depth = std::max(m_stats.max_depth, m_queue.size());
+        return true;
+      }
+
+      // Returns credits for consumed messages. A negative count means a new
+      // listener has started with no messages in flight.
+      void grant(int credits)
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (credits < 0)
         {
-          m_window = (id)m_parent_window;
+          m_in_flight = 0;
+          m_credits = m_window;
+          return;
         }
+        auto n = std::min(static_cast<unsigned int>(credits), m_in_flight);
+        m_in_flight -= n;
+        m_credits = std::min(m_window, m_credits + n);
+      }
 
-        // Webview
-        auto config = objc::msg_send<id>("WKWebViewConfiguration"_cls, "new"_sel);
-        m_manager = objc::msg_send<id>(config, "userContentController"_sel);
-        m_webview = objc::msg_send<id>("WKWebView"_cls, "alloc"_sel);
-
-        if (m_debug)
+      // Takes as many queued messages as there are credits and passes them to
+      // fn as a JSON array. fn runs without the channel lock. Only one thread
+      // takes batches at a time, so that they reach the engine in order; a
+      // thread finding another one at work leaves its messages to it.
+      void take(const std::function<void(const std::string &batch)> &fn)
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_taking)
         {
-          // Equivalent Obj-C:
-          // [[config preferences] setValue:@YES forKey:@"developerExtrasEnabled"];
-          objc::msg_send<id>(
-              objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
-              objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
-              "developerExtrasEnabled"_str);
+          return;
         }
+        m_taking = true;
+        while (!m_closed && m_credits > 0 && !m_queue.empty())
+        {
+          std::string batch = "[";
+          while (m_credits > 0 && !m_queue.empty())
+          {
+            if (batch.size() > 1)
+            {
+              batch += ",";
+            }
+            batch += *m_queue.front().second;
+            pop_front();
+            m_credits--;
+            m_in_flight++;
+            m_stats.delivered++;
+          }
+          batch += "]";
+          m_space.notify_all();
+          lock.unlock();
+          fn(batch);
+          lock.lock();
+        }
+        m_taking = false;
+      }
 
-        // Equivalent Obj-C:
-        // [[config preferences] setValue:@YES forKey:@"fullScreenEnabled"];
-        objc::msg_send<id>(
-            objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
-            objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
-            "fullScreenEnabled"_str);
-
-        // Equivalent Obj-C:
-        // [[config preferences] setValue:@YES forKey:@"javaScriptCanAccessClipboard"];
-        objc::msg_send<id>(
-            objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
-            objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
-            "javaScriptCanAccessClipboard"_str);
+      // Wakes up blocked posters and rejects further messages.
+      void close()
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_space.notify_all();
+      }
 
-        // Equivalent Obj-C:
-        // [[config preferences] setValue:@YES forKey:@"DOMPasteAllowed"];
-        objc::msg_send<id>(
-            objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
-            objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
-            "DOMPasteAllowed"_str);
+      stats get_stats() const
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto result = m_stats;
+        result.depth = m_queue.size();
+        result.credits = m_credits;
+        result.in_flight = m_in_flight;
+        return result;
+      }
 
-        auto ui_delegate = create_webkit_ui_delegate();
-        objc::msg_send<void>(m_webview, "initWithFrame:configuration:"_sel,
-                             CGRectMake(0, 0, 0, 0), config);
-        objc::msg_send<void>(m_webview, "setUIDelegate:"_sel, ui_delegate);
-        auto script_message_handler = create_script_message_handler();
-        objc::msg_send<void>(m_manager, "addScriptMessageHandler:name:"_sel,
-                             script_message_handler, "external"_str);
+    private:
+      using queue_t = std::list<std::pair<std::string, payload_t>>;
 
-        init(R""(
-      window.external = {
-        invoke: function(s) {
-          window.webkit.messageHandlers.external.postMessage(s);
-        },
-      };
-      )"");
-        objc::msg_send<void>(m_window, "setContentView:"_sel, m_webview);
-        objc::msg_send<void>(m_window, "makeKeyAndOrderFront:"_sel, nullptr);
+      void pop_front()
+      {
+        const auto &key = m_queue.front().first;
+        if (!key.empty())
+        {
+          auto found = m_keyed.find(key);
+          if (found != m_keyed.end() && found->second == m_queue.begin())
+          {
+            m_keyed.erase(found);
+          }
+        }
+        m_queue.pop_front();
       }
-      bool m_debug;
-      void *m_parent_window;
-      id m_window;
-      id m_webview;
-      id m_manager;
+
+      policy m_policy;
+      std::size_t m_capacity;
+      unsigned int m_window;
+      // Credits start at zero; JS hands out the first window when it starts
+      // listening.
+      unsigned int m_credits = 0;
+      unsigned int m_in_flight = 0;
+      bool m_closed = false;
+      // Set while a thread is handing batches to fn.
+      bool m_taking = false;
+      queue_t m_queue;
+      std::unordered_map<std::string, queue_t::iterator> m_keyed;
+      stats m_stats;
+      mutable std::mutex m_mutex;
+      std::condition_variable m_space;
     };
 
   } // namespace detail
 
-  using browser_engine = detail::cocoa_wkwebview_engine;
+  WEBVIEW_DEPRECATED_PRIVATE
+  inline int json_parse_c(const char *s, size_t sz, const char *key, size_t keysz,
+                          const char **value, size_t *valuesz)
+  {
+    return detail::json_parse_c(s, sz, key, keysz, value, valuesz);
+  }
 
-} // namespace webview
+  WEBVIEW_DEPRECATED_PRIVATE
+  inline std::string json_escape(const std::string &s)
+  {
+    return detail::json_escape(s);
+  }
 
-#elif defined(WEBVIEW_EDGE)
+  WEBVIEW_DEPRECATED_PRIVATE
+  inline int json_unescape(const char *s, size_t n, char *out)
+  {
+    return detail::json_unescape(s, n, out);
+  }
 
+  WEBVIEW_DEPRECATED_PRIVATE
+  inline std::string json_parse(const std::string &s, const std::string &key,
+                                const int index)
+  {
+    return detail::json_parse(s, key, index);
+  }
+
+} // namespace webview
+
+#if defined(WEBVIEW_GTK) || defined(WEBVIEW_HEADLESS)
 //
 // ====================================================================
 //
-// This implementation uses Win32 API to create a native window. It
-// uses Edge/Chromium webview2 backend as a browser engine.
+// Virtual host folders for the backends without a native mapping. Hosts
+// are served from a custom scheme. Small files are read into memory and
+// large files are streamed from their descriptor, so serving a large file
+// does not read it into memory first, and a file rewritten while the engine
+// reads it cannot fault the process as a mapping of it would.
 //
 // ====================================================================
 //
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
-#define WIN32_LEAN_AND_MEAN
-#include <shlobj.h>
-#include <shlwapi.h>
-#include <stdlib.h>
-#include <windows.h>
-
-#include "WebView2.h"
-
-#ifdef _MSC_VER
-#pragma comment(lib, "advapi32.lib")
-#pragma comment(lib, "ole32.lib")
-#pragma comment(lib, "shell32.lib")
-#pragma comment(lib, "shlwapi.lib")
-#pragma comment(lib, "user32.lib")
-#pragma comment(lib, "version.lib")
+// Brotli bodies can only be decoded when built with -DWEBVIEW_BROTLI and
+// linked with -lbrotlidec; gzip needs nothing more than GIO.
+#ifdef WEBVIEW_BROTLI
+#include <brotli/decode.h>
 #endif
 
 namespace webview
@@ -1244,924 +1954,3497 @@ namespace webview
   namespace detail
   {
 
-    using msg_cb_t = std::function<void(const std::string)>;
-
-    // Converts a narrow (UTF-8-encoded) string into a wide (UTF-16-encoded) string.
-    inline std::wstring widen_string(const std::string &input)
+    inline const char *mime_type_for(const std::string &path)
     {
-      if (input.empty())
+      static const std::pair<const char *, const char *> types[] = {
+          {"html", "text/html"},
+          {"htm", "text/html"},
+          {"js", "text/javascript"},
+          {"mjs", "text/javascript"},
+          {"css", "text/css"},
+          {"json", "application/json"},
+          {"map", "application/json"},
+          {"wasm", "application/wasm"},
+          {"svg", "image/svg+xml"},
+          {"png", "image/png"},
+          {"jpg", "image/jpeg"},
+          {"jpeg", "image/jpeg"},
+          {"gif", "image/gif"},
+          {"webp", "image/webp"},
+          {"avif", "image/avif"},
+          {"ico", "image/x-icon"},
+          {"woff", "font/woff"},
+          {"woff2", "font/woff2"},
+          {"ttf", "font/ttf"},
+          {"otf", "font/otf"},
+          {"mp4", "video/mp4"},
+          {"webm", "video/webm"},
+          {"mp3", "audio/mpeg"},
+          {"ogg", "audio/ogg"},
+          {"wav", "audio/wav"},
+          {"txt", "text/plain"},
+          {"xml", "application/xml"},
+          {"pdf", "application/pdf"},
+      };
+      auto dot = path.rfind('.');
+      if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
       {
-        return std::wstring();
+        return "application/octet-stream";
       }
-      UINT cp = CP_UTF8;
-      DWORD flags = MB_ERR_INVALID_CHARS;
-      auto input_c = input.c_str();
-      auto input_length = static_cast<int>(input.size());
-      auto required_length =
-          MultiByteToWideChar(cp, flags, input_c, input_length, nullptr, 0);
-      if (required_length > 0)
+      auto ext = path.substr(dot + 1);
+      std::transform(ext.begin(), ext.end(), ext.begin(),
+                     [](char c)
+                     { return static_cast<char>(std::tolower(c)); });
+      for (const auto &type : types)
       {
-        std::wstring output(static_cast<std::size_t>(required_length), L'\0');
-        if (MultiByteToWideChar(cp, flags, input_c, input_length, &output[0],
-                                required_length) > 0)
+        if (ext == type.first)
         {
-          return output;
+          return type.second;
         }
       }
-      // Failed to convert string from UTF-8 to UTF-16
-      return std::wstring();
+      return "application/octet-stream";
     }
 
-    // Converts a wide (UTF-16-encoded) string into a narrow (UTF-8-encoded) string.
-    inline std::string narrow_string(const std::wstring &input)
+    // A read-only mapping of a whole regular file. Truncating the file while
+    // it is mapped faults the reader, so files are replaced by rename.
+    class mapped_file
     {
-      if (input.empty())
+    public:
+      // Returns nullptr if path is not a readable regular file.
+      static std::unique_ptr<mapped_file> open(const std::string &path)
       {
-        return std::string();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+          return nullptr;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+          ::close(fd);
+          return nullptr;
+        }
+        std::unique_ptr<mapped_file> file(new mapped_file());
+        file->m_size = static_cast<std::size_t>(st.st_size);
+        if (file->m_size > 0)
+        {
+          auto data = mmap(nullptr, file->m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+          if (data == MAP_FAILED)
+          {
+            ::close(fd);
+            return nullptr;
+          }
+          file->m_data = data;
+        }
+        ::close(fd);
+        return file;
       }
-      UINT cp = CP_UTF8;
-      DWORD flags = WC_ERR_INVALID_CHARS;
-      auto input_c = input.c_str();
-      auto input_length = static_cast<int>(input.size());
-      auto required_length = WideCharToMultiByte(cp, flags, input_c, input_length,
-                                                 nullptr, 0, nullptr, nullptr);
-      if (required_length > 0)
+
+      ~mapped_file()
       {
-        std::string output(static_cast<std::size_t>(required_length), '\0');
-        if (WideCharToMultiByte(cp, flags, input_c, input_length, &output[0],
-                                required_length, nullptr, nullptr) > 0)
+        if (m_data != nullptr)
         {
-          return output;
+          munmap(m_data, m_size);
         }
       }
-      // Failed to convert string from UTF-16 to UTF-8
-      return std::string();
-    }
 
-    // Parses a version string with 1-4 integral components, e.g. "1.2.3.4".
-    // Missing or invalid components default to 0, and excess components are ignored.
-    template <typename T>
-    std::array<unsigned int, 4>
-    parse_version(const std::basic_string<T> &version) noexcept
+      const char *data() const
+      {
+        return m_data != nullptr ? static_cast<const char *>(m_data) : "";
+      }
+      std::size_t size() const { return m_size; }
+
+    private:
+      mapped_file() = default;
+
+      void *m_data = nullptr;
+      std::size_t m_size = 0;
+    };
+
+    // Streams a range of an open file, for files too large to read into
+    // memory. A file truncated meanwhile ends the stream early. Used as the
+    // reader of scheme_request::respond_stream.
+    class file_reader
     {
-      auto parse_component = [](auto sb, auto se) -> unsigned int
+    public:
+      file_reader(int fd, std::size_t offset, std::size_t length)
+          : m_fd(fd), m_offset(offset), m_left(length) {}
+
+      ~file_reader() { ::close(m_fd); }
+
+      static long long read(void *buf, std::size_t size, void *reader)
       {
-        try
+        auto r = static_cast<file_reader *>(reader);
+        size = std::min(size, r->m_left);
+        if (size == 0)
         {
-          auto n = std::stol(std::basic_string<T>(sb, se));
-          return n < 0 ? 0 : n;
+          return 0;
         }
-        catch (std::exception &)
+        ssize_t n;
+        while ((n = ::pread(r->m_fd, buf, size,
+                            static_cast<off_t>(r->m_offset))) < 0 &&
+               errno == EINTR)
         {
-          return 0;
         }
-      };
-      auto end = version.end();
-      auto sb = version.begin(); // subrange begin
-      auto se = sb;              // subrange end
-      unsigned int ci = 0;       // component index
-      std::array<unsigned int, 4> components{};
-      while (sb != end && se != end && ci < components.size())
-      {
-        if (*se == static_cast<T>('.'))
+        if (n < 0)
         {
-          components[ci++] = parse_component(sb, se);
-          sb = ++se;
-          continue;
+          return -1;
         }
-        ++se;
-      }
-      if (sb < se && ci < components.size())
-      {
-        components[ci] = parse_component(sb, se);
+        r->m_offset += static_cast<std::size_t>(n);
+        r->m_left -= static_cast<std::size_t>(n);
+        return n;
       }
-      return components;
-    }
 
-    template <typename T, std::size_t Length>
-    auto parse_version(const T (&version)[Length]) noexcept
-    {
-      return parse_version(std::basic_string<T>(version, Length));
-    }
+      static void close(void *reader) { delete static_cast<file_reader *>(reader); }
 
-    std::wstring get_file_version_string(const std::wstring &file_path) noexcept
+    private:
+      int m_fd;
+      std::size_t m_offset;
+      std::size_t m_left;
+    };
+
+    // Asset bundles, written by tools/bundle, pack a folder into one file
+    // that is mapped once; entries are found by path without a system call.
+    // All integers are little-endian:
+    //
+    //   header   "WVBUNDLE", u32 version, u32 entry count, u32 bucket count,
+    //            u32 reserved, u64 file size
+    //   buckets  u32 each, entry index + 1 or 0 if empty; a hash table of
+    //            the paths with linear probing, the count a power of two
+    //   entries  u64 path hash, u64 data offset, u64 data size,
+    //            u64 decoded size, u32 path offset, u16 path size,
+    //            u8 encoding, u8 reserved
+    //   paths and payloads, referenced by offset from the start of the file
+    //
+    // Paths start with "/", as in the URI of a request.
+    namespace bundle_format
     {
-      DWORD dummy_handle; // Unused
-      DWORD info_buffer_length =
-          GetFileVersionInfoSizeW(file_path.c_str(), &dummy_handle);
-      if (info_buffer_length == 0)
+      constexpr char magic[8] = {'W', 'V', 'B', 'U', 'N', 'D', 'L', 'E'};
+      constexpr std::uint32_t version = 1;
+      constexpr std::size_t header_size = 32;
+      constexpr std::size_t bucket_size = 4;
+      constexpr std::size_t entry_size = 40;
+
+      enum encoding : std::uint8_t
       {
-        return std::wstring();
+        identity = 0,
+        gzip = 1,
+        br = 2
+      };
+
+      inline const char *encoding_name(std::uint8_t e)
+      {
+        return e == gzip ? "gzip" : e == br ? "br" : "identity";
       }
-      std::vector<char> info_buffer;
-      info_buffer.reserve(info_buffer_length);
-      if (!GetFileVersionInfoW(file_path.c_str(), 0, info_buffer_length,
-                               info_buffer.data()))
+
+      // FNV-1a, 64 bits.
+      inline std::uint64_t hash(const char *s, std::size_t n)
       {
-        return std::wstring();
+        std::uint64_t h = 14695981039346656037ull;
+        for (std::size_t i = 0; i < n; i++)
+        {
+          h ^= static_cast<unsigned char>(s[i]);
+          h *= 1099511628211ull;
+        }
+        return h;
       }
-      auto sub_block = L"\\StringFileInfo\\040904B0\\ProductVersion";
-      LPWSTR version = nullptr;
-      unsigned int version_length = 0;
-      if (!VerQueryValueW(info_buffer.data(), sub_block,
-                          reinterpret_cast<LPVOID *>(&version), &version_length))
+
+      inline std::uint64_t load(const char *p, std::size_t bytes)
       {
-        return std::wstring();
+        std::uint64_t v = 0;
+        for (std::size_t i = bytes; i > 0; i--)
+        {
+          v = (v << 8) | static_cast<unsigned char>(p[i - 1]);
+        }
+        return v;
       }
-      if (!version || version_length == 0)
+
+      inline void store(std::string &out, std::uint64_t v, std::size_t bytes)
       {
-        return std::wstring();
+        for (std::size_t i = 0; i < bytes; i++)
+        {
+          out += static_cast<char>((v >> (8 * i)) & 0xff);
+        }
       }
-      return std::wstring(version, version_length);
-    }
+    } // namespace bundle_format
 
-    // A wrapper around COM library initialization. Calls CoInitializeEx in the
-    // constructor and CoUninitialize in the destructor.
-    class com_init_wrapper
+    class asset_bundle
     {
     public:
-      com_init_wrapper(DWORD dwCoInit)
+      struct entry
       {
-        // We can safely continue as long as COM was either successfully
-        // initialized or already initialized.
-        // RPC_E_CHANGED_MODE means that CoInitializeEx was already called with
-        // a different concurrency model.
-        switch (CoInitializeEx(nullptr, dwCoInit))
+        const char *data;
+        std::size_t size;
+        long long decoded_size;
+        std::uint8_t encoding;
+      };
+
+      // Maps and validates the bundle, so that lookups need no bounds
+      // checks. Returns nullptr if path is not a valid bundle.
+      static std::shared_ptr<asset_bundle> open(const std::string &path)
+      {
+        namespace f = bundle_format;
+        auto file = mapped_file::open(path);
+        if (!file || file->size() < f::header_size ||
+            std::memcmp(file->data(), f::magic, sizeof(f::magic)) != 0)
         {
-        case S_OK:
-        case S_FALSE:
-          m_initialized = true;
-          break;
+          return nullptr;
+        }
+        const char *p = file->data();
+        std::uint64_t size = file->size();
+        std::uint64_t count = f::load(p + 12, 4);
+        std::uint64_t buckets = f::load(p + 16, 4);
+        if (f::load(p + 8, 4) != f::version || f::load(p + 24, 8) != size ||
+            buckets == 0 || (buckets & (buckets - 1)) != 0 || count >= buckets ||
+            f::header_size + buckets * f::bucket_size + count * f::entry_size >
+                size)
+        {
+          return nullptr;
+        }
+        std::shared_ptr<asset_bundle> bundle(new asset_bundle());
+        bundle->m_buckets = p + f::header_size;
+        bundle->m_entries = bundle->m_buckets + buckets * f::bucket_size;
+        bundle->m_mask = buckets - 1;
+        for (std::uint64_t i = 0; i < buckets; i++)
+        {
+          if (f::load(bundle->m_buckets + i * f::bucket_size, 4) > count)
+          {
+            return nullptr;
+          }
+        }
+        for (std::uint64_t i = 0; i < count; i++)
+        {
+          auto e = bundle->m_entries + i * f::entry_size;
+          auto data_offset = f::load(e + 8, 8);
+          auto data_size = f::load(e + 16, 8);
+          auto path_offset = f::load(e + 32, 4);
+          auto path_size = f::load(e + 36, 2);
+          if (data_offset > size || data_size > size - data_offset ||
+              path_offset + path_size > size ||
+              static_cast<unsigned char>(e[38]) > f::br)
+          {
+            return nullptr;
+          }
         }
+        bundle->m_count = count;
+        bundle->m_file = std::move(file);
+        return bundle;
       }
 
-      ~com_init_wrapper()
+      std::size_t size() const { return m_count; }
+
+      // Path of the entry at index, in the order of the file.
+      std::string path(std::size_t index) const
       {
-        if (m_initialized)
+        namespace f = bundle_format;
+        auto e = m_entries + index * f::entry_size;
+        return std::string(m_file->data() + f::load(e + 32, 4),
+                           static_cast<std::size_t>(f::load(e + 36, 2)));
+      }
+
+      bool find(const std::string &path, entry &out) const
+      {
+        namespace f = bundle_format;
+        auto h = f::hash(path.data(), path.size());
+        for (auto i = h & m_mask, probes = m_mask + 1; probes > 0;
+             i = (i + 1) & m_mask, probes--)
         {
-          CoUninitialize();
-          m_initialized = false;
+          auto index = f::load(m_buckets + i * f::bucket_size, 4);
+          if (index == 0)
+          {
+            return false;
+          }
+          auto e = m_entries + (index - 1) * f::entry_size;
+          if (f::load(e, 8) != h || f::load(e + 36, 2) != path.size() ||
+              std::memcmp(m_file->data() + f::load(e + 32, 4), path.data(),
+                          path.size()) != 0)
+          {
+            continue;
+          }
+          out.data = m_file->data() + f::load(e + 8, 8);
+          out.size = static_cast<std::size_t>(f::load(e + 16, 8));
+          out.decoded_size = static_cast<long long>(f::load(e + 24, 8));
+          out.encoding = static_cast<std::uint8_t>(e[38]);
+          return true;
         }
+        return false;
       }
 
-      com_init_wrapper(const com_init_wrapper &other) = delete;
-      com_init_wrapper &operator=(const com_init_wrapper &other) = delete;
-      com_init_wrapper(com_init_wrapper &&other) = delete;
-      com_init_wrapper &operator=(com_init_wrapper &&other) = delete;
-
-      bool is_initialized() const { return m_initialized; }
-
     private:
-      bool m_initialized = false;
-    };
-
-    // Holds a symbol name and associated type for code clarity.
-    template <typename T>
-    class library_symbol
-    {
-    public:
-      using type = T;
-
-      constexpr explicit library_symbol(const char *name) : m_name(name) {}
-      constexpr const char *get_name() const { return m_name; }
+      asset_bundle() = default;
 
-    private:
-      const char *m_name;
+      std::unique_ptr<mapped_file> m_file;
+      const char *m_buckets = nullptr;
+      const char *m_entries = nullptr;
+      std::uint64_t m_mask = 0;
+      std::uint64_t m_count = 0;
     };
 
-    // Loads a native shared library and allows one to get addresses for those
-    // symbols.
-    class native_library
+#ifdef WEBVIEW_BROTLI
+    // Decodes a brotli body as the engine reads it, for engines that cannot
+    // hand compressed bodies to the page. Used as the reader of
+    // scheme_request::respond_stream.
+    class brotli_reader
     {
     public:
-      explicit native_library(const wchar_t *name) : m_handle(LoadLibraryW(name)) {}
+      brotli_reader(const void *data, std::size_t size,
+                    scheme_request::release_fn_t release, void *arg)
+          : m_state(BrotliDecoderCreateInstance(nullptr, nullptr, nullptr)),
+            m_next(static_cast<const std::uint8_t *>(data)), m_left(size),
+            m_release(release), m_arg(arg) {}
 
-      ~native_library()
+      ~brotli_reader()
       {
-        if (m_handle)
+        BrotliDecoderDestroyInstance(m_state);
+        if (m_release != nullptr)
         {
-          FreeLibrary(m_handle);
-          m_handle = nullptr;
+          m_release(m_arg);
         }
       }
 
-      native_library(const native_library &other) = delete;
-      native_library &operator=(const native_library &other) = delete;
-      native_library(native_library &&other) = default;
-      native_library &operator=(native_library &&other) = default;
-
-      // Returns true if the library is currently loaded; otherwise false.
-      operator bool() const { return is_loaded(); }
-
-      // Get the address for the specified symbol or nullptr if not found.
-      template <typename Symbol>
-      typename Symbol::type get(const Symbol &symbol) const
+      static long long read(void *buf, std::size_t size, void *reader)
       {
-        if (is_loaded())
+        auto r = static_cast<brotli_reader *>(reader);
+        auto out = static_cast<std::uint8_t *>(buf);
+        auto avail = size;
+        auto result = BrotliDecoderDecompressStream(r->m_state, &r->m_left,
+                                                    &r->m_next, &avail, &out,
+                                                    nullptr);
+        auto n = static_cast<long long>(size - avail);
+        if (result == BROTLI_DECODER_RESULT_ERROR ||
+            (n == 0 && result == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT))
         {
-          return reinterpret_cast<typename Symbol::type>(
-              GetProcAddress(m_handle, symbol.get_name()));
+          return -1;
         }
-        return nullptr;
+        return n;
       }
 
-      // Returns true if the library is currently loaded; otherwise false.
-      bool is_loaded() const { return !!m_handle; }
-
-      void detach() { m_handle = nullptr; }
+      static void close(void *reader) { delete static_cast<brotli_reader *>(reader); }
 
     private:
-      HMODULE m_handle = nullptr;
+      BrotliDecoderState *m_state;
+      const std::uint8_t *m_next;
+      std::size_t m_left;
+      scheme_request::release_fn_t m_release;
+      void *m_arg;
     };
+#endif
 
-    struct user32_symbols
+    struct byte_range
     {
-      using DPI_AWARENESS_CONTEXT = HANDLE;
-      using SetProcessDpiAwarenessContext_t = BOOL(WINAPI *)(DPI_AWARENESS_CONTEXT);
-      using SetProcessDPIAware_t = BOOL(WINAPI *)();
-
-      static constexpr auto SetProcessDpiAwarenessContext =
-          library_symbol<SetProcessDpiAwarenessContext_t>(
-              "SetProcessDpiAwarenessContext");
-      static constexpr auto SetProcessDPIAware =
-          library_symbol<SetProcessDPIAware_t>("SetProcessDPIAware");
+      std::size_t start = 0;
+      std::size_t length = 0;
     };
 
-    struct shcore_symbols
+    // Applies the Range header of a request to a file of size bytes. Returns
+    // 206 with the range to serve, 416 if the range cannot be satisfied, or
+    // 200 to serve the whole file when there is no range or it is not a
+    // single byte range.
+    inline int parse_range(const std::string &header, std::size_t size,
+                           byte_range &range)
     {
-      typedef enum
+      auto number = [](const std::string &s, std::size_t &value)
       {
-        PROCESS_PER_MONITOR_DPI_AWARE = 2
-      } PROCESS_DPI_AWARENESS;
-      using SetProcessDpiAwareness_t = HRESULT(WINAPI *)(PROCESS_DPI_AWARENESS);
-
-      static constexpr auto SetProcessDpiAwareness =
-          library_symbol<SetProcessDpiAwareness_t>("SetProcessDpiAwareness");
-    };
-
-    class reg_key
-    {
-    public:
-      explicit reg_key(HKEY root_key, const wchar_t *sub_key, DWORD options,
-                       REGSAM sam_desired)
-      {
-        HKEY handle;
-        auto status =
-            RegOpenKeyExW(root_key, sub_key, options, sam_desired, &handle);
-        if (status == ERROR_SUCCESS)
+        if (s.empty() || s.find_first_not_of("0123456789") != std::string::npos)
         {
-          m_handle = handle;
+          return false;
         }
+        value = static_cast<std::size_t>(std::strtoull(s.c_str(), nullptr, 10));
+        return true;
+      };
+      if (header.compare(0, 6, "bytes=") != 0 ||
+          header.find(',') != std::string::npos)
+      {
+        return 200;
       }
-
-      explicit reg_key(HKEY root_key, const std::wstring &sub_key, DWORD options,
-                       REGSAM sam_desired)
-          : reg_key(root_key, sub_key.c_str(), options, sam_desired) {}
-
-      virtual ~reg_key()
+      auto dash = header.find('-', 6);
+      if (dash == std::string::npos)
       {
-        if (m_handle)
+        return 200;
+      }
+      auto first = header.substr(6, dash - 6);
+      auto last = header.substr(dash + 1);
+      std::size_t start = 0;
+      std::size_t end = 0;
+      if (first.empty())
+      {
+        // The last n bytes.
+        std::size_t n = 0;
+        if (!number(last, n))
         {
-          RegCloseKey(m_handle);
-          m_handle = nullptr;
+          return 200;
+        }
+        if (n == 0 || size == 0)
+        {
+          return 416;
         }
+        start = n < size ? size - n : 0;
+        end = size - 1;
       }
-
-      reg_key(const reg_key &other) = delete;
-      reg_key &operator=(const reg_key &other) = delete;
-      reg_key(reg_key &&other) = delete;
-      reg_key &operator=(reg_key &&other) = delete;
-
-      bool is_open() const { return !!m_handle; }
-      bool get_handle() const { return m_handle; }
-
-      std::wstring query_string(const wchar_t *name) const
+      else
       {
-        DWORD buf_length = 0;
-        // Get the size of the data in bytes.
-        auto status = RegQueryValueExW(m_handle, name, nullptr, nullptr, nullptr,
-                                       &buf_length);
-        if (status != ERROR_SUCCESS && status != ERROR_MORE_DATA)
+        if (!number(first, start))
         {
-          return std::wstring();
+          return 200;
         }
-        // Read the data.
-        std::wstring result(buf_length / sizeof(wchar_t), 0);
-        auto buf = reinterpret_cast<LPBYTE>(&result[0]);
-        status =
-            RegQueryValueExW(m_handle, name, nullptr, nullptr, buf, &buf_length);
-        if (status != ERROR_SUCCESS)
+        if (start >= size)
         {
-          return std::wstring();
+          return 416;
         }
-        // Remove trailing null-characters.
-        for (std::size_t length = result.size(); length > 0; --length)
+        end = size - 1;
+        if (!last.empty())
         {
-          if (result[length - 1] != 0)
+          if (!number(last, end) || end < start)
           {
-            result.resize(length);
-            break;
+            return 200;
           }
+          end = std::min(end, size - 1);
         }
-        return result;
       }
+      range.start = start;
+      range.length = end - start + 1;
+      return 206;
+    }
 
-    private:
-      HKEY m_handle = nullptr;
-    };
-
-    inline bool enable_dpi_awareness()
+    // Process-wide cache of the files served from virtual host folders, so
+    // that repeated loads, from any window, are served from memory. Files are
+    // read into memory rather than kept mapped, so a file truncated on disk
+    // cannot fault a response in flight. The cache is split into shards by
+    // path hash, each with its own lock and LRU list, and bounded in bytes.
+    // Absent files are cached too, as every request probes for .br and .gz
+    // siblings. Only files whose directory is watched with inotify are
+    // cached, and any change in a watched directory drops its entries.
+    class asset_cache
     {
-      auto user32 = native_library(L"user32.dll");
-      if (auto fn = user32.get(user32_symbols::SetProcessDpiAwarenessContext))
+    public:
+      enum class result
       {
-        if (fn(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE))
+        // out holds the contents of the file.
+        cached,
+        // The file does not exist.
+        missing,
+        // The cache cannot hold the file, read it directly.
+        uncached
+      };
+
+      struct stats
+      {
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long evictions;
+        unsigned long long invalidations;
+        unsigned long long entries;
+        unsigned long long bytes;
+        unsigned long long capacity;
+      };
+
+      static constexpr std::size_t shards = 16;
+      static constexpr std::size_t default_capacity = 32 * 1024 * 1024;
+
+      // Never destroyed: the inotify thread may still be running at exit.
+      static asset_cache &shared()
+      {
+        static auto cache = new asset_cache();
+        return *cache;
+      }
+
+      // Bounds the cache to bytes, 0 disables it. Shrinking evicts.
+      void set_capacity(std::size_t bytes)
+      {
+        m_capacity.store(bytes, std::memory_order_relaxed);
+        for (auto &shard : m_shards)
         {
-          return true;
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          evict(shard, bytes / shards);
         }
-        return GetLastError() == ERROR_ACCESS_DENIED;
       }
-      if (auto shcore = native_library(L"shcore.dll"))
+
+      result find(const std::string &path,
+                  std::shared_ptr<const std::string> &out)
       {
-        if (auto fn = shcore.get(shcore_symbols::SetProcessDpiAwareness))
+        auto capacity = m_capacity.load(std::memory_order_relaxed) / shards;
+        if (capacity == 0)
         {
-          auto result = fn(shcore_symbols::PROCESS_PER_MONITOR_DPI_AWARE);
-          return result == S_OK || result == E_ACCESSDENIED;
+          return result::uncached;
+        }
+        auto &shard = shard_for(path);
+        unsigned long long generation;
+        {
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          auto found = shard.index.find(path);
+          if (found != shard.index.end())
+          {
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            m_hits.fetch_add(1, std::memory_order_relaxed);
+            out = found->second->data;
+            return out ? result::cached : result::missing;
+          }
+          generation = shard.generation;
+        }
+        m_misses.fetch_add(1, std::memory_order_relaxed);
+        // Watched before reading, so that a change during the read is seen.
+        if (!watch(path.substr(0, path.rfind('/'))))
+        {
+          return result::uncached;
+        }
+        auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        std::shared_ptr<std::string> data;
+        if (fd >= 0)
+        {
+          struct stat st;
+          if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) ||
+              path.size() + static_cast<std::size_t>(st.st_size) > capacity)
+          {
+            ::close(fd);
+            return result::uncached;
+          }
+          data = std::make_shared<std::string>(
+              static_cast<std::size_t>(st.st_size), '\0');
+          std::size_t done = 0;
+          while (done < data->size())
+          {
+            auto n = ::read(fd, &(*data)[done], data->size() - done);
+            if (n <= 0)
+            {
+              break;
+            }
+            done += static_cast<std::size_t>(n);
+          }
+          ::close(fd);
+          // Shorter than stat said, it is being written.
+          if (done != data->size())
+          {
+            return result::uncached;
+          }
+        }
+        else if (errno != ENOENT && errno != ENOTDIR)
+        {
+          return result::uncached;
+        }
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        // An invalidation raced with the read, the data may be stale.
+        if (shard.generation == generation && shard.index.count(path) == 0)
+        {
+          auto size = path.size() + (data ? data->size() : 0);
+          shard.lru.push_front({path, data, size});
+          shard.index[path] = shard.lru.begin();
+          shard.bytes += size;
+          evict(shard, capacity);
         }
+        out = data;
+        return data ? result::cached : result::missing;
       }
-      if (auto fn = user32.get(user32_symbols::SetProcessDPIAware))
+
+      stats snapshot()
       {
-        return !!fn();
+        stats st{m_hits.load(std::memory_order_relaxed),
+                 m_misses.load(std::memory_order_relaxed),
+                 m_evictions.load(std::memory_order_relaxed),
+                 m_invalidations.load(std::memory_order_relaxed),
+                 0,
+                 0,
+                 m_capacity.load(std::memory_order_relaxed)};
+        for (auto &shard : m_shards)
+        {
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          st.entries += shard.index.size();
+          st.bytes += shard.bytes;
+        }
+        return st;
       }
-      return true;
-    }
-
-// Enable built-in WebView2Loader implementation by default.
-#ifndef WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL
-#define WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL 1
-#endif
-
-// Link WebView2Loader.dll explicitly by default only if the built-in
-// implementation is enabled.
-#ifndef WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK
-#define WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL
-#endif
-
-// Explicit linking of WebView2Loader.dll should be used along with
-// the built-in implementation.
-#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1 && \
-    WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK != 1
-#undef WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK
-#error Please set WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK=1.
-#endif
 
-#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
-    // Gets the last component of a Windows native file path.
-    // For example, if the path is "C:\a\b" then the result is "b".
-    template <typename T>
-    std::basic_string<T>
-    get_last_native_path_component(const std::basic_string<T> &path)
-    {
-      if (auto pos = path.find_last_of(static_cast<T>('\\'));
-          pos != std::basic_string<T>::npos)
+      // Drops path, or everything below it when it is a directory.
+      void invalidate(const std::string &path, bool directory)
       {
-        return path.substr(pos + 1);
+        if (!directory)
+        {
+          auto &shard = shard_for(path);
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          shard.generation++;
+          auto found = shard.index.find(path);
+          if (found != shard.index.end())
+          {
+            erase(shard, found->second);
+            m_invalidations.fetch_add(1, std::memory_order_relaxed);
+          }
+          return;
+        }
+        auto prefix = path + "/";
+        for (auto &shard : m_shards)
+        {
+          std::lock_guard<std::mutex> lock(shard.mutex);
+          shard.generation++;
+          for (auto it = shard.lru.begin(); it != shard.lru.end();)
+          {
+            auto next = std::next(it);
+            if (prefix == "/" || it->path.compare(0, prefix.size(), prefix) == 0)
+            {
+              erase(shard, it);
+              m_invalidations.fetch_add(1, std::memory_order_relaxed);
+            }
+            it = next;
+          }
+        }
       }
-      return std::basic_string<T>();
-    }
-#endif /* WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL */
-
-    template <typename T>
-    struct cast_info_t
-    {
-      using type = T;
-      IID iid;
-    };
-
-    namespace mswebview2
-    {
-      static constexpr IID
-          IID_ICoreWebView2CreateCoreWebView2ControllerCompletedHandler{
-              0x6C4819F3, 0xC9B7, 0x4260, 0x81, 0x27, 0xC9,
-              0xF5, 0xBD, 0xE7, 0xF6, 0x8C};
-      static constexpr IID
-          IID_ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler{
-              0x4E8A3389, 0xC9D8, 0x4BD2, 0xB6, 0xB5, 0x12,
-              0x4F, 0xEE, 0x6C, 0xC1, 0x4D};
-      static constexpr IID IID_ICoreWebView2PermissionRequestedEventHandler{
-          0x15E1C6A3, 0xC72A, 0x4DF3, 0x91, 0xD7, 0xD0, 0x97, 0xFB, 0xEC, 0x6B, 0xFD};
-      static constexpr IID IID_ICoreWebView2WebMessageReceivedEventHandler{
-          0x57213F19, 0x00E6, 0x49FA, 0x8E, 0x07, 0x89, 0x8E, 0xA0, 0x1E, 0xCB, 0xD2};
 
-#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
-      enum class webview2_runtime_type
+    private:
+      struct entry
       {
-        installed = 0,
-        embedded = 1
+        std::string path;
+        std::shared_ptr<const std::string> data;
+        std::size_t size;
       };
 
-      namespace webview2_symbols
+      struct shard
       {
-        using CreateWebViewEnvironmentWithOptionsInternal_t =
-            HRESULT(STDMETHODCALLTYPE *)(
-                bool, webview2_runtime_type, PCWSTR, IUnknown *,
-                ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler *);
-        using DllCanUnloadNow_t = HRESULT(STDMETHODCALLTYPE *)();
+        std::mutex mutex;
+        std::list<entry> lru;
+        std::unordered_map<std::string, std::list<entry>::iterator> index;
+        std::size_t bytes = 0;
+        // Bumped by every invalidation, see find.
+        unsigned long long generation = 0;
+      };
 
-        static constexpr auto CreateWebViewEnvironmentWithOptionsInternal =
-            library_symbol<CreateWebViewEnvironmentWithOptionsInternal_t>(
-                "CreateWebViewEnvironmentWithOptionsInternal");
-        static constexpr auto DllCanUnloadNow =
-            library_symbol<DllCanUnloadNow_t>("DllCanUnloadNow");
-      } // namespace webview2_symbols
-#endif /* WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL */
+      asset_cache() = default;
 
-#if WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK == 1
-      namespace webview2_symbols
+      shard &shard_for(const std::string &path)
       {
-        using CreateCoreWebView2EnvironmentWithOptions_t = HRESULT(STDMETHODCALLTYPE *)(
-            PCWSTR, PCWSTR, ICoreWebView2EnvironmentOptions *,
-            ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler *);
-        using GetAvailableCoreWebView2BrowserVersionString_t =
-            HRESULT(STDMETHODCALLTYPE *)(PCWSTR, LPWSTR *);
+        return m_shards[std::hash<std::string>()(path) % shards];
+      }
 
-        static constexpr auto CreateCoreWebView2EnvironmentWithOptions =
-            library_symbol<CreateCoreWebView2EnvironmentWithOptions_t>(
-                "CreateCoreWebView2EnvironmentWithOptions");
-        static constexpr auto GetAvailableCoreWebView2BrowserVersionString =
-            library_symbol<GetAvailableCoreWebView2BrowserVersionString_t>(
-                "GetAvailableCoreWebView2BrowserVersionString");
-      } // namespace webview2_symbols
-#endif /* WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK */
+      void erase(shard &s, std::list<entry>::iterator it)
+      {
+        s.bytes -= it->size;
+        s.index.erase(it->path);
+        s.lru.erase(it);
+      }
 
-      class loader
+      void evict(shard &s, std::size_t capacity)
       {
-      public:
-        HRESULT create_environment_with_options(
-            PCWSTR browser_dir, PCWSTR user_data_dir,
-            ICoreWebView2EnvironmentOptions *env_options,
-            ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler
-                *created_handler) const
+        while (s.bytes > capacity && !s.lru.empty())
         {
-#if WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK == 1
-          if (m_lib.is_loaded())
-          {
-            if (auto fn = m_lib.get(
-                    webview2_symbols::CreateCoreWebView2EnvironmentWithOptions))
-            {
-              return fn(browser_dir, user_data_dir, env_options, created_handler);
-            }
-          }
-#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
-          return create_environment_with_options_impl(browser_dir, user_data_dir,
-                                                      env_options, created_handler);
-#else
-          return S_FALSE;
-#endif
-#else
-          return ::CreateCoreWebView2EnvironmentWithOptions(
-              browser_dir, user_data_dir, env_options, created_handler);
-#endif /* WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK */
+          erase(s, std::prev(s.lru.end()));
+          m_evictions.fetch_add(1, std::memory_order_relaxed);
         }
+      }
 
-        HRESULT
-        get_available_browser_version_string(PCWSTR browser_dir,
-                                             LPWSTR *version) const
+#ifdef __linux__
+      bool watch(const std::string &directory)
+      {
+        std::lock_guard<std::mutex> lock(m_watch_mutex);
+        if (m_watched.count(directory) > 0)
         {
-#if WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK == 1
-          if (m_lib.is_loaded())
+          return true;
+        }
+        if (m_inotify < 0)
+        {
+          m_inotify = inotify_init1(IN_CLOEXEC);
+          if (m_inotify < 0)
           {
-            if (auto fn = m_lib.get(
-                    webview2_symbols::GetAvailableCoreWebView2BrowserVersionString))
-            {
-              return fn(browser_dir, version);
-            }
+            return false;
           }
-#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
-          return get_available_browser_version_string_impl(browser_dir, version);
-#else
-          return S_FALSE;
-#endif
-#else
-          return ::GetAvailableCoreWebView2BrowserVersionString(browser_dir, version);
-#endif /* WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK */
+          std::thread([this]()
+                      { read_events(); })
+              .detach();
         }
-
-      private:
-#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
-        struct client_info_t
+        auto wd = inotify_add_watch(
+            m_inotify, directory.empty() ? "/" : directory.c_str(),
+            IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+        if (wd < 0)
         {
-          bool found = false;
-          std::wstring dll_path;
-          std::wstring version;
-          webview2_runtime_type runtime_type;
-        };
+          return false;
+        }
+        m_watched.insert(directory);
+        m_directories[wd] = directory;
+        return true;
+      }
 
-        HRESULT create_environment_with_options_impl(
-            PCWSTR browser_dir, PCWSTR user_data_dir,
-            ICoreWebView2EnvironmentOptions *env_options,
-            ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler
-                *created_handler) const
+      void read_events()
+      {
+        alignas(inotify_event) char buf[16384];
+        while (true)
         {
-          auto found_client = find_available_client(browser_dir);
-          if (!found_client.found)
+          auto n = ::read(m_inotify, buf, sizeof(buf));
+          if (n < 0 && errno == EINTR)
           {
-            return -1;
+            continue;
           }
-          auto client_dll = native_library(found_client.dll_path.c_str());
-          if (auto fn = client_dll.get(
-                  webview2_symbols::CreateWebViewEnvironmentWithOptionsInternal))
+          if (n <= 0)
           {
-            return fn(true, found_client.runtime_type, user_data_dir, env_options,
-                      created_handler);
+            return;
           }
-          if (auto fn = client_dll.get(webview2_symbols::DllCanUnloadNow))
+          for (auto p = buf; p < buf + n;)
           {
-            if (!fn())
+            auto event = reinterpret_cast<const inotify_event *>(p);
+            p += sizeof(inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW)
             {
-              client_dll.detach();
+              invalidate("", true);
+              continue;
+            }
+            std::string directory;
+            {
+              std::lock_guard<std::mutex> lock(m_watch_mutex);
+              auto found = m_directories.find(event->wd);
+              if (found == m_directories.end())
+              {
+                continue;
+              }
+              directory = found->second;
+              // The kernel dropped the watch, the next find watches again.
+              if (event->mask & IN_IGNORED)
+              {
+                m_watched.erase(directory);
+                m_directories.erase(found);
+              }
+            }
+            if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+            {
+              invalidate(directory, true);
+            }
+            else if (event->len > 0)
+            {
+              invalidate(directory + "/" + event->name,
+                         (event->mask & IN_ISDIR) != 0);
             }
           }
-          return ERROR_SUCCESS;
         }
+      }
 
-        HRESULT
-        get_available_browser_version_string_impl(PCWSTR browser_dir,
-                                                  LPWSTR *version) const
+      std::mutex m_watch_mutex;
+      int m_inotify = -1;
+      std::set<std::string> m_watched;
+      std::unordered_map<int, std::string> m_directories;
+#else
+      // Without inotify nothing could be invalidated, so nothing is cached.
+      bool watch(const std::string &) { return false; }
+#endif
+
+      std::array<shard, shards> m_shards;
+      std::atomic<std::size_t> m_capacity{default_capacity};
+      std::atomic<unsigned long long> m_hits{0};
+      std::atomic<unsigned long long> m_misses{0};
+      std::atomic<unsigned long long> m_evictions{0};
+      std::atomic<unsigned long long> m_invalidations{0};
+    };
+
+#ifdef __linux__
+    // Watches a folder and the folders below it, and reports the files
+    // written in it once they have been quiet for 50 ms, so that an editor
+    // saving in several steps gives a single report. Paths are relative to
+    // the folder and start with '/'. Hidden files, backups ending with '~'
+    // and names without an extension, which editors write while saving, are
+    // not reported.
+    class folder_watcher
+    {
+    public:
+      using changes_fn_t =
+          std::function<void(const std::vector<std::string> &)>;
+
+      static constexpr int quiet_ms = 50;
+
+      // Returns nullptr if the folder cannot be watched.
+      static std::unique_ptr<folder_watcher> start(const std::string &folder,
+                                                   changes_fn_t fn)
+      {
+        std::unique_ptr<folder_watcher> w(
+            new folder_watcher(folder, std::move(fn)));
+        w->m_inotify = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+        if (w->m_inotify < 0 || pipe2(w->m_stop, O_CLOEXEC) != 0 ||
+            !w->add(""))
         {
-          if (!version)
+          return nullptr;
+        }
+        w->m_thread = std::thread([w = w.get()]()
+                                  { w->run(); });
+        return w;
+      }
+
+      ~folder_watcher()
+      {
+        if (m_thread.joinable())
+        {
+          while (::write(m_stop[1], "", 1) < 0 && errno == EINTR)
           {
-            return -1;
           }
-          auto found_client = find_available_client(browser_dir);
-          if (!found_client.found)
+          m_thread.join();
+        }
+        for (auto fd : {m_inotify, m_stop[0], m_stop[1]})
+        {
+          if (fd >= 0)
           {
-            return -1;
+            ::close(fd);
           }
-          auto info_length_bytes =
-              found_client.version.size() * sizeof(found_client.version[0]);
-          auto info = static_cast<LPWSTR>(CoTaskMemAlloc(info_length_bytes));
-          if (!info)
+        }
+      }
+
+      folder_watcher(const folder_watcher &) = delete;
+      folder_watcher &operator=(const folder_watcher &) = delete;
+
+    private:
+      folder_watcher(const std::string &folder, changes_fn_t fn)
+          : m_folder(folder), m_fn(std::move(fn)) {}
+
+      static bool reported(const char *name)
+      {
+        return name[0] != '\0' && name[0] != '.' &&
+               name[std::strlen(name) - 1] != '~' &&
+               std::strchr(name, '.') != nullptr;
+      }
+
+      // Watches folder + relative and, unless it was already watched, the
+      // folders below it. Symbolic links are not followed.
+      bool add(const std::string &relative)
+      {
+        auto path = m_folder + relative;
+        auto wd = inotify_add_watch(
+            m_inotify, path.c_str(),
+            IN_CLOSE_WRITE | IN_MOVED_TO | IN_ATTRIB | IN_CREATE |
+                IN_ONLYDIR | IN_DONT_FOLLOW);
+        if (wd < 0)
+        {
+          return false;
+        }
+        if (!m_directories.emplace(wd, relative).second)
+        {
+          return true;
+        }
+        auto dir = opendir(path.c_str());
+        if (dir == nullptr)
+        {
+          return true;
+        }
+        while (auto entry = readdir(dir))
+        {
+          std::string name = entry->d_name;
+          if (name != "." && name != ".." &&
+              (entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN))
           {
-            return -1;
+            add(relative + "/" + name);
           }
-          CopyMemory(info, found_client.version.c_str(), info_length_bytes);
-          *version = info;
-          return 0;
         }
+        closedir(dir);
+        return true;
+      }
 
-        client_info_t find_available_client(PCWSTR browser_dir) const
+      void run()
+      {
+        std::set<std::string> changed;
+        alignas(inotify_event) char buf[16384];
+        while (true)
         {
-          if (browser_dir)
+          pollfd fds[] = {{m_inotify, POLLIN, 0}, {m_stop[0], POLLIN, 0}};
+          auto n = poll(fds, 2, changed.empty() ? -1 : quiet_ms);
+          if (n < 0 && errno == EINTR)
           {
-            return find_embedded_client(api_version, browser_dir);
+            continue;
           }
-          auto found_client =
-              find_installed_client(api_version, true, default_release_channel_guid);
-          if (!found_client.found)
+          if (n < 0 || fds[1].revents != 0)
           {
-            found_client = find_installed_client(api_version, false,
-                                                 default_release_channel_guid);
+            return;
+          }
+          if (n == 0)
+          {
+            m_fn(std::vector<std::string>(changed.begin(), changed.end()));
+            changed.clear();
+            continue;
+          }
+          ssize_t size;
+          while ((size = ::read(m_inotify, buf, sizeof(buf))) > 0)
+          {
+            for (auto p = buf; p < buf + size;)
+            {
+              auto event = reinterpret_cast<const inotify_event *>(p);
+              p += sizeof(inotify_event) + event->len;
+              auto found = m_directories.find(event->wd);
+              if (found == m_directories.end())
+              {
+                continue;
+              }
+              if (event->mask & IN_IGNORED)
+              {
+                m_directories.erase(found);
+                continue;
+              }
+              if (event->len == 0)
+              {
+                continue;
+              }
+              auto path = found->second + "/" + event->name;
+              if (event->mask & IN_ISDIR)
+              {
+                // Files written before the watch was added are missed, the
+                // next write reports them.
+                if (event->mask & (IN_CREATE | IN_MOVED_TO))
+                {
+                  add(path);
+                }
+              }
+              else if ((event->mask & IN_CREATE) == 0 &&
+                       reported(event->name))
+              {
+                changed.insert(path);
+              }
+            }
           }
-          return found_client;
         }
+      }
 
-        std::wstring make_client_dll_path(const std::wstring &dir) const
+      std::string m_folder;
+      changes_fn_t m_fn;
+      int m_inotify = -1;
+      int m_stop[2] = {-1, -1};
+      // Watched folders by watch descriptor, relative to m_folder. Only the
+      // watcher thread uses it once started.
+      std::unordered_map<int, std::string> m_directories;
+      std::thread m_thread;
+    };
+#endif
+
+    // Folders mapped to host names, served as scheme://host/path. The access
+    // kinds are those of WebView2 virtual hosts.
+    class virtual_hosts
+    {
+    public:
+      static constexpr const char *scheme = "webview";
+
+      enum access
+      {
+        // Pages of other origins cannot use the files at all.
+        access_deny = 0,
+        // Any page can use the files, including with CORS requests.
+        access_allow = 1,
+        // Other origins can load the files as subresources but not through
+        // CORS requests.
+        access_deny_cors = 2
+      };
+
+      // Strips the scheme and trailing slashes a host may be given with, as
+      // WebView2 accepts, ex: "https://app.example/".
+      static std::string normalize_host(std::string host)
+      {
+        for (const char *prefix : {"https://", "http://"})
         {
-          auto dll_path = dir;
-          if (!dll_path.empty())
+          if (host.compare(0, std::strlen(prefix), prefix) == 0)
           {
-            auto last_char = dir[dir.size() - 1];
-            if (last_char != L'\\' && last_char != L'/')
+            host.erase(0, std::strlen(prefix));
+          }
+        }
+        while (!host.empty() && host.back() == '/')
+        {
+          host.pop_back();
+        }
+        return host;
+      }
+
+      // Maps host to folder. Returns true for the first mapping, when the
+      // scheme has to be registered.
+      bool set(const std::string &host, std::string folder, int access)
+      {
+        while (folder.size() > 1 && folder.back() == '/')
+        {
+          folder.pop_back();
+        }
+        return add(host, {folder, nullptr, access});
+      }
+
+      // Maps host to the entries of a bundle instead of a folder.
+      bool set_bundle(const std::string &host,
+                      std::shared_ptr<asset_bundle> bundle, int access)
+      {
+        return add(host, {std::string(), std::move(bundle), access});
+      }
+
+      // Turns http(s)://host/... of a mapped host into scheme://host/..., so
+      // that pages written for WebView2 load unchanged.
+      std::string rewrite(const std::string &url) const
+      {
+        for (const char *prefix : {"https://", "http://"})
+        {
+          auto n = std::strlen(prefix);
+          if (url.compare(0, n, prefix) == 0)
+          {
+            auto host = url.substr(n, url.find_first_of("/?#", n) - n);
+            if (m_hosts.count(host) > 0)
             {
-              dll_path += L'\\';
+              return std::string(scheme) + "://" + url.substr(n);
             }
           }
-          dll_path += L"EBWebView\\";
-#if defined(_M_X64) || defined(__x86_64__)
-          dll_path += L"x64";
-#elif defined(_M_IX86) || defined(__i386__)
-          dll_path += L"x86";
-#elif defined(_M_ARM64) || defined(__aarch64__)
-          dll_path += L"arm64";
-#else
-#error WebView2 integration for this platform is not yet supported.
-#endif
-          dll_path += L"\\EmbeddedBrowserWebView.dll";
-          return dll_path;
         }
+        return url;
+      }
 
-        client_info_t
-        find_installed_client(unsigned int min_api_version, bool system,
-                              const std::wstring &release_channel) const
+      void serve(scheme_request *r) const
+      {
+        auto host = host_of(r->uri());
+        auto found = m_hosts.find(host);
+        if (found == m_hosts.end())
         {
-          std::wstring sub_key = client_state_reg_sub_key;
-          sub_key += release_channel;
-          auto root_key = system ? HKEY_LOCAL_MACHINE : HKEY_CURRENT_USER;
-          reg_key key(root_key, sub_key, 0, KEY_READ | KEY_WOW64_32KEY);
-          if (!key.is_open())
+          r->fail("No virtual host " + host);
+          return;
+        }
+        const auto &mapping = found->second;
+        if (mapping.access == access_deny && !same_origin(r, host))
+        {
+          r->fail("Cross origin access to " + r->uri() + " is denied");
+          return;
+        }
+        std::string relative;
+        if (!decode_path(r->path(), relative))
+        {
+          r->fail("Invalid path " + r->path());
+          return;
+        }
+        if (relative.back() == '/')
+        {
+          relative += "index.html";
+        }
+        if (mapping.access == access_allow)
+        {
+          r->set_header("Access-Control-Allow-Origin", "*");
+        }
+        auto mime = mime_type_for(relative);
+        if (mapping.bundle)
+        {
+          asset_bundle::entry e;
+          if (!mapping.bundle->find(relative, e))
           {
-            return {};
+            respond_not_found(r);
+            return;
           }
-          auto ebwebview_value = key.query_string(L"EBWebView");
-
-          auto client_version_string =
-              get_last_native_path_component(ebwebview_value);
-          auto client_version = parse_version(client_version_string);
-          if (client_version[2] < min_api_version)
+          // The bundle stays mapped while the engine reads the entry, even
+          // if the host is remapped meanwhile.
+          auto keep = new std::shared_ptr<asset_bundle>(mapping.bundle);
+          auto release = +[](void *bundle)
+          { delete static_cast<std::shared_ptr<asset_bundle> *>(bundle); };
+          if (e.encoding == bundle_format::identity)
           {
-            // Our API version is greater than the runtime API version.
-            return {};
+            respond_range(r, mime, e.data, e.size, release, keep);
           }
-
-          auto client_dll_path = make_client_dll_path(ebwebview_value);
-          return {true, client_dll_path, client_version_string,
-                  webview2_runtime_type::installed};
+          else if (!r->respond_encoded(
+                       200, mime, bundle_format::encoding_name(e.encoding),
+                       e.data, e.size, e.decoded_size, release, keep))
+          {
+            delete keep;
+            r->fail("Unsupported encoding of " + relative);
+          }
+          return;
         }
-
-        client_info_t find_embedded_client(unsigned int min_api_version,
-                                           const std::wstring &dir) const
+        // Pre-compressed siblings are read instead of the file, unless the
+        // request wants a range of it, as media elements do.
+        if (r->header("Range").empty())
         {
-          auto client_dll_path = make_client_dll_path(dir);
-
-          auto client_version_string = get_file_version_string(client_dll_path);
-          auto client_version = parse_version(client_version_string);
-          if (client_version[2] < min_api_version)
+          static const std::pair<const char *, const char *> encodings[] = {
+              {"br", ".br"}, {"gzip", ".gz"}};
+          for (const auto &encoding : encodings)
           {
-            // Our API version is greater than the runtime API version.
-            return {};
+            asset a;
+            if (open_asset(mapping.folder + relative + encoding.second, a))
+            {
+              // Siblings too large to read into memory are not used.
+              if (a.fd < 0 &&
+                  r->respond_encoded(200, mime, encoding.first, a.data, a.size,
+                                     -1, a.release, a.arg))
+              {
+                return;
+              }
+              close_asset(a);
+            }
           }
-
-          return {true, client_dll_path, client_version_string,
-                  webview2_runtime_type::embedded};
         }
+        asset a;
+        if (!open_asset(mapping.folder + relative, a))
+        {
+          respond_not_found(r);
+          return;
+        }
+        if (a.fd >= 0)
+        {
+          respond_file_range(r, mime, a.fd, a.size);
+          return;
+        }
+        respond_range(r, mime, a.data, a.size, a.release, a.arg);
+      }
 
-        // The minimum WebView2 API version we need regardless of the SDK release
-        // actually used. The number comes from the SDK release version,
-        // e.g. 1.0.1150.38. To be safe the SDK should have a number that is greater
-        // than or equal to this number. The Edge browser webview client must
-        // have a number greater than or equal to this number.
-        static constexpr unsigned int api_version = 1150;
-
-        static constexpr auto client_state_reg_sub_key =
-            L"SOFTWARE\\Microsoft\\EdgeUpdate\\ClientState\\";
-
-        // GUID for the stable release channel.
-        static constexpr auto stable_release_guid =
-            L"{F3017226-FE2A-4295-8BDF-00C3A9A7E4C5}";
-
-        static constexpr auto default_release_channel_guid = stable_release_guid;
-#endif /* WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL */
-
-#if WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK == 1
-        native_library m_lib{L"WebView2Loader.dll"};
-#endif
+    private:
+      struct mapping
+      {
+        std::string folder;
+        std::shared_ptr<asset_bundle> bundle;
+        int access;
       };
 
-      namespace cast_info
+      bool add(const std::string &name, mapping m)
       {
-        static constexpr auto controller_completed =
-            cast_info_t<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>{
-                IID_ICoreWebView2CreateCoreWebView2ControllerCompletedHandler};
-
-        static constexpr auto environment_completed =
-            cast_info_t<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>{
-                IID_ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler};
-
-        static constexpr auto message_received =
-            cast_info_t<ICoreWebView2WebMessageReceivedEventHandler>{
-                IID_ICoreWebView2WebMessageReceivedEventHandler};
-
-        static constexpr auto permission_requested =
-            cast_info_t<ICoreWebView2PermissionRequestedEventHandler>{
-                IID_ICoreWebView2PermissionRequestedEventHandler};
-      } // namespace cast_info
-    }   // namespace mswebview2
+        auto host = normalize_host(name);
+        auto first = m_hosts.empty();
+        m_hosts[host] = std::move(m);
+        return first;
+      }
 
-    class webview2_com_handler
-        : public ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler,
-          public ICoreWebView2CreateCoreWebView2ControllerCompletedHandler,
-          public ICoreWebView2WebMessageReceivedEventHandler,
-          public ICoreWebView2PermissionRequestedEventHandler
-    {
-      using webview2_com_handler_cb_t =
-          std::function<void(ICoreWebView2Controller *, ICoreWebView2 *webview)>;
+      // Files up to this size are read into memory when the asset cache does
+      // not hold them. Larger files are streamed from their descriptor.
+      static constexpr std::size_t read_limit = 1024 * 1024;
 
-    public:
-      webview2_com_handler(HWND hwnd, msg_cb_t msgCb, webview2_com_handler_cb_t cb)
-          : m_window(hwnd), m_msgCb(msgCb), m_cb(cb) {}
+      // The contents of a file, released with release(arg). For a file over
+      // read_limit, data is null and fd is the open file of size bytes.
+      struct asset
+      {
+        const char *data;
+        std::size_t size;
+        scheme_request::release_fn_t release;
+        void *arg;
+        int fd;
+      };
 
-      virtual ~webview2_com_handler() = default;
-      webview2_com_handler(const webview2_com_handler &other) = delete;
-      webview2_com_handler &operator=(const webview2_com_handler &other) = delete;
-      webview2_com_handler(webview2_com_handler &&other) = delete;
-      webview2_com_handler &operator=(webview2_com_handler &&other) = delete;
+      static asset hold(std::shared_ptr<const std::string> contents)
+      {
+        auto keep = new std::shared_ptr<const std::string>(contents);
+        return {contents->data(), contents->size(), +[](void *data)
+                { delete static_cast<std::shared_ptr<const std::string> *>(data); },
+                keep, -1};
+      }
 
-      ULONG STDMETHODCALLTYPE AddRef() { return ++m_ref_count; }
-      ULONG STDMETHODCALLTYPE Release()
+      static void close_asset(asset &a)
       {
-        if (m_ref_count > 1)
+        if (a.fd >= 0)
         {
-          return --m_ref_count;
+          ::close(a.fd);
+        }
+        else
+        {
+          a.release(a.arg);
         }
-        delete this;
-        return 0;
       }
-      HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, LPVOID *ppv)
-      {
-        using namespace mswebview2::cast_info;
 
-        if (!ppv)
+      // Looks path up in the asset cache, or opens the file when the cache
+      // cannot hold it. Returns false if there is no such file.
+      static bool open_asset(const std::string &path, asset &a)
+      {
+        std::shared_ptr<const std::string> cached;
+        switch (asset_cache::shared().find(path, cached))
         {
-          return E_POINTER;
+        case asset_cache::result::missing:
+          return false;
+        case asset_cache::result::cached:
+          a = hold(std::move(cached));
+          return true;
+        case asset_cache::result::uncached:
+          break;
         }
-
-        // All of the COM interfaces we implement should be added here regardless
-        // of whether they are required.
-        // This is just to be on the safe side in case the WebView2 Runtime ever
-        // requests a pointer to an interface we implement.
-        // The WebView2 Runtime must at the very least be able to get a pointer to
-        // ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler when we use
-        // our custom WebView2 loader implementation, and observations have shown
-        // that it is the only interface requested in this case. None have been
-        // observed to be requested when using the official WebView2 loader.
-
-        if (cast_if_equal_iid(riid, controller_completed, ppv) ||
-            cast_if_equal_iid(riid, environment_completed, ppv) ||
-            cast_if_equal_iid(riid, message_received, ppv) ||
-            cast_if_equal_iid(riid, permission_requested, ppv))
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
         {
-          return S_OK;
+          return false;
         }
-
-        return E_NOINTERFACE;
-      }
-      HRESULT STDMETHODCALLTYPE Invoke(HRESULT res, ICoreWebView2Environment *env)
-      {
-        if (SUCCEEDED(res))
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
         {
-          res = env->CreateCoreWebView2Controller(m_window, this);
-          if (SUCCEEDED(res))
-          {
-            return S_OK;
-          }
+          ::close(fd);
+          return false;
         }
-        try_create_environment();
-        return S_OK;
-      }
-      HRESULT STDMETHODCALLTYPE Invoke(HRESULT res,
-                                       ICoreWebView2Controller *controller)
-      {
-        if (FAILED(res))
+        auto size = static_cast<std::size_t>(st.st_size);
+        if (size > read_limit)
         {
-          // See try_create_environment() regarding
-          // HRESULT_FROM_WIN32(ERROR_INVALID_STATE).
-          // The result is E_ABORT if the parent window has been destroyed already.
-          switch (res)
+          a = {nullptr, size, nullptr, nullptr, fd};
+          return true;
+        }
+        // Read to the end rather than to the size, which is stale if the
+        // file is being written.
+        auto contents = std::make_shared<std::string>();
+        contents->reserve(size);
+        char buf[16384];
+        ssize_t n;
+        while ((n = ::read(fd, buf, sizeof(buf))) != 0)
+        {
+          if (n < 0 && errno != EINTR)
           {
-          case HRESULT_FROM_WIN32(ERROR_INVALID_STATE):
-          case E_ABORT:
-            return S_OK;
+            ::close(fd);
+            return false;
+          }
+          if (n > 0)
+          {
+            contents->append(buf, static_cast<std::size_t>(n));
           }
-          try_create_environment();
-          return S_OK;
         }
-
-        ICoreWebView2 *webview;
-        ::EventRegistrationToken token;
-        controller->get_CoreWebView2(&webview);
-        webview->add_WebMessageReceived(this, &token);
-        webview->add_PermissionRequested(this, &token);
-
-        m_cb(controller, webview);
-        return S_OK;
+        ::close(fd);
+        a = hold(std::move(contents));
+        return true;
       }
-      HRESULT STDMETHODCALLTYPE Invoke(
-          ICoreWebView2 *sender, ICoreWebView2WebMessageReceivedEventArgs *args)
+
+      static void respond_not_found(scheme_request *r)
       {
-        LPWSTR message;
-        args->TryGetWebMessageAsString(&message);
-        m_msgCb(narrow_string(message));
-        sender->PostWebMessageAsString(message);
+        static const char not_found[] = "Not Found";
+        r->respond(404, "text/plain", not_found, sizeof(not_found) - 1,
+                   +[](void *) {}, nullptr);
+      }
 
-        CoTaskMemFree(message);
-        return S_OK;
+      // Sets the range headers for size bytes and returns the status to
+      // answer with. A 416 is answered here.
+      static int prepare_range(scheme_request *r, const char *mime,
+                               std::size_t size, byte_range &range)
+      {
+        r->set_header("Accept-Ranges", "bytes");
+        range = {0, size};
+        auto status = parse_range(r->header("Range"), size, range);
+        if (status == 416)
+        {
+          r->set_header("Content-Range", "bytes */" + std::to_string(size));
+          r->respond(416, mime, "", 0, nullptr, nullptr);
+        }
+        else if (status == 206)
+        {
+          r->set_header("Content-Range",
+                        "bytes " + std::to_string(range.start) + "-" +
+                            std::to_string(range.start + range.length - 1) +
+                            "/" + std::to_string(size));
+        }
+        return status;
       }
-      HRESULT STDMETHODCALLTYPE Invoke(
-          ICoreWebView2 *sender, ICoreWebView2PermissionRequestedEventArgs *args)
+
+      // Answers with the range the request asks for, or the whole data.
+      // release(arg) is called once the data is no longer needed.
+      static void respond_range(scheme_request *r, const char *mime,
+                                const char *data, std::size_t size,
+                                scheme_request::release_fn_t release, void *arg)
       {
-        COREWEBVIEW2_PERMISSION_KIND kind;
-        args->get_PermissionKind(&kind);
-        if (kind == COREWEBVIEW2_PERMISSION_KIND_CLIPBOARD_READ)
+        byte_range range;
+        auto status = prepare_range(r, mime, size, range);
+        if (status == 416)
         {
-          args->put_State(COREWEBVIEW2_PERMISSION_STATE_ALLOW);
+          release(arg);
+          return;
         }
-        return S_OK;
+        r->respond(status, mime, data + range.start, range.length, release, arg);
       }
 
-      // Checks whether the specified IID equals the IID of the specified type and
-      // if so casts the "this" pointer to T and returns it. Returns nullptr on
-      // mismatching IIDs.
-      // If ppv is specified then the pointer will also be assigned to *ppv.
-      template <typename T>
-      T *cast_if_equal_iid(REFIID riid, const cast_info_t<T> &info,
-                           LPVOID *ppv = nullptr) noexcept
+      // Answers with the range the request asks for, or the whole file, read
+      // from fd as the engine needs it. fd is closed once the engine is done.
+      static void respond_file_range(scheme_request *r, const char *mime,
+                                     int fd, std::size_t size)
       {
-        T *ptr = nullptr;
-        if (IsEqualIID(riid, info.iid))
+        byte_range range;
+        auto status = prepare_range(r, mime, size, range);
+        if (status == 416)
         {
-          ptr = static_cast<T *>(this);
-          ptr->AddRef();
+          ::close(fd);
+          return;
         }
-        if (ppv)
+        r->respond_stream(status, mime, static_cast<long long>(range.length),
+                          file_reader::read, file_reader::close,
+                          new file_reader(fd, range.start, range.length));
+      }
+
+      static std::string host_of(const std::string &uri)
+      {
+        auto start = uri.find("://");
+        if (start == std::string::npos)
         {
-          *ppv = ptr;
+          return std::string();
         }
-        return ptr;
+        start += 3;
+        return uri.substr(start, uri.find_first_of("/?#", start) - start);
       }
 
-      // Set the function that will perform the initiating logic for creating
-      // the WebView2 environment.
-      void set_attempt_handler(std::function<HRESULT()> attempt_handler) noexcept
+      // Requests without an Origin or a Referer, as on WebKitGTK before 2.36,
+      // are taken as same origin.
+      static bool same_origin(const scheme_request *r, const std::string &host)
       {
-        m_attempt_handler = attempt_handler;
+        auto origin = std::string(scheme) + "://" + host;
+        auto from = r->header("Origin");
+        if (from.empty())
+        {
+          from = r->header("Referer");
+          return from.empty() || from.compare(0, origin.size() + 1,
+                                              origin + "/") == 0;
+        }
+        return from == origin;
       }
 
-      // Retry creating a WebView2 environment.
-      // The initiating logic for creating the environment is defined by the
-      // caller of set_attempt_handler().
-      void try_create_environment() noexcept
+      // Decodes the path of a request into a path below the folder. Fails on
+      // NUL bytes and on ".." segments, which would leave the folder.
+      static bool decode_path(const std::string &path, std::string &out)
       {
-        // WebView creation fails with HRESULT_FROM_WIN32(ERROR_INVALID_STATE) if
-        // a running instance using the same user data folder exists, and the
-        // Environment objects have different EnvironmentOptions.
-        // Source: https://docs.microsoft.com/en-us/microsoft-edge/webview2/reference/win32/icorewebview2environment?view=webview2-1.0.1150.38
-        if (m_attempts < m_max_attempts)
+        out = "/";
+        for (std::size_t i = 0; i < path.size(); i++)
         {
-          ++m_attempts;
-          auto res = m_attempt_handler();
-          if (SUCCEEDED(res))
+          char c = path[i];
+          if (c == '%')
           {
-            return;
+            if (i + 2 >= path.size() || !std::isxdigit(path[i + 1]) ||
+                !std::isxdigit(path[i + 2]))
+            {
+              return false;
+            }
+            c = static_cast<char>(
+                std::strtol(path.substr(i + 1, 2).c_str(), nullptr, 16));
+            i += 2;
+            if (c == '\0')
+            {
+              return false;
+            }
           }
-          // Not entirely sure if this error code only applies to
-          // CreateCoreWebView2Controller so we check here as well.
-          if (res == HRESULT_FROM_WIN32(ERROR_INVALID_STATE))
+          if (c == '/' && out.back() == '/')
           {
-            return;
+            continue;
           }
-          try_create_environment();
-          return;
+          out += c;
         }
-        // Give up.
-        m_cb(nullptr, nullptr);
+        std::size_t start = 0;
+        while (start < out.size())
+        {
+          auto end = out.find('/', start + 1);
+          if (out.compare(start, end - start, "/..") == 0 &&
+              (end == std::string::npos || end - start == 3))
+          {
+            return false;
+          }
+          start = end;
+        }
+        return true;
       }
 
-    private:
-      HWND m_window;
-      msg_cb_t m_msgCb;
-      webview2_com_handler_cb_t m_cb;
-      std::atomic<ULONG> m_ref_count{1};
-      std::function<HRESULT()> m_attempt_handler;
-      unsigned int m_max_attempts = 5;
-      unsigned int m_attempts = 0;
+      std::map<std::string, mapping> m_hosts;
     };
 
-    class win32_edge_engine
-    {
-    public:
-      win32_edge_engine(bool debug, void *window)
-      {
-        if (!is_webview2_available())
-        {
-          return;
-        }
-        if (!m_com_init.is_initialized())
-        {
-          return;
-        }
-        enable_dpi_awareness();
-        if (window == nullptr)
-        {
-          HINSTANCE hInstance = GetModuleHandle(nullptr);
-          HICON icon = (HICON)LoadImage(
-              hInstance, IDI_APPLICATION, IMAGE_ICON, GetSystemMetrics(SM_CXICON),
-              GetSystemMetrics(SM_CYICON), LR_DEFAULTCOLOR);
+  } // namespace detail
+} // namespace webview
 
-          WNDCLASSEXW wc;
-          ZeroMemory(&wc, sizeof(WNDCLASSEX));
-          wc.cbSize = sizeof(WNDCLASSEX);
-          wc.hInstance = hInstance;
-          wc.lpszClassName = L"webview";
-          wc.hIcon = icon;
-          wc.lpfnWndProc =
-              (WNDPROC)(+[](HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) -> LRESULT
-                        {
-                          auto w = (win32_edge_engine *)GetWindowLongPtr(hwnd, GWLP_USERDATA);
-                          switch (msg)
-                          {
-                          case WM_SIZE:
-                            w->resize(hwnd);
+#endif /* WEBVIEW_GTK, WEBVIEW_HEADLESS */
+
+#if defined(WEBVIEW_GTK)
+//
+// ====================================================================
+//
+// This implementation uses webkit2gtk backend. It requires gtk+3.0 and
+// webkit2gtk-4.0 libraries. Proper compiler flags can be retrieved via:
+//
+//   pkg-config --cflags --libs gtk+-3.0 webkit2gtk-4.0
+//
+// ====================================================================
+//
+#include <JavaScriptCore/JavaScript.h>
+#include <gtk/gtk.h>
+#include <webkit2/webkit2.h>
+
+namespace webview
+{
+  namespace detail
+  {
+
+    // A GInputStream that pulls its bytes from a scheme_request::read_fn_t.
+    // WebKit reads it asynchronously, so the reader runs on a GIO worker
+    // thread.
+    struct reader_stream
+    {
+      GInputStream parent;
+      scheme_request::read_fn_t read;
+      scheme_request::release_fn_t close;
+      void *arg;
+    };
+
+    inline GType reader_stream_get_type()
+    {
+      static GType type = g_type_register_static_simple(
+          G_TYPE_INPUT_STREAM, "WebviewReaderStream", sizeof(GInputStreamClass),
+          (GClassInitFunc)(+[](gpointer klass, gpointer)
+                           {
+            auto stream_class = G_INPUT_STREAM_CLASS(klass);
+            stream_class->read_fn = +[](GInputStream *stream, void *buf,
+                                        gsize size, GCancellable *,
+                                        GError **error) -> gssize
+            {
+              auto r = reinterpret_cast<reader_stream *>(stream);
+              auto n = r->read(buf, size, r->arg);
+              if (n < 0)
+              {
+                g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                                    "Failed to read the scheme response");
+                return -1;
+              }
+              return static_cast<gssize>(n);
+            };
+            // GInputStream closes the stream when it is disposed, so this runs
+            // even if WebKit gives up on the response.
+            stream_class->close_fn = +[](GInputStream *stream, GCancellable *,
+                                         GError **) -> gboolean
+            {
+              auto r = reinterpret_cast<reader_stream *>(stream);
+              if (r->close != nullptr)
+              {
+                r->close(r->arg);
+                r->close = nullptr;
+              }
+              return TRUE;
+            }; }),
+          sizeof(reader_stream), nullptr, static_cast<GTypeFlags>(0));
+      return type;
+    }
+
+    class gtk_scheme_request : public scheme_request
+    {
+    public:
+      explicit gtk_scheme_request(WebKitURISchemeRequest *request)
+          : m_request(request)
+      {
+        g_object_ref(m_request);
+        m_uri = webkit_uri_scheme_request_get_uri(m_request);
+        m_path = webkit_uri_scheme_request_get_path(m_request);
+      }
+
+      ~gtk_scheme_request() override { g_object_unref(m_request); }
+
+      std::string header(const std::string &name) const override
+      {
+#if WEBKIT_CHECK_VERSION(2, 36, 0)
+        auto headers = webkit_uri_scheme_request_get_http_headers(m_request);
+        auto value = headers == nullptr
+                         ? nullptr
+                         : soup_message_headers_get_one(headers, name.c_str());
+        return value == nullptr ? std::string() : value;
+#else
+        (void)name;
+        return std::string();
+#endif
+      }
+
+      void respond(int status, const std::string &mime, const void *data,
+                   std::size_t size, release_fn_t release, void *arg) override
+      {
+        finish(status, mime, memory_stream(data, size, release, arg),
+               static_cast<gint64>(size));
+      }
+
+      // WebKit hands the body of a custom scheme to the page as is, without
+      // looking at Content-Encoding, so the body is decoded on the GIO thread
+      // that reads it. Only the compressed bytes are read from disk.
+      bool respond_encoded(int status, const std::string &mime,
+                           const std::string &encoding, const void *data,
+                           std::size_t size, long long decoded_size,
+                           release_fn_t release, void *arg) override
+      {
+#ifdef WEBVIEW_BROTLI
+        if (encoding == "br")
+        {
+          respond_stream(status, mime, decoded_size, brotli_reader::read,
+                         brotli_reader::close,
+                         new brotli_reader(data, size, release, arg));
+          return true;
+        }
+#endif
+        if (encoding != "gzip")
+        {
+          return false;
+        }
+        auto compressed = memory_stream(data, size, release, arg);
+        auto decompressor =
+            g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+        auto stream =
+            g_converter_input_stream_new(compressed, G_CONVERTER(decompressor));
+        g_object_unref(decompressor);
+        g_object_unref(compressed);
+        finish(status, mime, stream, decoded_size);
+        return true;
+      }
+
+      void respond_stream(int status, const std::string &mime, long long size,
+                          read_fn_t read, release_fn_t close,
+                          void *arg) override
+      {
+        auto stream = static_cast<reader_stream *>(
+            g_object_new(reader_stream_get_type(), nullptr));
+        stream->read = read;
+        stream->close = close;
+        stream->arg = arg;
+        finish(status, mime, G_INPUT_STREAM(stream), size);
+      }
+
+      void fail(const std::string &message) override
+      {
+        auto error =
+            g_error_new_literal(G_IO_ERROR, G_IO_ERROR_NOT_FOUND, message.c_str());
+        webkit_uri_scheme_request_finish_error(m_request, error);
+        g_error_free(error);
+        delete this;
+      }
+
+    private:
+      static GInputStream *memory_stream(const void *data, std::size_t size,
+                                         release_fn_t release, void *arg)
+      {
+        auto bytes = release != nullptr
+                         ? g_bytes_new_with_free_func(data, size, release, arg)
+                         : g_bytes_new(data, size);
+        auto stream = g_memory_input_stream_new_from_bytes(bytes);
+        g_bytes_unref(bytes);
+        return stream;
+      }
+
+      // Status and headers need WebKitGTK 2.36, older versions answer 200
+      // with the content type only.
+      void finish(int status, const std::string &mime, GInputStream *stream,
+                  gint64 size)
+      {
+#if WEBKIT_CHECK_VERSION(2, 36, 0)
+        auto response = webkit_uri_scheme_response_new(stream, size);
+        webkit_uri_scheme_response_set_status(
+            response, static_cast<guint>(status), nullptr);
+        webkit_uri_scheme_response_set_content_type(response, mime.c_str());
+        if (!m_headers.empty())
+        {
+          auto headers = soup_message_headers_new(SOUP_MESSAGE_HEADERS_RESPONSE);
+          for (const auto &header : m_headers)
+          {
+            soup_message_headers_append(headers, header.first.c_str(),
+                                        header.second.c_str());
+          }
+          webkit_uri_scheme_response_set_http_headers(response, headers);
+        }
+        webkit_uri_scheme_request_finish_with_response(m_request, response);
+        g_object_unref(response);
+#else
+        (void)status;
+        webkit_uri_scheme_request_finish(m_request, stream, size, mime.c_str());
+#endif
+        g_object_unref(stream);
+        delete this;
+      }
+
+      WebKitURISchemeRequest *m_request;
+    };
+
+    class gtk_webkit_engine
+    {
+    public:
+      gtk_webkit_engine(bool debug, void *window, bool visible = true)
+          : m_window(static_cast<GtkWidget *>(window))
+      {
+        if (gtk_init_check(nullptr, nullptr) == FALSE)
+        {
+          return;
+        }
+        m_window = static_cast<GtkWidget *>(window);
+        if (m_window == nullptr)
+        {
+          m_window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+          m_owns_window = true;
+        }
+        g_signal_connect(G_OBJECT(m_window), "destroy",
+                         G_CALLBACK(+[](GtkWidget *, gpointer arg)
+                                    {
+                                      auto *w = static_cast<gtk_webkit_engine *>(arg);
+                                      // The web view goes along with its window.
+                                      w->m_window = nullptr;
+                                      w->m_webview = nullptr;
+                                      if (w->on_destroy)
+                                      {
+                                        w->on_destroy();
+                                      }
+                                      w->terminate();
+                                    }),
+                         this);
+        // Initialize webview widget
+        m_webview = webkit_web_view_new();
+        WebKitUserContentManager *manager =
+            webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(m_webview));
+        g_signal_connect(manager, "script-message-received::external",
+                         G_CALLBACK(+[](WebKitUserContentManager *,
+                                        WebKitJavascriptResult *r, gpointer arg)
+                                    {
+                                      auto *w = static_cast<gtk_webkit_engine *>(arg);
+                                      char *s = get_string_from_js_result(r);
+                                      w->on_message(s);
+                                      g_free(s);
+                                    }),
+                         this);
+        webkit_user_content_manager_register_script_message_handler(manager,
+                                                                    "external");
+        init("window.external={invoke:function(s){window.webkit.messageHandlers."
+             "external.postMessage(s);}}");
+        // Load events are handed over as messages, like those of the page,
+        // so that navigation timing is recorded in one place.
+        g_signal_connect(G_OBJECT(m_webview), "load-changed",
+                         G_CALLBACK(+[](WebKitWebView *webview,
+                                        WebKitLoadEvent event, gpointer arg)
+                                    {
+                                      const char *phase =
+                                          event == WEBKIT_LOAD_STARTED     ? "started"
+                                          : event == WEBKIT_LOAD_COMMITTED ? "committed"
+                                          : event == WEBKIT_LOAD_FINISHED  ? "load-finished"
+                                                                           : nullptr;
+                                      if (phase == nullptr)
+                                      {
+                                        return;
+                                      }
+                                      auto uri = webkit_web_view_get_uri(webview);
+                                      auto *w = static_cast<gtk_webkit_engine *>(arg);
+                                      w->on_message(std::string("{\"event\":\"timing\",\"phase\":\"") +
+                                                    phase + "\",\"url\":" +
+                                                    json_escape(uri != nullptr ? uri : "") + "}");
+                                    }),
+                         this);
+
+        gtk_container_add(GTK_CONTAINER(m_window), GTK_WIDGET(m_webview));
+        gtk_widget_grab_focus(GTK_WIDGET(m_webview));
+
+        WebKitSettings *settings =
+            webkit_web_view_get_settings(WEBKIT_WEB_VIEW(m_webview));
+        webkit_settings_set_javascript_can_access_clipboard(settings, true);
+        if (debug)
+        {
+          webkit_settings_set_enable_write_console_messages_to_stdout(settings,
+                                                                      true);
+          webkit_settings_set_enable_developer_extras(settings, true);
+        }
+
+        // A hidden window is shown with its children by show().
+        if (visible)
+        {
+          gtk_widget_show_all(m_window);
+        }
+      }
+      // Destroys the window, or only the web view in a window the caller
+      // gave. The signal handlers get this as their data and are
+      // disconnected first, since a view may still be loading, as pooled
+      // views load a blank page.
+      virtual ~gtk_webkit_engine()
+      {
+        if (m_webview != nullptr)
+        {
+          WebKitUserContentManager *manager =
+              webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(m_webview));
+          g_signal_handlers_disconnect_by_data(manager, this);
+          webkit_user_content_manager_unregister_script_message_handler(
+              manager, "external");
+          g_signal_handlers_disconnect_by_data(m_webview, this);
+          g_object_set_data(G_OBJECT(m_webview), "webview-engine", nullptr);
+        }
+        if (m_window != nullptr)
+        {
+          g_signal_handlers_disconnect_by_data(m_window, this);
+        }
+        auto widget = m_owns_window ? m_window : m_webview;
+        if (widget != nullptr)
+        {
+          gtk_widget_destroy(widget);
+        }
+      }
+      // Shows a window created hidden.
+      void show()
+      {
+        gtk_widget_show_all(m_window);
+        gtk_widget_grab_focus(GTK_WIDGET(m_webview));
+      }
+      // Runs f once the main loop has nothing more urgent to do, after
+      // dispatched functions and redraws.
+      static void post_idle(std::function<void()> f)
+      {
+        g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, (GSourceFunc)([](void *f) -> int
+                                                               {
+                      (*static_cast<dispatch_fn_t *>(f))();
+                      return G_SOURCE_REMOVE; }),
+                        new std::function<void()>(std::move(f)),
+                        [](void *f)
+                        { delete static_cast<dispatch_fn_t *>(f); });
+      }
+      void *window() { return (void *)m_window; }
+      void run() { gtk_main(); }
+      // Handles the pending events without blocking, for applications that
+      // drive their own loop.
+      void run1()
+      {
+        while (gtk_events_pending())
+        {
+          gtk_main_iteration_do(FALSE);
+        }
+      }
+      void set_on_destroy(std::function<void()> f) { on_destroy = f; }
+      void terminate() { gtk_main_quit(); }
+      void dispatch(std::function<void()> f)
+      {
+        g_idle_add_full(G_PRIORITY_HIGH_IDLE, (GSourceFunc)([](void *f) -> int
+                                                            {
+                      (*static_cast<dispatch_fn_t *>(f))();
+                      return G_SOURCE_REMOVE; }),
+                        new std::function<void()>(f),
+                        [](void *f)
+                        { delete static_cast<dispatch_fn_t *>(f); });
+      }
+
+      void set_title(const std::string &title)
+      {
+        gtk_window_set_title(GTK_WINDOW(m_window), title.c_str());
+      }
+
+      void set_size(int width, int height, int hints)
+      {
+        gtk_window_set_resizable(GTK_WINDOW(m_window), hints != WEBVIEW_HINT_FIXED);
+        if (hints == WEBVIEW_HINT_NONE)
+        {
+          gtk_window_resize(GTK_WINDOW(m_window), width, height);
+        }
+        else if (hints == WEBVIEW_HINT_FIXED)
+        {
+          gtk_widget_set_size_request(m_window, width, height);
+        }
+        else
+        {
+          GdkGeometry g;
+          g.min_width = g.max_width = width;
+          g.min_height = g.max_height = height;
+          GdkWindowHints h =
+              (hints == WEBVIEW_HINT_MIN ? GDK_HINT_MIN_SIZE : GDK_HINT_MAX_SIZE);
+          // This defines either MIN_SIZE, or MAX_SIZE, but not both:
+          gtk_window_set_geometry_hints(GTK_WINDOW(m_window), nullptr, &g, h);
+        }
+      }
+
+      void navigate(const std::string &url)
+      {
+        webkit_web_view_load_uri(WEBKIT_WEB_VIEW(m_webview),
+                                 m_virtual_hosts.rewrite(url).c_str());
+      }
+
+      void set_html(const std::string &html)
+      {
+        webkit_web_view_load_html(WEBKIT_WEB_VIEW(m_webview), html.c_str(),
+                                  nullptr);
+      }
+
+      // The file is mapped and the mapping is handed to WebKit as is, so the
+      // page is never copied on our side.
+      bool set_html_file(const std::string &path)
+      {
+        auto file = g_mapped_file_new(path.c_str(), FALSE, nullptr);
+        if (file == nullptr)
+        {
+          return false;
+        }
+        auto bytes = g_mapped_file_get_bytes(file);
+        g_mapped_file_unref(file);
+        webkit_web_view_load_bytes(WEBKIT_WEB_VIEW(m_webview), bytes,
+                                   "text/html", "UTF-8", nullptr);
+        g_bytes_unref(bytes);
+        return true;
+      }
+
+      void init(const std::string &js)
+      {
+        m_user_scripts.add(js);
+        update_user_scripts();
+      }
+
+      void set_init_script(const std::string &id, const std::string &js)
+      {
+        if (m_user_scripts.set(id, js))
+        {
+          update_user_scripts();
+        }
+      }
+
+      void remove_init_script(const std::string &id)
+      {
+        if (m_user_scripts.remove(id))
+        {
+          update_user_scripts();
+        }
+      }
+
+      void eval(const std::string &js)
+      {
+        webkit_web_view_run_javascript(WEBKIT_WEB_VIEW(m_webview), js.c_str(),
+                                       nullptr, nullptr, nullptr);
+      }
+
+      // WebKitGTK has no virtual host mapping, so hosts are served from the
+      // virtual_hosts scheme and navigate() rewrites their https:// URLs.
+      bool set_virtual_host_name(const std::string &host,
+                                 const std::string &folder, const int access)
+      {
+        if (!m_virtual_hosts.set(host, folder, access))
+        {
+          return true;
+        }
+        return register_scheme(virtual_hosts::scheme, [this](scheme_request *r)
+                               { m_virtual_hosts.serve(r); });
+      }
+
+      // Serves host from the entries of an asset bundle, see
+      // set_virtual_host_name.
+      bool set_virtual_host_bundle(const std::string &host,
+                                   const std::string &path, const int access)
+      {
+        auto bundle = asset_bundle::open(path);
+        if (!bundle)
+        {
+          return false;
+        }
+        if (!m_virtual_hosts.set_bundle(host, std::move(bundle), access))
+        {
+          return true;
+        }
+        return register_scheme(virtual_hosts::scheme, [this](scheme_request *r)
+                               { m_virtual_hosts.serve(r); });
+      }
+
+      // Schemes are registered on the web context, which every web view of
+      // the process shares by default, so a single callback per scheme finds
+      // the engine of the requesting view.
+      bool register_scheme(const std::string &scheme, scheme_handler_t handler)
+      {
+        m_scheme_handlers[scheme] = std::move(handler);
+        g_object_set_data(G_OBJECT(m_webview), "webview-engine", this);
+
+        auto context = webkit_web_view_get_context(WEBKIT_WEB_VIEW(m_webview));
+        static std::set<std::pair<WebKitWebContext *, std::string>> registered;
+        if (!registered.emplace(context, scheme).second)
+        {
+          return true;
+        }
+        webkit_web_context_register_uri_scheme(
+            context, scheme.c_str(),
+            +[](WebKitURISchemeRequest *request, gpointer)
+            {
+              auto r = new gtk_scheme_request(request);
+              auto view = webkit_uri_scheme_request_get_web_view(request);
+              auto w = view == nullptr
+                           ? nullptr
+                           : static_cast<gtk_webkit_engine *>(g_object_get_data(
+                                 G_OBJECT(view), "webview-engine"));
+              if (w != nullptr)
+              {
+                auto found = w->m_scheme_handlers.find(
+                    webkit_uri_scheme_request_get_scheme(request));
+                if (found != w->m_scheme_handlers.end())
+                {
+                  found->second(r);
+                  return;
+                }
+              }
+              r->fail("No handler for " + r->uri());
+            },
+            nullptr, nullptr);
+        // Pages fetch() from the scheme, which WebKit only allows for CORS
+        // enabled schemes, and secure pages must not see it as mixed content.
+        auto security = webkit_web_context_get_security_manager(context);
+        webkit_security_manager_register_uri_scheme_as_cors_enabled(
+            security, scheme.c_str());
+        webkit_security_manager_register_uri_scheme_as_secure(security,
+                                                              scheme.c_str());
+        return true;
+      }
+
+    private:
+      virtual void on_message(const std::string &msg) = 0;
+
+      // Replaces every installed user script with the registered init
+      // scripts.
+      void update_user_scripts()
+      {
+        if (m_webview == nullptr)
+        {
+          return;
+        }
+        WebKitUserContentManager *manager =
+            webkit_web_view_get_user_content_manager(WEBKIT_WEB_VIEW(m_webview));
+        webkit_user_content_manager_remove_all_scripts(manager);
+        for (const auto &js : m_user_scripts.scripts())
+        {
+          auto script = webkit_user_script_new(
+              js.c_str(), WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+              WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START, nullptr, nullptr);
+          webkit_user_content_manager_add_script(manager, script);
+          webkit_user_script_unref(script);
+        }
+      }
+
+      static char *get_string_from_js_result(WebKitJavascriptResult *r)
+      {
+        char *s;
+#if WEBKIT_MAJOR_VERSION >= 2 && WEBKIT_MINOR_VERSION >= 22
+        JSCValue *value = webkit_javascript_result_get_js_value(r);
+        s = jsc_value_to_string(value);
+#else
+        JSGlobalContextRef ctx = webkit_javascript_result_get_global_context(r);
+        JSValueRef value = webkit_javascript_result_get_value(r);
+        JSStringRef js = JSValueToStringCopy(ctx, value, nullptr);
+        size_t n = JSStringGetMaximumUTF8CStringSize(js);
+        s = g_new(char, n);
+        JSStringGetUTF8CString(js, s, n);
+        JSStringRelease(js);
+#endif
+        return s;
+      }
+
+      GtkWidget *m_window;
+      GtkWidget *m_webview = nullptr;
+      // Whether the window was created here rather than given by the caller.
+      bool m_owns_window = false;
+      std::function<void()> on_destroy;
+      user_script_registry m_user_scripts;
+      std::map<std::string, scheme_handler_t> m_scheme_handlers;
+      virtual_hosts m_virtual_hosts;
+    };
+
+  } // namespace detail
+
+  using browser_engine = detail::gtk_webkit_engine;
+
+} // namespace webview
+
+#elif defined(WEBVIEW_COCOA)
+
+//
+// ====================================================================
+//
+// This implementation uses Cocoa WKWebView backend on macOS. It is
+// written using ObjC runtime and uses WKWebView class as a browser runtime.
+// You should pass "-framework Webkit" flag to the compiler.
+//
+// ====================================================================
+//
+
+#include <CoreGraphics/CoreGraphics.h>
+#include <objc/NSObjCRuntime.h>
+#include <objc/objc-runtime.h>
+
+namespace webview
+{
+  namespace detail
+  {
+    namespace objc
+    {
+
+      // A convenient template function for unconditionally casting the specified
+      // C-like function into a function that can be called with the given return
+      // type and arguments. Caller takes full responsibility for ensuring that
+      // the function call is valid. It is assumed that the function will not
+      // throw exceptions.
+      template <typename Result, typename Callable, typename... Args>
+      Result invoke(Callable callable, Args... args) noexcept
+      {
+        return reinterpret_cast<Result (*)(Args...)>(callable)(args...);
+      }
+
+      // Calls objc_msgSend.
+      template <typename Result, typename... Args>
+      Result msg_send(Args... args) noexcept
+      {
+        return invoke<Result>(objc_msgSend, args...);
+      }
+
+    } // namespace objc
+
+    enum NSBackingStoreType : NSUInteger
+    {
+      NSBackingStoreBuffered = 2
+    };
+
+    enum NSWindowStyleMask : NSUInteger
+    {
+      NSWindowStyleMaskTitled = 1,
+      NSWindowStyleMaskClosable = 2,
+      NSWindowStyleMaskMiniaturizable = 4,
+      NSWindowStyleMaskResizable = 8
+    };
+
+    enum NSApplicationActivationPolicy : NSInteger
+    {
+      NSApplicationActivationPolicyRegular = 0
+    };
+
+    enum WKUserScriptInjectionTime : NSInteger
+    {
+      WKUserScriptInjectionTimeAtDocumentStart = 0
+    };
+
+    enum NSModalResponse : NSInteger
+    {
+      NSModalResponseOK = 1
+    };
+
+    enum NSDataReadingOptions : NSUInteger
+    {
+      NSDataReadingMappedIfSafe = 1
+    };
+
+    // Convenient conversion of string literals.
+    inline id operator"" _cls(const char *s, std::size_t)
+    {
+      return (id)objc_getClass(s);
+    }
+    inline SEL operator"" _sel(const char *s, std::size_t)
+    {
+      return sel_registerName(s);
+    }
+    inline id operator"" _str(const char *s, std::size_t)
+    {
+      return objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel, s);
+    }
+
+    class cocoa_wkwebview_engine
+    {
+    public:
+      cocoa_wkwebview_engine(bool debug, void *window, bool visible = true)
+          : m_debug{debug}, m_visible{visible}, m_parent_window{window}
+      {
+        auto app = get_shared_application();
+        auto delegate = create_app_delegate();
+        objc_setAssociatedObject(delegate, "webview", (id)this,
+                                 OBJC_ASSOCIATION_ASSIGN);
+        objc::msg_send<void>(app, "setDelegate:"_sel, delegate);
+
+        // See comments related to application lifecycle in create_app_delegate().
+        if (window)
+        {
+          on_application_did_finish_launching(delegate, app);
+        }
+        else
+        {
+          // Start the main run loop so that the app delegate gets the
+          // NSApplicationDidFinishLaunchingNotification notification after the run
+          // loop has started in order to perform further initialization.
+          // We need to return from this constructor so this run loop is only
+          // temporary.
+          objc::msg_send<void>(app, "run"_sel);
+        }
+      }
+      virtual ~cocoa_wkwebview_engine() = default;
+      void *window() { return (void *)m_window; }
+      // Shows a window created hidden.
+      void show()
+      {
+        objc::msg_send<void>(m_window, "makeKeyAndOrderFront:"_sel, nullptr);
+      }
+      // The main queue has no priorities, so this is a plain dispatch.
+      static void post_idle(std::function<void()> f)
+      {
+        dispatch_async_f(dispatch_get_main_queue(), new dispatch_fn_t(std::move(f)),
+                         (dispatch_function_t)([](void *arg)
+                                               {
+                       auto f = static_cast<dispatch_fn_t *>(arg);
+                       (*f)();
+                       delete f; }));
+      }
+      void terminate()
+      {
+        auto app = get_shared_application();
+        objc::msg_send<void>(app, "terminate:"_sel, nullptr);
+      }
+      void run()
+      {
+        auto app = get_shared_application();
+        objc::msg_send<void>(app, "run"_sel);
+      }
+      void dispatch(std::function<void()> f)
+      {
+        dispatch_async_f(dispatch_get_main_queue(), new dispatch_fn_t(f),
+                         (dispatch_function_t)([](void *arg)
+                                               {
+                       auto f = static_cast<dispatch_fn_t *>(arg);
+                       (*f)();
+                       delete f; }));
+      }
+      void set_title(const std::string &title)
+      {
+        objc::msg_send<void>(m_window, "setTitle:"_sel,
+                             objc::msg_send<id>("NSString"_cls,
+                                                "stringWithUTF8String:"_sel,
+                                                title.c_str()));
+      }
+      void set_size(int width, int height, int hints)
+      {
+        auto style = static_cast<NSWindowStyleMask>(
+            NSWindowStyleMaskTitled | NSWindowStyleMaskClosable |
+            NSWindowStyleMaskMiniaturizable);
+        if (hints != WEBVIEW_HINT_FIXED)
+        {
+          style =
+              static_cast<NSWindowStyleMask>(style | NSWindowStyleMaskResizable);
+        }
+        objc::msg_send<void>(m_window, "setStyleMask:"_sel, style);
+
+        if (hints == WEBVIEW_HINT_MIN)
+        {
+          objc::msg_send<void>(m_window, "setContentMinSize:"_sel,
+                               CGSizeMake(width, height));
+        }
+        else if (hints == WEBVIEW_HINT_MAX)
+        {
+          objc::msg_send<void>(m_window, "setContentMaxSize:"_sel,
+                               CGSizeMake(width, height));
+        }
+        else
+        {
+          objc::msg_send<void>(m_window, "setFrame:display:animate:"_sel,
+                               CGRectMake(0, 0, width, height), YES, NO);
+        }
+        objc::msg_send<void>(m_window, "center"_sel);
+      }
+      void navigate(const std::string &url)
+      {
+        auto nsurl = objc::msg_send<id>(
+            "NSURL"_cls, "URLWithString:"_sel,
+            objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel,
+                               url.c_str()));
+
+        objc::msg_send<void>(
+            m_webview, "loadRequest:"_sel,
+            objc::msg_send<id>("NSURLRequest"_cls, "requestWithURL:"_sel, nsurl));
+      }
+      void set_html(const std::string &html)
+      {
+        objc::msg_send<void>(m_webview, "loadHTMLString:baseURL:"_sel,
+                             objc::msg_send<id>("NSString"_cls,
+                                                "stringWithUTF8String:"_sel,
+                                                html.c_str()),
+                             nullptr);
+      }
+      // The file is mapped when the file system allows it and the data is
+      // handed to WebKit without decoding it into a string first.
+      bool set_html_file(const std::string &path)
+      {
+        auto data = objc::msg_send<id>(
+            "NSData"_cls, "dataWithContentsOfFile:options:error:"_sel,
+            objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel,
+                               path.c_str()),
+            NSDataReadingMappedIfSafe, nullptr);
+        if (data == nullptr)
+        {
+          return false;
+        }
+        objc::msg_send<void>(
+            m_webview, "loadData:MIMEType:characterEncodingName:baseURL:"_sel,
+            data, "text/html"_str, "UTF-8"_str,
+            objc::msg_send<id>("NSURL"_cls, "URLWithString:"_sel,
+                               "about:blank"_str));
+        return true;
+      }
+      void init(const std::string &js)
+      {
+        m_user_scripts.add(js);
+        update_user_scripts();
+      }
+      void set_init_script(const std::string &id, const std::string &js)
+      {
+        if (m_user_scripts.set(id, js))
+        {
+          update_user_scripts();
+        }
+      }
+      void remove_init_script(const std::string &id)
+      {
+        if (m_user_scripts.remove(id))
+        {
+          update_user_scripts();
+        }
+      }
+      void eval(const std::string &js)
+      {
+        objc::msg_send<void>(m_webview, "evaluateJavaScript:completionHandler:"_sel,
+                             objc::msg_send<id>("NSString"_cls,
+                                                "stringWithUTF8String:"_sel,
+                                                js.c_str()),
+                             nullptr);
+      }
+
+      // WKURLSchemeHandler can only be set on the configuration before the
+      // web view is created.
+      bool register_scheme(const std::string &, scheme_handler_t)
+      {
+        return false;
+      }
+
+      bool set_virtual_host_bundle(const std::string &, const std::string &,
+                                   const int)
+      {
+        return false;
+      }
+
+    private:
+      virtual void on_message(const std::string &msg) = 0;
+      // Replaces every installed user script with the registered init
+      // scripts.
+      void update_user_scripts()
+      {
+        // Equivalent Obj-C:
+        // [m_manager removeAllUserScripts];
+        // for each js:
+        // [m_manager addUserScript:[[WKUserScript alloc] initWithSource:[NSString stringWithUTF8String:js.c_str()] injectionTime:WKUserScriptInjectionTimeAtDocumentStart forMainFrameOnly:YES]]
+        objc::msg_send<void>(m_manager, "removeAllUserScripts"_sel);
+        for (const auto &js : m_user_scripts.scripts())
+        {
+          auto script = objc::msg_send<id>(
+              objc::msg_send<id>("WKUserScript"_cls, "alloc"_sel),
+              "initWithSource:injectionTime:forMainFrameOnly:"_sel,
+              objc::msg_send<id>("NSString"_cls, "stringWithUTF8String:"_sel,
+                                 js.c_str()),
+              WKUserScriptInjectionTimeAtDocumentStart, YES);
+          objc::msg_send<void>(m_manager, "addUserScript:"_sel, script);
+          objc::msg_send<void>(script, "release"_sel);
+        }
+      }
+      id create_app_delegate()
+      {
+        // Note: Avoid registering the class name "AppDelegate" as it is the
+        // default name in projects created with Xcode, and using the same name
+        // causes objc_registerClassPair to crash.
+        auto cls = objc_allocateClassPair((Class) "NSResponder"_cls,
+                                          "WebviewAppDelegate", 0);
+        class_addProtocol(cls, objc_getProtocol("NSTouchBarProvider"));
+        class_addMethod(cls, "applicationShouldTerminateAfterLastWindowClosed:"_sel,
+                        (IMP)(+[](id, SEL, id) -> BOOL
+                              { return 1; }),
+                        "c@:@");
+        // If the library was not initialized with an existing window then the user
+        // is likely managing the application lifecycle and we would not get the
+        // "applicationDidFinishLaunching:" message and therefore do not need to
+        // add this method.
+        if (!m_parent_window)
+        {
+          class_addMethod(cls, "applicationDidFinishLaunching:"_sel,
+                          (IMP)(+[](id self, SEL, id notification)
+                                {
+                                  auto app =
+                                      objc::msg_send<id>(notification, "object"_sel);
+                                  auto w = get_associated_webview(self);
+                                  w->on_application_did_finish_launching(self, app);
+                                }),
+                          "v@:@");
+        }
+        objc_registerClassPair(cls);
+        return objc::msg_send<id>((id)cls, "new"_sel);
+      }
+      id create_script_message_handler()
+      {
+        auto cls = objc_allocateClassPair((Class) "NSResponder"_cls,
+                                          "WebkitScriptMessageHandler", 0);
+        class_addProtocol(cls, objc_getProtocol("WKScriptMessageHandler"));
+        class_addMethod(
+            cls, "userContentController:didReceiveScriptMessage:"_sel,
+            (IMP)(+[](id self, SEL, id, id msg)
+                  {
+                    auto w = get_associated_webview(self);
+                    w->on_message(objc::msg_send<const char *>(
+                        objc::msg_send<id>(msg, "body"_sel), "UTF8String"_sel));
+                  }),
+            "v@:@@");
+        objc_registerClassPair(cls);
+        auto instance = objc::msg_send<id>((id)cls, "new"_sel);
+        objc_setAssociatedObject(instance, "webview", (id)this,
+                                 OBJC_ASSOCIATION_ASSIGN);
+        return instance;
+      }
+      static id create_webkit_ui_delegate()
+      {
+        auto cls =
+            objc_allocateClassPair((Class) "NSObject"_cls, "WebkitUIDelegate", 0);
+        class_addProtocol(cls, objc_getProtocol("WKUIDelegate"));
+        class_addMethod(
+            cls,
+            "webView:runOpenPanelWithParameters:initiatedByFrame:completionHandler:"_sel,
+            (IMP)(+[](id, SEL, id, id parameters, id, id completion_handler)
+                  {
+                    auto allows_multiple_selection =
+                        objc::msg_send<BOOL>(parameters, "allowsMultipleSelection"_sel);
+                    auto allows_directories =
+                        objc::msg_send<BOOL>(parameters, "allowsDirectories"_sel);
+
+                    // Show a panel for selecting files.
+                    auto panel = objc::msg_send<id>("NSOpenPanel"_cls, "openPanel"_sel);
+                    objc::msg_send<void>(panel, "setCanChooseFiles:"_sel, YES);
+                    objc::msg_send<void>(panel, "setCanChooseDirectories:"_sel,
+                                         allows_directories);
+                    objc::msg_send<void>(panel, "setAllowsMultipleSelection:"_sel,
+                                         allows_multiple_selection);
+                    auto modal_response =
+                        objc::msg_send<NSModalResponse>(panel, "runModal"_sel);
+
+                    // Get the URLs for the selected files. If the modal was canceled
+                    // then we pass null to the completion handler to signify
+                    // cancellation.
+                    id urls = modal_response == NSModalResponseOK
+                                  ? objc::msg_send<id>(panel, "URLs"_sel)
+                                  : nullptr;
+
+                    // Invoke the completion handler block.
+                    auto sig = objc::msg_send<id>("NSMethodSignature"_cls,
+                                                  "signatureWithObjCTypes:"_sel, "v@?@");
+                    auto invocation = objc::msg_send<id>(
+                        "NSInvocation"_cls, "invocationWithMethodSignature:"_sel, sig);
+                    objc::msg_send<void>(invocation, "setTarget:"_sel,
+                                         completion_handler);
+                    objc::msg_send<void>(invocation, "setArgument:atIndex:"_sel, &urls,
+                                         1);
+                    objc::msg_send<void>(invocation, "invoke"_sel);
+                  }),
+            "v@:@@@@");
+        objc_registerClassPair(cls);
+        return objc::msg_send<id>((id)cls, "new"_sel);
+      }
+      static id get_shared_application()
+      {
+        return objc::msg_send<id>("NSApplication"_cls, "sharedApplication"_sel);
+      }
+      static cocoa_wkwebview_engine *get_associated_webview(id object)
+      {
+        auto w =
+            (cocoa_wkwebview_engine *)objc_getAssociatedObject(object, "webview");
+        assert(w);
+        return w;
+      }
+      static id get_main_bundle() noexcept
+      {
+        return objc::msg_send<id>("NSBundle"_cls, "mainBundle"_sel);
+      }
+      static bool is_app_bundled() noexcept
+      {
+        auto bundle = get_main_bundle();
+        if (!bundle)
+        {
+          return false;
+        }
+        auto bundle_path = objc::msg_send<id>(bundle, "bundlePath"_sel);
+        auto bundled =
+            objc::msg_send<BOOL>(bundle_path, "hasSuffix:"_sel, ".app"_str);
+        return !!bundled;
+      }
+      void on_application_did_finish_launching(id /*delegate*/, id app)
+      {
+        // See comments related to application lifecycle in create_app_delegate().
+        if (!m_parent_window)
+        {
+          // Stop the main run loop so that we can return
+          // from the constructor.
+          objc::msg_send<void>(app, "stop:"_sel, nullptr);
+        }
+
+        // Activate the app if it is not bundled.
+        // Bundled apps launched from Finder are activated automatically but
+        // otherwise not. Activating the app even when it has been launched from
+        // Finder does not seem to be harmful but calling this function is rarely
+        // needed as proper activation is normally taken care of for us.
+        // Bundled apps have a default activation policy of
+        // NSApplicationActivationPolicyRegular while non-bundled apps have a
+        // default activation policy of NSApplicationActivationPolicyProhibited.
+        if (!is_app_bundled())
+        {
+          // "setActivationPolicy:" must be invoked before
+          // "activateIgnoringOtherApps:" for activation to work.
+          objc::msg_send<void>(app, "setActivationPolicy:"_sel,
+                               NSApplicationActivationPolicyRegular);
+          // Activate the app regardless of other active apps.
+          // This can be obtrusive so we only do it when necessary.
+          objc::msg_send<void>(app, "activateIgnoringOtherApps:"_sel, YES);
+        }
+
+        // Main window
+        if (!m_parent_window)
+        {
+          m_window = objc::msg_send<id>("NSWindow"_cls, "alloc"_sel);
+          auto style = NSWindowStyleMaskTitled;
+          m_window = objc::msg_send<id>(
+              m_window, "initWithContentRect:styleMask:backing:defer:"_sel,
+              CGRectMake(0, 0, 0, 0), style, NSBackingStoreBuffered, NO);
+        }
+        else
+        {
+          m_window = (id)m_parent_window;
+        }
+
+        // Webview
+        auto config = objc::msg_send<id>("WKWebViewConfiguration"_cls, "new"_sel);
+        m_manager = objc::msg_send<id>(config, "userContentController"_sel);
+        m_webview = objc::msg_send<id>("WKWebView"_cls, "alloc"_sel);
+
+        if (m_debug)
+        {
+          // Equivalent Obj-C:
+          // [[config preferences] setValue:@YES forKey:@"developerExtrasEnabled"];
+          objc::msg_send<id>(
+              objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
+              objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
+              "developerExtrasEnabled"_str);
+        }
+
+        // Equivalent Obj-C:
+        // [[config preferences] setValue:@YES forKey:@"fullScreenEnabled"];
+        objc::msg_send<id>(
+            objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
+            objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
+            "fullScreenEnabled"_str);
+
+        // Equivalent Obj-C:
+        // [[config preferences] setValue:@YES forKey:@"javaScriptCanAccessClipboard"];
+        objc::msg_send<id>(
+            objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
+            objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
+            "javaScriptCanAccessClipboard"_str);
+
+        // Equivalent Obj-C:
+        // [[config preferences] setValue:@YES forKey:@"DOMPasteAllowed"];
+        objc::msg_send<id>(
+            objc::msg_send<id>(config, "preferences"_sel), "setValue:forKey:"_sel,
+            objc::msg_send<id>("NSNumber"_cls, "numberWithBool:"_sel, YES),
+            "DOMPasteAllowed"_str);
+
+        auto ui_delegate = create_webkit_ui_delegate();
+        objc::msg_send<void>(m_webview, "initWithFrame:configuration:"_sel,
+                             CGRectMake(0, 0, 0, 0), config);
+        objc::msg_send<void>(m_webview, "setUIDelegate:"_sel, ui_delegate);
+        auto script_message_handler = create_script_message_handler();
+        objc::msg_send<void>(m_manager, "addScriptMessageHandler:name:"_sel,
+                             script_message_handler, "external"_str);
+
+        init(R""(
+      window.external = {
+        invoke: function(s) {
+          window.webkit.messageHandlers.external.postMessage(s);
+        },
+      };
+      )"");
+        objc::msg_send<void>(m_window, "setContentView:"_sel, m_webview);
+        if (m_visible)
+        {
+          objc::msg_send<void>(m_window, "makeKeyAndOrderFront:"_sel, nullptr);
+        }
+      }
+      bool m_debug;
+      bool m_visible;
+      void *m_parent_window;
+      id m_window;
+      id m_webview;
+      id m_manager;
+      user_script_registry m_user_scripts;
+    };
+
+  } // namespace detail
+
+  using browser_engine = detail::cocoa_wkwebview_engine;
+
+} // namespace webview
+
+#elif defined(WEBVIEW_EDGE)
+
+//
+// ====================================================================
+//
+// This implementation uses Win32 API to create a native window. It
+// uses Edge/Chromium webview2 backend as a browser engine.
+//
+// ====================================================================
+//
+
+#define WIN32_LEAN_AND_MEAN
+#include <shlobj.h>
+#include <shlwapi.h>
+#include <stdlib.h>
+#include <windows.h>
+
+#include "WebView2.h"
+
+#ifdef _MSC_VER
+#pragma comment(lib, "advapi32.lib")
+#pragma comment(lib, "ole32.lib")
+#pragma comment(lib, "shell32.lib")
+#pragma comment(lib, "shlwapi.lib")
+#pragma comment(lib, "user32.lib")
+#pragma comment(lib, "version.lib")
+#endif
+
+namespace webview
+{
+  namespace detail
+  {
+
+    using msg_cb_t = std::function<void(const std::string)>;
+
+    // Converts a narrow (UTF-8-encoded) string into a wide (UTF-16-encoded) string.
+    inline std::wstring widen_string(const char *input_c, std::size_t size)
+    {
+      if (size == 0)
+      {
+        return std::wstring();
+      }
+      UINT cp = CP_UTF8;
+      DWORD flags = MB_ERR_INVALID_CHARS;
+      auto input_length = static_cast<int>(size);
+      auto required_length =
+          MultiByteToWideChar(cp, flags, input_c, input_length, nullptr, 0);
+      if (required_length > 0)
+      {
+        std::wstring output(static_cast<std::size_t>(required_length), L'\0');
+        if (MultiByteToWideChar(cp, flags, input_c, input_length, &output[0],
+                                required_length) > 0)
+        {
+          return output;
+        }
+      }
+      // Failed to convert string from UTF-8 to UTF-16
+      return std::wstring();
+    }
+
+    inline std::wstring widen_string(const std::string &input)
+    {
+      return widen_string(input.c_str(), input.size());
+    }
+
+    // Converts a wide (UTF-16-encoded) string into a narrow (UTF-8-encoded) string.
+    inline std::string narrow_string(const std::wstring &input)
+    {
+      if (input.empty())
+      {
+        return std::string();
+      }
+      UINT cp = CP_UTF8;
+      DWORD flags = WC_ERR_INVALID_CHARS;
+      auto input_c = input.c_str();
+      auto input_length = static_cast<int>(input.size());
+      auto required_length = WideCharToMultiByte(cp, flags, input_c, input_length,
+                                                 nullptr, 0, nullptr, nullptr);
+      if (required_length > 0)
+      {
+        std::string output(static_cast<std::size_t>(required_length), '\0');
+        if (WideCharToMultiByte(cp, flags, input_c, input_length, &output[0],
+                                required_length, nullptr, nullptr) > 0)
+        {
+          return output;
+        }
+      }
+      // Failed to convert string from UTF-16 to UTF-8
+      return std::string();
+    }
+
+    // Parses a version string with 1-4 integral components, e.g. "1.2.3.4".
+    // Missing or invalid components default to 0, and excess components are ignored.
+    template <typename T>
+    std::array<unsigned int, 4>
+    parse_version(const std::basic_string<T> &version) noexcept
+    {
+      auto parse_component = [](auto sb, auto se) -> unsigned int
+      {
+        try
+        {
+          auto n = std::stol(std::basic_string<T>(sb, se));
+          return n < 0 ? 0 : n;
+        }
+        catch (std::exception &)
+        {
+          return 0;
+        }
+      };
+      auto end = version.end();
+      auto sb = version.begin(); // subrange begin
+      auto se = sb;              // subrange end
+      unsigned int ci = 0;       // component index
+      std::array<unsigned int, 4> components{};
+      while (sb != end && se != end && ci < components.size())
+      {
+        if (*se == static_cast<T>('.'))
+        {
+          components[ci++] = parse_component(sb, se);
+          sb = ++se;
+          continue;
+        }
+        ++se;
+      }
+      if (sb < se && ci < components.size())
+      {
+        components[ci] = parse_component(sb, se);
+      }
+      return components;
+    }
+
+    template <typename T, std::size_t Length>
+    auto parse_version(const T (&version)[Length]) noexcept
+    {
+      return parse_version(std::basic_string<T>(version, Length));
+    }
+
+    std::wstring get_file_version_string(const std::wstring &file_path) noexcept
+    {
+      DWORD dummy_handle; // Unused
+      DWORD info_buffer_length =
+          GetFileVersionInfoSizeW(file_path.c_str(), &dummy_handle);
+      if (info_buffer_length == 0)
+      {
+        return std::wstring();
+      }
+      std::vector<char> info_buffer;
+      info_buffer.reserve(info_buffer_length);
+      if (!GetFileVersionInfoW(file_path.c_str(), 0, info_buffer_length,
+                               info_buffer.data()))
+      {
+        return std::wstring();
+      }
+      auto sub_block = L"\\StringFileInfo\\040904B0\\ProductVersion";
+      LPWSTR version = nullptr;
+      unsigned int version_length = 0;
+      if (!VerQueryValueW(info_buffer.data(), sub_block,
+                          reinterpret_cast<LPVOID *>(&version), &version_length))
+      {
+        return std::wstring();
+      }
+      if (!version || version_length == 0)
+      {
+        return std::wstring();
+      }
+      return std::wstring(version, version_length);
+    }
+
+    // A wrapper around COM library initialization. Calls CoInitializeEx in the
+    // constructor and CoUninitialize in the destructor.
+    class com_init_wrapper
+    {
+    public:
+      com_init_wrapper(DWORD dwCoInit)
+      {
+        // We can safely continue as long as COM was either successfully
+        // initialized or already initialized.
+        // RPC_E_CHANGED_MODE means that CoInitializeEx was already called with
+        // a different concurrency model.
+        switch (CoInitializeEx(nullptr, dwCoInit))
+        {
+        case S_OK:
+        case S_FALSE:
+          m_initialized = true;
+          break;
+        }
+      }
+
+      ~com_init_wrapper()
+      {
+        if (m_initialized)
+        {
+          CoUninitialize();
+          m_initialized = false;
+        }
+      }
+
+      com_init_wrapper(const com_init_wrapper &other) = delete;
+      com_init_wrapper &operator=(const com_init_wrapper &other) = delete;
+      com_init_wrapper(com_init_wrapper &&other) = delete;
+      com_init_wrapper &operator=(com_init_wrapper &&other) = delete;
+
+      bool is_initialized() const { return m_initialized; }
+
+    private:
+      bool m_initialized = false;
+    };
+
+    // Holds a symbol name and associated type for code clarity.
+    template <typename T>
+    class library_symbol
+    {
+    public:
+      using type = T;
+
+      constexpr explicit library_symbol(const char *name) : m_name(name) {}
+      constexpr const char *get_name() const { return m_name; }
+
+    private:
+      const char *m_name;
+    };
+
+    // Loads a native shared library and allows one to get addresses for those
+    // symbols.
+    class native_library
+    {
+    public:
+      explicit native_library(const wchar_t *name) : m_handle(LoadLibraryW(name)) {}
+
+      ~native_library()
+      {
+        if (m_handle)
+        {
+          FreeLibrary(m_handle);
+          m_handle = nullptr;
+        }
+      }
+
+      native_library(const native_library &other) = delete;
+      native_library &operator=(const native_library &other) = delete;
+      native_library(native_library &&other) = default;
+      native_library &operator=(native_library &&other) = default;
+
+      // Returns true if the library is currently loaded; otherwise false.
+      operator bool() const { return is_loaded(); }
+
+      // Get the address for the specified symbol or nullptr if not found.
+      template <typename Symbol>
+      typename Symbol::type get(const Symbol &symbol) const
+      {
+        if (is_loaded())
+        {
+          return reinterpret_cast<typename Symbol::type>(
+              GetProcAddress(m_handle, symbol.get_name()));
+        }
+        return nullptr;
+      }
+
+      // Returns true if the library is currently loaded; otherwise false.
+      bool is_loaded() const { return !!m_handle; }
+
+      void detach() { m_handle = nullptr; }
+
+    private:
+      HMODULE m_handle = nullptr;
+    };
+
+    struct user32_symbols
+    {
+      using DPI_AWARENESS_CONTEXT = HANDLE;
+      using SetProcessDpiAwarenessContext_t = BOOL(WINAPI *)(DPI_AWARENESS_CONTEXT);
+      using SetProcessDPIAware_t = BOOL(WINAPI *)();
+
+      static constexpr auto SetProcessDpiAwarenessContext =
+          library_symbol<SetProcessDpiAwarenessContext_t>(
+              "SetProcessDpiAwarenessContext");
+      static constexpr auto SetProcessDPIAware =
+          library_symbol<SetProcessDPIAware_t>("SetProcessDPIAware");
+    };
+
+    struct shcore_symbols
+    {
+      typedef enum
+      {
+        PROCESS_PER_MONITOR_DPI_AWARE = 2
+      } PROCESS_DPI_AWARENESS;
+      using SetProcessDpiAwareness_t = HRESULT(WINAPI *)(PROCESS_DPI_AWARENESS);
+
+      static constexpr auto SetProcessDpiAwareness =
+          library_symbol<SetProcessDpiAwareness_t>("SetProcessDpiAwareness");
+    };
+
+    class reg_key
+    {
+    public:
+      explicit reg_key(HKEY root_key, const wchar_t *sub_key, DWORD options,
+                       REGSAM sam_desired)
+      {
+        HKEY handle;
+        auto status =
+            RegOpenKeyExW(root_key, sub_key, options, sam_desired, &handle);
+        if (status == ERROR_SUCCESS)
+        {
+          m_handle = handle;
+        }
+      }
+
+      explicit reg_key(HKEY root_key, const std::wstring &sub_key, DWORD options,
+                       REGSAM sam_desired)
+          : reg_key(root_key, sub_key.c_str(), options, sam_desired) {}
+
+      virtual ~reg_key()
+      {
+        if (m_handle)
+        {
+          RegCloseKey(m_handle);
+          m_handle = nullptr;
+        }
+      }
+
+      reg_key(const reg_key &other) = delete;
+      reg_key &operator=(const reg_key &other) = delete;
+      reg_key(reg_key &&other) = delete;
+      reg_key &operator=(reg_key &&other) = delete;
+
+      bool is_open() const { return !!m_handle; }
+      bool get_handle() const { return m_handle; }
+
+      std::wstring query_string(const wchar_t *name) const
+      {
+        DWORD buf_length = 0;
+        // Get the size of the data in bytes.
+        auto status = RegQueryValueExW(m_handle, name, nullptr, nullptr, nullptr,
+                                       &buf_length);
+        if (status != ERROR_SUCCESS && status != ERROR_MORE_DATA)
+        {
+          return std::wstring();
+        }
+        // Read the data.
+        std::wstring result(buf_length / sizeof(wchar_t), 0);
+        auto buf = reinterpret_cast<LPBYTE>(&result[0]);
+        status =
+            RegQueryValueExW(m_handle, name, nullptr, nullptr, buf, &buf_length);
+        if (status != ERROR_SUCCESS)
+        {
+          return std::wstring();
+        }
+        // Remove trailing null-characters.
+        for (std::size_t length = result.size(); length > 0; --length)
+        {
+          if (result[length - 1] != 0)
+          {
+            result.resize(length);
+            break;
+          }
+        }
+        return result;
+      }
+
+    private:
+      HKEY m_handle = nullptr;
+    };
+
+    inline bool enable_dpi_awareness()
+    {
+      auto user32 = native_library(L"user32.dll");
+      if (auto fn = user32.get(user32_symbols::SetProcessDpiAwarenessContext))
+      {
+        if (fn(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE))
+        {
+          return true;
+        }
+        return GetLastError() == ERROR_ACCESS_DENIED;
+      }
+      if (auto shcore = native_library(L"shcore.dll"))
+      {
+        if (auto fn = shcore.get(shcore_symbols::SetProcessDpiAwareness))
+        {
+          auto result = fn(shcore_symbols::PROCESS_PER_MONITOR_DPI_AWARE);
+          return result == S_OK || result == E_ACCESSDENIED;
+        }
+      }
+      if (auto fn = user32.get(user32_symbols::SetProcessDPIAware))
+      {
+        return !!fn();
+      }
+      return true;
+    }
+
+// Enable built-in WebView2Loader implementation by default.
+#ifndef WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL
+#define WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL 1
+#endif
+
+// Link WebView2Loader.dll explicitly by default only if the built-in
+// implementation is enabled.
+#ifndef WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK
+#define WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL
+#endif
+
+// Explicit linking of WebView2Loader.dll should be used along with
+// the built-in implementation.
+#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1 && \
+    WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK != 1
+#undef WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK
+#error Please set WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK=1.
+#endif
+
+#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
+    // Gets the last component of a Windows native file path.
+    // For example, if the path is "C:\a\b" then the result is "b".
+    template <typename T>
+    std::basic_string<T>
+    get_last_native_path_component(const std::basic_string<T> &path)
+    {
+      if (auto pos = path.find_last_of(static_cast<T>('\\'));
+          pos != std::basic_string<T>::npos)
+      {
+        return path.substr(pos + 1);
+      }
+      return std::basic_string<T>();
+    }
+#endif /* WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL */
+
+    template <typename T>
+    struct cast_info_t
+    {
+      using type = T;
+      IID iid;
+    };
+
+    namespace mswebview2
+    {
+      static constexpr IID
+          IID_ICoreWebView2CreateCoreWebView2ControllerCompletedHandler{
+              0x6C4819F3, 0xC9B7, 0x4260, 0x81, 0x27, 0xC9,
+              0xF5, 0xBD, 0xE7, 0xF6, 0x8C};
+      static constexpr IID
+          IID_ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler{
+              0x4E8A3389, 0xC9D8, 0x4BD2, 0xB6, 0xB5, 0x12,
+              0x4F, 0xEE, 0x6C, 0xC1, 0x4D};
+      static constexpr IID IID_ICoreWebView2PermissionRequestedEventHandler{
+          0x15E1C6A3, 0xC72A, 0x4DF3, 0x91, 0xD7, 0xD0, 0x97, 0xFB, 0xEC, 0x6B, 0xFD};
+      static constexpr IID IID_ICoreWebView2WebMessageReceivedEventHandler{
+          0x57213F19, 0x00E6, 0x49FA, 0x8E, 0x07, 0x89, 0x8E, 0xA0, 0x1E, 0xCB, 0xD2};
+      static constexpr IID
+          IID_ICoreWebView2AddScriptToExecuteOnDocumentCreatedCompletedHandler{
+              0xB99369F3, 0x9B11, 0x47B5, 0xBC, 0x6F,
+              0x8E, 0x78, 0x95, 0xFC, 0xEA, 0x17};
+
+#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
+      enum class webview2_runtime_type
+      {
+        installed = 0,
+        embedded = 1
+      };
+
+      namespace webview2_symbols
+      {
+        using CreateWebViewEnvironmentWithOptionsInternal_t =
+            HRESULT(STDMETHODCALLTYPE *)(
+                bool, webview2_runtime_type, PCWSTR, IUnknown *,
+                ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler *);
+        using DllCanUnloadNow_t = HRESULT(STDMETHODCALLTYPE *)();
+
+        static constexpr auto CreateWebViewEnvironmentWithOptionsInternal =
+            library_symbol<CreateWebViewEnvironmentWithOptionsInternal_t>(
+                "CreateWebViewEnvironmentWithOptionsInternal");
+        static constexpr auto DllCanUnloadNow =
+            library_symbol<DllCanUnloadNow_t>("DllCanUnloadNow");
+      } // namespace webview2_symbols
+#endif /* WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL */
+
+#if WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK == 1
+      namespace webview2_symbols
+      {
+        using CreateCoreWebView2EnvironmentWithOptions_t = HRESULT(STDMETHODCALLTYPE *)(
+            PCWSTR, PCWSTR, ICoreWebView2EnvironmentOptions *,
+            ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler *);
+        using GetAvailableCoreWebView2BrowserVersionString_t =
+            HRESULT(STDMETHODCALLTYPE *)(PCWSTR, LPWSTR *);
+
+        static constexpr auto CreateCoreWebView2EnvironmentWithOptions =
+            library_symbol<CreateCoreWebView2EnvironmentWithOptions_t>(
+                "CreateCoreWebView2EnvironmentWithOptions");
+        static constexpr auto GetAvailableCoreWebView2BrowserVersionString =
+            library_symbol<GetAvailableCoreWebView2BrowserVersionString_t>(
+                "GetAvailableCoreWebView2BrowserVersionString");
+      } // namespace webview2_symbols
+#endif /* WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK */
+
+      class loader
+      {
+      public:
+        HRESULT create_environment_with_options(
+            PCWSTR browser_dir, PCWSTR user_data_dir,
+            ICoreWebView2EnvironmentOptions *env_options,
+            ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler
+                *created_handler) const
+        {
+#if WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK == 1
+          if (m_lib.is_loaded())
+          {
+            if (auto fn = m_lib.get(
+                    webview2_symbols::CreateCoreWebView2EnvironmentWithOptions))
+            {
+              return fn(browser_dir, user_data_dir, env_options, created_handler);
+            }
+          }
+#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
+          return create_environment_with_options_impl(browser_dir, user_data_dir,
+                                                      env_options, created_handler);
+#else
+          return S_FALSE;
+#endif
+#else
+          return ::CreateCoreWebView2EnvironmentWithOptions(
+              browser_dir, user_data_dir, env_options, created_handler);
+#endif /* WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK */
+        }
+
+        HRESULT
+        get_available_browser_version_string(PCWSTR browser_dir,
+                                             LPWSTR *version) const
+        {
+#if WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK == 1
+          if (m_lib.is_loaded())
+          {
+            if (auto fn = m_lib.get(
+                    webview2_symbols::GetAvailableCoreWebView2BrowserVersionString))
+            {
+              return fn(browser_dir, version);
+            }
+          }
+#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
+          return get_available_browser_version_string_impl(browser_dir, version);
+#else
+          return S_FALSE;
+#endif
+#else
+          return ::GetAvailableCoreWebView2BrowserVersionString(browser_dir, version);
+#endif /* WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK */
+        }
+
+      private:
+#if WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL == 1
+        struct client_info_t
+        {
+          bool found = false;
+          std::wstring dll_path;
+          std::wstring version;
+          webview2_runtime_type runtime_type;
+        };
+
+        HRESULT create_environment_with_options_impl(
+            PCWSTR browser_dir, PCWSTR user_data_dir,
+            ICoreWebView2EnvironmentOptions *env_options,
+            ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler
+                *created_handler) const
+        {
+          auto found_client = find_available_client(browser_dir);
+          if (!found_client.found)
+          {
+            return -1;
+          }
+          auto client_dll = native_library(found_client.dll_path.c_str());
+          if (auto fn = client_dll.get(
+                  webview2_symbols::CreateWebViewEnvironmentWithOptionsInternal))
+          {
+            return fn(true, found_client.runtime_type, user_data_dir, env_options,
+                      created_handler);
+          }
+          if (auto fn = client_dll.get(webview2_symbols::DllCanUnloadNow))
+          {
+            if (!fn())
+            {
+              client_dll.detach();
+            }
+          }
+          return ERROR_SUCCESS;
+        }
+
+        HRESULT
+        get_available_browser_version_string_impl(PCWSTR browser_dir,
+                                                  LPWSTR *version) const
+        {
+          if (!version)
+          {
+            return -1;
+          }
+          auto found_client = find_available_client(browser_dir);
+          if (!found_client.found)
+          {
+            return -1;
+          }
+          auto info_length_bytes =
+              found_client.version.size() * sizeof(found_client.version[0]);
+          auto info = static_cast<LPWSTR>(CoTaskMemAlloc(info_length_bytes));
+          if (!info)
+          {
+            return -1;
+          }
+          CopyMemory(info, found_client.version.c_str(), info_length_bytes);
+          *version = info;
+          return 0;
+        }
+
+        client_info_t find_available_client(PCWSTR browser_dir) const
+        {
+          if (browser_dir)
+          {
+            return find_embedded_client(api_version, browser_dir);
+          }
+          auto found_client =
+              find_installed_client(api_version, true, default_release_channel_guid);
+          if (!found_client.found)
+          {
+            found_client = find_installed_client(api_version, false,
+                                                 default_release_channel_guid);
+          }
+          return found_client;
+        }
+
+        std::wstring make_client_dll_path(const std::wstring &dir) const
+        {
+          auto dll_path = dir;
+          if (!dll_path.empty())
+          {
+            auto last_char = dir[dir.size() - 1];
+            if (last_char != L'\\' && last_char != L'/')
+            {
+              dll_path += L'\\';
+            }
+          }
+          dll_path += L"EBWebView\\";
+#if defined(_M_X64) || defined(__x86_64__)
+          dll_path += L"x64";
+#elif defined(_M_IX86) || defined(__i386__)
+          dll_path += L"x86";
+#elif defined(_M_ARM64) || defined(__aarch64__)
+          dll_path += L"arm64";
+#else
+#error WebView2 integration for this platform is not yet supported.
+#endif
+          dll_path += L"\\EmbeddedBrowserWebView.dll";
+          return dll_path;
+        }
+
+        client_info_t
+        find_installed_client(unsigned int min_api_version, bool system,
+                              const std::wstring &release_channel) const
+        {
+          std::wstring sub_key = client_state_reg_sub_key;
+          sub_key += release_channel;
+          auto root_key = system ? HKEY_LOCAL_MACHINE : HKEY_CURRENT_USER;
+          reg_key key(root_key, sub_key, 0, KEY_READ | KEY_WOW64_32KEY);
+          if (!key.is_open())
+          {
+            return {};
+          }
+          auto ebwebview_value = key.query_string(L"EBWebView");
+
+          auto client_version_string =
+              get_last_native_path_component(ebwebview_value);
+          auto client_version = parse_version(client_version_string);
+          if (client_version[2] < min_api_version)
+          {
+            // Our API version is greater than the runtime API version.
+            return {};
+          }
+
+          auto client_dll_path = make_client_dll_path(ebwebview_value);
+          return {true, client_dll_path, client_version_string,
+                  webview2_runtime_type::installed};
+        }
+
+        client_info_t find_embedded_client(unsigned int min_api_version,
+                                           const std::wstring &dir) const
+        {
+          auto client_dll_path = make_client_dll_path(dir);
+
+          auto client_version_string = get_file_version_string(client_dll_path);
+          auto client_version = parse_version(client_version_string);
+          if (client_version[2] < min_api_version)
+          {
+            // Our API version is greater than the runtime API version.
+            return {};
+          }
+
+          return {true, client_dll_path, client_version_string,
+                  webview2_runtime_type::embedded};
+        }
+
+        // The minimum WebView2 API version we need regardless of the SDK release
+        // actually used. The number comes from the SDK release version,
+        // e.g. 1.0.1150.38. To be safe the SDK should have a number that is greater
+        // than or equal to this number. The Edge browser webview client must
+        // have a number greater than or equal to this number.
+        static constexpr unsigned int api_version = 1150;
+
+        static constexpr auto client_state_reg_sub_key =
+            L"SOFTWARE\\Microsoft\\EdgeUpdate\\ClientState\\";
+
+        // GUID for the stable release channel.
+        static constexpr auto stable_release_guid =
+            L"{F3017226-FE2A-4295-8BDF-00C3A9A7E4C5}";
+
+        static constexpr auto default_release_channel_guid = stable_release_guid;
+#endif /* WEBVIEW_MSWEBVIEW2_BUILTIN_IMPL */
+
+#if WEBVIEW_MSWEBVIEW2_EXPLICIT_LINK == 1
+        native_library m_lib{L"WebView2Loader.dll"};
+#endif
+      };
+
+      namespace cast_info
+      {
+        static constexpr auto controller_completed =
+            cast_info_t<ICoreWebView2CreateCoreWebView2ControllerCompletedHandler>{
+                IID_ICoreWebView2CreateCoreWebView2ControllerCompletedHandler};
+
+        static constexpr auto environment_completed =
+            cast_info_t<ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler>{
+                IID_ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler};
+
+        static constexpr auto message_received =
+            cast_info_t<ICoreWebView2WebMessageReceivedEventHandler>{
+                IID_ICoreWebView2WebMessageReceivedEventHandler};
+
+        static constexpr auto permission_requested =
+            cast_info_t<ICoreWebView2PermissionRequestedEventHandler>{
+                IID_ICoreWebView2PermissionRequestedEventHandler};
+
+        static constexpr auto add_script_completed = cast_info_t<
+            ICoreWebView2AddScriptToExecuteOnDocumentCreatedCompletedHandler>{
+            IID_ICoreWebView2AddScriptToExecuteOnDocumentCreatedCompletedHandler};
+      } // namespace cast_info
+    }   // namespace mswebview2
+
+    class webview2_com_handler
+        : public ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler,
+          public ICoreWebView2CreateCoreWebView2ControllerCompletedHandler,
+          public ICoreWebView2WebMessageReceivedEventHandler,
+          public ICoreWebView2PermissionRequestedEventHandler
+    {
+      using webview2_com_handler_cb_t =
+          std::function<void(ICoreWebView2Controller *, ICoreWebView2 *webview)>;
+
+    public:
+      webview2_com_handler(HWND hwnd, msg_cb_t msgCb, webview2_com_handler_cb_t cb)
+          : m_window(hwnd), m_msgCb(msgCb), m_cb(cb) {}
+
+      virtual ~webview2_com_handler() = default;
+      webview2_com_handler(const webview2_com_handler &other) = delete;
+      webview2_com_handler &operator=(const webview2_com_handler &other) = delete;
+      webview2_com_handler(webview2_com_handler &&other) = delete;
+      webview2_com_handler &operator=(webview2_com_handler &&other) = delete;
+
+      ULONG STDMETHODCALLTYPE AddRef() { return ++m_ref_count; }
+      ULONG STDMETHODCALLTYPE Release()
+      {
+        if (m_ref_count > 1)
+        {
+          return --m_ref_count;
+        }
+        delete this;
+        return 0;
+      }
+      HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, LPVOID *ppv)
+      {
+        using namespace mswebview2::cast_info;
+
+        if (!ppv)
+        {
+          return E_POINTER;
+        }
+
+        // All of the COM interfaces we implement should be added here regardless
+        // of whether they are required.
+        // This is just to be on the safe side in case the WebView2 Runtime ever
+        // requests a pointer to an interface we implement.
+        // The WebView2 Runtime must at the very least be able to get a pointer to
+        // ICoreWebView2CreateCoreWebView2EnvironmentCompletedHandler when we use
+        // our custom WebView2 loader implementation, and observations have shown
+        // that it is the only interface requested in this case. None have been
+        // observed to be requested when using the official WebView2 loader.
+
+        if (cast_if_equal_iid(riid, controller_completed, ppv) ||
+            cast_if_equal_iid(riid, environment_completed, ppv) ||
+            cast_if_equal_iid(riid, message_received, ppv) ||
+            cast_if_equal_iid(riid, permission_requested, ppv))
+        {
+          return S_OK;
+        }
+
+        return E_NOINTERFACE;
+      }
+      HRESULT STDMETHODCALLTYPE Invoke(HRESULT res, ICoreWebView2Environment *env)
+      {
+        if (SUCCEEDED(res))
+        {
+          res = env->CreateCoreWebView2Controller(m_window, this);
+          if (SUCCEEDED(res))
+          {
+            return S_OK;
+          }
+        }
+        try_create_environment();
+        return S_OK;
+      }
+      HRESULT STDMETHODCALLTYPE Invoke(HRESULT res,
+                                       ICoreWebView2Controller *controller)
+      {
+        if (FAILED(res))
+        {
+          // See try_create_environment() regarding
+          // HRESULT_FROM_WIN32(ERROR_INVALID_STATE).
+          // The result is E_ABORT if the parent window has been destroyed already.
+          switch (res)
+          {
+          case HRESULT_FROM_WIN32(ERROR_INVALID_STATE):
+          case E_ABORT:
+            return S_OK;
+          }
+          try_create_environment();
+          return S_OK;
+        }
+
+        ICoreWebView2 *webview;
+        ::EventRegistrationToken token;
+        controller->get_CoreWebView2(&webview);
+        webview->add_WebMessageReceived(this, &token);
+        webview->add_PermissionRequested(this, &token);
+
+        m_cb(controller, webview);
+        return S_OK;
+      }
+      HRESULT STDMETHODCALLTYPE Invoke(
+          ICoreWebView2 *sender, ICoreWebView2WebMessageReceivedEventArgs *args)
+      {
+        LPWSTR message;
+        args->TryGetWebMessageAsString(&message);
+        m_msgCb(narrow_string(message));
+        sender->PostWebMessageAsString(message);
+
+        CoTaskMemFree(message);
+        return S_OK;
+      }
+      HRESULT STDMETHODCALLTYPE Invoke(
+          ICoreWebView2 *sender, ICoreWebView2PermissionRequestedEventArgs *args)
+      {
+        COREWEBVIEW2_PERMISSION_KIND kind;
+        args->get_PermissionKind(&kind);
+        if (kind == COREWEBVIEW2_PERMISSION_KIND_CLIPBOARD_READ)
+        {
+          args->put_State(COREWEBVIEW2_PERMISSION_STATE_ALLOW);
+        }
+        return S_OK;
+      }
+
+      // Checks whether the specified IID equals the IID of the specified type and
+      // if so casts the "this" pointer to T and returns it. Returns nullptr on
+      // mismatching IIDs.
+      // If ppv is specified then the pointer will also be assigned to *ppv.
+      template <typename T>
+      T *cast_if_equal_iid(REFIID riid, const cast_info_t<T> &info,
+                           LPVOID *ppv = nullptr) noexcept
+      {
+        T *ptr = nullptr;
+        if (IsEqualIID(riid, info.iid))
+        {
+          ptr = static_cast<T *>(this);
+          ptr->AddRef();
+        }
+        if (ppv)
+        {
+          *ppv = ptr;
+        }
+        return ptr;
+      }
+
+      // Set the function that will perform the initiating logic for creating
+      // the WebView2 environment.
+      void set_attempt_handler(std::function<HRESULT()> attempt_handler) noexcept
+      {
+        m_attempt_handler = attempt_handler;
+      }
+
+      // Retry creating a WebView2 environment.
+      // The initiating logic for creating the environment is defined by the
+      // caller of set_attempt_handler().
+      void try_create_environment() noexcept
+      {
+        // WebView creation fails with HRESULT_FROM_WIN32(ERROR_INVALID_STATE) if
+        // a running instance using the same user data folder exists, and the
+        // Environment objects have different EnvironmentOptions.
+        // Source: https://docs.microsoft.com/en-us/microsoft-edge/webview2/reference/win32/icorewebview2environment?view=webview2-1.0.1150.38
+        if (m_attempts < m_max_attempts)
+        {
+          ++m_attempts;
+          auto res = m_attempt_handler();
+          if (SUCCEEDED(res))
+          {
+            return;
+          }
+          // Not entirely sure if this error code only applies to
+          // CreateCoreWebView2Controller so we check here as well.
+          if (res == HRESULT_FROM_WIN32(ERROR_INVALID_STATE))
+          {
+            return;
+          }
+          try_create_environment();
+          return;
+        }
+        // Give up.
+        m_cb(nullptr, nullptr);
+      }
+
+    private:
+      HWND m_window;
+      msg_cb_t m_msgCb;
+      webview2_com_handler_cb_t m_cb;
+      std::atomic<ULONG> m_ref_count{1};
+      std::function<HRESULT()> m_attempt_handler;
+      unsigned int m_max_attempts = 5;
+      unsigned int m_attempts = 0;
+    };
+
+    // Receives the id of a script added by AddScriptToExecuteOnDocumentCreated
+    // so that the script can be removed again later.
+    class add_script_com_handler
+        : public ICoreWebView2AddScriptToExecuteOnDocumentCreatedCompletedHandler
+    {
+      using add_script_cb_t = std::function<void(LPCWSTR id)>;
+
+    public:
+      add_script_com_handler(add_script_cb_t cb) : m_cb(cb) {}
+
+      virtual ~add_script_com_handler() = default;
+      add_script_com_handler(const add_script_com_handler &other) = delete;
+      add_script_com_handler &operator=(const add_script_com_handler &other) = delete;
+      add_script_com_handler(add_script_com_handler &&other) = delete;
+      add_script_com_handler &operator=(add_script_com_handler &&other) = delete;
+
+      ULONG STDMETHODCALLTYPE AddRef() { return ++m_ref_count; }
+      ULONG STDMETHODCALLTYPE Release()
+      {
+        if (m_ref_count > 1)
+        {
+          return --m_ref_count;
+        }
+        delete this;
+        return 0;
+      }
+      HRESULT STDMETHODCALLTYPE QueryInterface(REFIID riid, LPVOID *ppv)
+      {
+        if (!ppv)
+        {
+          return E_POINTER;
+        }
+        if (IsEqualIID(riid, mswebview2::cast_info::add_script_completed.iid))
+        {
+          AddRef();
+          *ppv = static_cast<
+              ICoreWebView2AddScriptToExecuteOnDocumentCreatedCompletedHandler *>(
+              this);
+          return S_OK;
+        }
+        *ppv = nullptr;
+        return E_NOINTERFACE;
+      }
+      HRESULT STDMETHODCALLTYPE Invoke(HRESULT res, LPCWSTR id)
+      {
+        if (SUCCEEDED(res) && id)
+        {
+          m_cb(id);
+        }
+        return S_OK;
+      }
+
+    private:
+      add_script_cb_t m_cb;
+      std::atomic<ULONG> m_ref_count{1};
+    };
+
+    class win32_edge_engine
+    {
+    public:
+      win32_edge_engine(bool debug, void *window, bool visible = true)
+      {
+        if (!is_webview2_available())
+        {
+          return;
+        }
+        if (!m_com_init.is_initialized())
+        {
+          return;
+        }
+        enable_dpi_awareness();
+        if (window == nullptr)
+        {
+          HINSTANCE hInstance = GetModuleHandle(nullptr);
+          HICON icon = (HICON)LoadImage(
+              hInstance, IDI_APPLICATION, IMAGE_ICON, GetSystemMetrics(SM_CXICON),
+              GetSystemMetrics(SM_CYICON), LR_DEFAULTCOLOR);
+
+          WNDCLASSEXW wc;
+          ZeroMemory(&wc, sizeof(WNDCLASSEX));
+          wc.cbSize = sizeof(WNDCLASSEX);
+          wc.hInstance = hInstance;
+          wc.lpszClassName = L"webview";
+          wc.hIcon = icon;
+          wc.lpfnWndProc =
+              (WNDPROC)(+[](HWND hwnd, UINT msg, WPARAM wp, LPARAM lp) -> LRESULT
+                        {
+                          auto w = (win32_edge_engine *)GetWindowLongPtr(hwnd, GWLP_USERDATA);
+                          switch (msg)
+                          {
+                          case WM_SIZE:
+                            w->resize(hwnd);
                             break;
                           case WM_CLOSE:
                             DestroyWindow(hwnd);
@@ -2198,453 +5481,2573 @@ namespace webview
                                    nullptr, hInstance, nullptr);
           if (m_window == nullptr)
           {
-            return;
+            return;
+          }
+          SetWindowLongPtr(m_window, GWLP_USERDATA, (LONG_PTR)this);
+        }
+        else
+        {
+          m_window = *(static_cast<HWND *>(window));
+        }
+
+        if (visible)
+        {
+          ShowWindow(m_window, SW_SHOW);
+          UpdateWindow(m_window);
+          SetFocus(m_window);
+        }
+
+        auto cb =
+            std::bind(&win32_edge_engine::on_message, this, std::placeholders::_1);
+
+        embed(m_window, debug, cb);
+        resize(m_window);
+        m_controller->MoveFocus(COREWEBVIEW2_MOVE_FOCUS_REASON_PROGRAMMATIC);
+      }
+
+      virtual ~win32_edge_engine()
+      {
+        if (m_com_handler)
+        {
+          m_com_handler->Release();
+          m_com_handler = nullptr;
+        }
+        if (m_webview)
+        {
+          m_webview->Release();
+          m_webview = nullptr;
+        }
+        if (m_controller)
+        {
+          m_controller->Release();
+          m_controller = nullptr;
+        }
+      }
+
+      win32_edge_engine(const win32_edge_engine &other) = delete;
+      win32_edge_engine &operator=(const win32_edge_engine &other) = delete;
+      win32_edge_engine(win32_edge_engine &&other) = delete;
+      win32_edge_engine &operator=(win32_edge_engine &&other) = delete;
+
+      void run()
+      {
+        MSG msg;
+        BOOL res;
+        while ((res = GetMessage(&msg, nullptr, 0, 0)) != -1)
+        {
+          if (msg.hwnd)
+          {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+            continue;
+          }
+          if (msg.message == WM_APP)
+          {
+            auto f = (dispatch_fn_t *)(msg.lParam);
+            (*f)();
+            delete f;
+          }
+          else if (msg.message == WM_QUIT)
+          {
+            if (on_destroy)
+            {
+              on_destroy();
+            }
+            return;
+          }
+        }
+      }
+      void run1()
+      {
+        MSG msg;
+        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
+        {
+          if (msg.hwnd)
+          {
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
+          }
+          if (msg.message == WM_APP)
+          {
+            auto f = (dispatch_fn_t *)(msg.lParam);
+            (*f)();
+            delete f;
+          }
+          else if (msg.message == WM_QUIT)
+          {
+            if (on_destroy)
+            {
+              on_destroy();
+            }
+            return;
+          }
+        }
+      }
+
+      void set_on_destroy(std::function<void()> f) { on_destroy = f; }
+      void *window() { return (void *)m_window; }
+      // Shows a window created hidden.
+      void show()
+      {
+        ShowWindow(m_window, SW_SHOW);
+        UpdateWindow(m_window);
+        SetFocus(m_window);
+        m_controller->MoveFocus(COREWEBVIEW2_MOVE_FOCUS_REASON_PROGRAMMATIC);
+      }
+      // Thread messages are handled after the window messages already
+      // queued. Must be called on the UI thread.
+      static void post_idle(dispatch_fn_t f)
+      {
+        PostThreadMessage(GetCurrentThreadId(), WM_APP, 0,
+                          (LPARAM) new dispatch_fn_t(std::move(f)));
+      }
+      void terminate() { PostQuitMessage(0); }
+      void dispatch(dispatch_fn_t f)
+      {
+        PostThreadMessage(m_main_thread, WM_APP, 0, (LPARAM) new dispatch_fn_t(f));
+      }
+
+      void set_title(const std::string &title)
+      {
+        SetWindowTextW(m_window, widen_string(title).c_str());
+      }
+
+      void set_size(int width, int height, int hints)
+      {
+        auto style = GetWindowLong(m_window, GWL_STYLE);
+        if (hints == WEBVIEW_HINT_FIXED)
+        {
+          style &= ~(WS_THICKFRAME | WS_MAXIMIZEBOX);
+        }
+        else
+        {
+          style |= (WS_THICKFRAME | WS_MAXIMIZEBOX);
+        }
+        SetWindowLong(m_window, GWL_STYLE, style);
+
+        if (hints == WEBVIEW_HINT_MAX)
+        {
+          m_maxsz.x = width;
+          m_maxsz.y = height;
+        }
+        else if (hints == WEBVIEW_HINT_MIN)
+        {
+          m_minsz.x = width;
+          m_minsz.y = height;
+        }
+        else
+        {
+          RECT r;
+          r.left = r.top = 0;
+          r.right = width;
+          r.bottom = height;
+          AdjustWindowRect(&r, WS_OVERLAPPEDWINDOW, 0);
+          SetWindowPos(
+              m_window, nullptr, r.left, r.top, r.right - r.left, r.bottom - r.top,
+              SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOMOVE | SWP_FRAMECHANGED);
+          resize(m_window);
+        }
+      }
+
+      void navigate(const std::string &url)
+      {
+        auto wurl = widen_string(url);
+        m_webview->Navigate(wurl.c_str());
+      }
+
+      void init(const std::string &js)
+      {
+        m_user_scripts.add(js);
+        update_user_scripts();
+      }
+
+      void set_init_script(const std::string &id, const std::string &js)
+      {
+        if (m_user_scripts.set(id, js))
+        {
+          update_user_scripts();
+        }
+      }
+
+      void remove_init_script(const std::string &id)
+      {
+        if (m_user_scripts.remove(id))
+        {
+          update_user_scripts();
+        }
+      }
+
+      void eval(const std::string &js)
+      {
+        auto wjs = widen_string(js);
+        m_webview->ExecuteScript(wjs.c_str(), nullptr);
+      }
+
+      void set_html(const std::string &html)
+      {
+        m_webview->NavigateToString(widen_string(html).c_str());
+      }
+
+      // WebView2 only takes UTF-16 strings, so the mapped file is converted
+      // straight from the mapping, which is the only copy left.
+      bool set_html_file(const std::string &path)
+      {
+        auto file = CreateFileW(widen_string(path).c_str(), GENERIC_READ,
+                                FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+          return false;
+        }
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(file, &size))
+        {
+          CloseHandle(file);
+          return false;
+        }
+        if (size.QuadPart == 0)
+        {
+          CloseHandle(file);
+          m_webview->NavigateToString(L"");
+          return true;
+        }
+        auto mapping =
+            CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr)
+        {
+          return false;
+        }
+        auto view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (view == nullptr)
+        {
+          return false;
+        }
+        auto html = widen_string(static_cast<const char *>(view),
+                                 static_cast<std::size_t>(size.QuadPart));
+        UnmapViewOfFile(view);
+        m_webview->NavigateToString(html.c_str());
+        return true;
+      }
+
+      bool set_virtual_host_name(const std::string &url, const std::string &folder, const int option)
+      {
+        static auto wstring_conv = [](const std::string &input_string, std::wstring &output_string) -> bool
+        {
+          const auto size = MultiByteToWideChar(CP_UTF8, 0, input_string.data(), input_string.length(), nullptr, 0);
+
+          if (size == 0)
+          {
+            return false;
+          }
+
+          output_string = std::wstring(size, '\0');
+
+          const auto result = MultiByteToWideChar(CP_UTF8, 0, input_string.data(), input_string.length(), output_string.data(), size);
+
+          if (result <= 0)
+          {
+            return false;
+          }
+
+          return true;
+        };
+
+        std::wstring w_url;
+        std::wstring w_folder;
+
+        if (wstring_conv(url, w_url) && wstring_conv(folder, w_folder))
+        {
+          const auto hResult = static_cast<ICoreWebView2_3 *>(m_webview)->SetVirtualHostNameToFolderMapping(
+              w_url.data(),
+              w_folder.data(),
+              static_cast<COREWEBVIEW2_HOST_RESOURCE_ACCESS_KIND>(option));
+
+          if (hResult != S_OK)
+          {
+            return false;
+          }
+
+          return true;
+        }
+
+        return false;
+      }
+
+      // Custom schemes must be registered when the WebView2 environment is
+      // created, use set_virtual_host_name to serve local content.
+      bool register_scheme(const std::string &, scheme_handler_t)
+      {
+        return false;
+      }
+
+      bool set_virtual_host_bundle(const std::string &, const std::string &,
+                                   const int)
+      {
+        return false;
+      }
+
+    private:
+      bool embed(HWND wnd, bool debug, msg_cb_t cb)
+      {
+        std::atomic_flag flag = ATOMIC_FLAG_INIT;
+        flag.test_and_set();
+
+        wchar_t currentExePath[MAX_PATH];
+        GetModuleFileNameW(nullptr, currentExePath, MAX_PATH);
+        wchar_t *currentExeName = PathFindFileNameW(currentExePath);
+
+        wchar_t dataPath[MAX_PATH];
+        if (!SUCCEEDED(
+                SHGetFolderPathW(nullptr, CSIDL_APPDATA, nullptr, 0, dataPath)))
+        {
+          return false;
+        }
+        wchar_t userDataFolder[MAX_PATH];
+        PathCombineW(userDataFolder, dataPath, currentExeName);
+
+        m_com_handler = new webview2_com_handler(
+            wnd, cb,
+            [&](ICoreWebView2Controller *controller, ICoreWebView2 *webview)
+            {
+              if (!controller || !webview)
+              {
+                flag.clear();
+                return;
+              }
+              controller->AddRef();
+              webview->AddRef();
+              m_controller = controller;
+              m_webview = webview;
+              flag.clear();
+            });
+
+        m_com_handler->set_attempt_handler([&]
+                                           { return m_webview2_loader.create_environment_with_options(
+                                                 nullptr, userDataFolder, nullptr, m_com_handler); });
+        m_com_handler->try_create_environment();
+
+        MSG msg = {};
+        while (flag.test_and_set() && GetMessage(&msg, nullptr, 0, 0))
+        {
+          TranslateMessage(&msg);
+          DispatchMessage(&msg);
+        }
+        if (!m_controller || !m_webview)
+        {
+          return false;
+        }
+        ICoreWebView2Settings *settings = nullptr;
+        auto res = m_webview->get_Settings(&settings);
+        if (res != S_OK)
+        {
+          return false;
+        }
+        res = settings->put_AreDevToolsEnabled(debug ? TRUE : FALSE);
+        if (res != S_OK)
+        {
+          return false;
+        }
+        init("window.external={invoke:s=>window.chrome.webview.postMessage(s)}");
+        return true;
+      }
+
+      // Replaces the installed user scripts with the registered init
+      // scripts. The ids of the new scripts arrive asynchronously; a script
+      // whose id arrives after it has already been superseded is removed
+      // right away.
+      void update_user_scripts()
+      {
+        if (m_webview == nullptr)
+        {
+          return;
+        }
+        for (const auto &id : m_user_script_ids)
+        {
+          m_webview->RemoveScriptToExecuteOnDocumentCreated(id.c_str());
+        }
+        m_user_script_ids.clear();
+        auto generation = ++m_user_script_generation;
+        for (const auto &js : m_user_scripts.scripts())
+        {
+          auto handler = new add_script_com_handler(
+              [this, generation](LPCWSTR id)
+              {
+                if (generation != m_user_script_generation)
+                {
+                  m_webview->RemoveScriptToExecuteOnDocumentCreated(id);
+                  return;
+                }
+                m_user_script_ids.emplace_back(id);
+              });
+          auto wjs = widen_string(js);
+          m_webview->AddScriptToExecuteOnDocumentCreated(wjs.c_str(), handler);
+          handler->Release();
+        }
+      }
+
+      void resize(HWND wnd)
+      {
+        if (m_controller == nullptr)
+        {
+          return;
+        }
+        RECT bounds;
+        GetClientRect(wnd, &bounds);
+        m_controller->put_Bounds(bounds);
+      }
+
+      bool is_webview2_available() const noexcept
+      {
+        LPWSTR version_info = nullptr;
+        auto res = m_webview2_loader.get_available_browser_version_string(
+            nullptr, &version_info);
+        // The result will be equal to HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND)
+        // if the WebView2 runtime is not installed.
+        auto ok = SUCCEEDED(res) && version_info;
+        if (version_info)
+        {
+          CoTaskMemFree(version_info);
+        }
+        return ok;
+      }
+
+      virtual void on_message(const std::string &msg) = 0;
+
+      // The app is expected to call CoInitializeEx before
+      // CreateCoreWebView2EnvironmentWithOptions.
+      // Source: https://docs.microsoft.com/en-us/microsoft-edge/webview2/reference/win32/webview2-idl#createcorewebview2environmentwithoptions
+      com_init_wrapper m_com_init{COINIT_APARTMENTTHREADED};
+      HWND m_window = nullptr;
+      POINT m_minsz = POINT{0, 0};
+      POINT m_maxsz = POINT{0, 0};
+      DWORD m_main_thread = GetCurrentThreadId();
+      ICoreWebView2 *m_webview = nullptr;
+      ICoreWebView2Controller *m_controller = nullptr;
+      webview2_com_handler *m_com_handler = nullptr;
+      mswebview2::loader m_webview2_loader;
+      user_script_registry m_user_scripts;
+      std::vector<std::wstring> m_user_script_ids;
+      unsigned int m_user_script_generation = 0;
+
+      std::function<void()> on_destroy;
+    };
+
+  } // namespace detail
+
+  using browser_engine = detail::win32_edge_engine;
+
+} // namespace webview
+
+#elif defined(WEBVIEW_HEADLESS)
+
+//
+// ====================================================================
+//
+// This implementation has no browser and no window. The native side of the
+// library runs on an in-process loop, and the page is replaced by a scripted
+// simulator that sends calls the way the dispatcher does and settles them
+// from the scripts native code evaluates. It lets bindings, on_message,
+// resolve and the JSON helpers be load-tested deterministically on a
+// machine without a display. Build with -DWEBVIEW_HEADLESS.
+//
+// ====================================================================
+//
+namespace webview
+{
+  namespace detail
+  {
+
+    // What the simulated page receives from a scheme handler.
+    struct simulated_response
+    {
+      bool failed = false;
+      int status = 0;
+      std::string mime;
+      std::string body;
+      std::vector<std::pair<std::string, std::string>> headers;
+    };
+
+    class headless_scheme_request : public scheme_request
+    {
+    public:
+      using response_fn_t = std::function<void(const simulated_response &)>;
+
+      headless_scheme_request(
+          const std::string &uri, response_fn_t fn,
+          std::vector<std::pair<std::string, std::string>> request_headers)
+          : m_fn(std::move(fn)), m_request_headers(std::move(request_headers))
+      {
+        m_uri = uri;
+        auto start = uri.find(':') + 1;
+        if (uri.compare(start, 2, "//") == 0)
+        {
+          start = std::min(uri.find('/', start + 2), uri.size());
+        }
+        m_path = uri.substr(start, uri.find_first_of("?#", start) - start);
+      }
+
+      std::string header(const std::string &name) const override
+      {
+        for (const auto &h : m_request_headers)
+        {
+          if (h.first.size() == name.size() &&
+              std::equal(h.first.begin(), h.first.end(), name.begin(),
+                         [](char a, char b)
+                         { return std::tolower(a) == std::tolower(b); }))
+          {
+            return h.second;
+          }
+        }
+        return std::string();
+      }
+
+      void respond(int status, const std::string &mime, const void *data,
+                   std::size_t size, release_fn_t release, void *arg) override
+      {
+        m_response.body.assign(static_cast<const char *>(data), size);
+        if (release != nullptr)
+        {
+          release(arg);
+        }
+        finish(status, mime);
+      }
+
+      // The simulated page sees the body as sent, with Content-Encoding, as
+      // long as the request accepts the encoding.
+      bool respond_encoded(int status, const std::string &mime,
+                           const std::string &encoding, const void *data,
+                           std::size_t size, long long, release_fn_t release,
+                           void *arg) override
+      {
+        auto accepted = header("Accept-Encoding");
+        if ((encoding != "gzip" && encoding != "br") ||
+            (!accepted.empty() && accepted.find(encoding) == std::string::npos))
+        {
+          return false;
+        }
+        set_header("Content-Encoding", encoding);
+        respond(status, mime, data, size, release, arg);
+        return true;
+      }
+
+      void respond_stream(int status, const std::string &mime, long long,
+                          read_fn_t read, release_fn_t close,
+                          void *arg) override
+      {
+        char buf[65536];
+        long long n;
+        while ((n = read(buf, sizeof(buf), arg)) > 0)
+        {
+          m_response.body.append(buf, static_cast<std::size_t>(n));
+        }
+        m_response.failed = n < 0;
+        if (close != nullptr)
+        {
+          close(arg);
+        }
+        finish(status, mime);
+      }
+
+      void fail(const std::string &message) override
+      {
+        m_response.failed = true;
+        m_response.body = message;
+        finish(0, std::string());
+      }
+
+    private:
+      void finish(int status, const std::string &mime)
+      {
+        m_response.status = status;
+        m_response.mime = mime;
+        m_response.headers = m_headers;
+        if (m_fn)
+        {
+          m_fn(m_response);
+        }
+        delete this;
+      }
+
+      response_fn_t m_fn;
+      std::vector<std::pair<std::string, std::string>> m_request_headers;
+      simulated_response m_response;
+    };
+
+    class headless_engine
+    {
+    public:
+      // Called with the status and JSON result when the native side settles
+      // a simulated call.
+      using settle_fn_t = std::function<void(int, const std::string &)>;
+      // Called with the JSON of a chunk, an event batch or a message batch.
+      using json_fn_t = std::function<void(const std::string &)>;
+
+      headless_engine(bool, void *, bool = true) {}
+      virtual ~headless_engine() = default;
+
+      void show() {}
+
+      // Instances do not share a loop, so there is no idle time to wait for.
+      static void post_idle(std::function<void()> f) { f(); }
+
+      // There is no native window; the engine itself stands in for it so
+      // that callers checking for a window see a live instance.
+      void *window() { return this; }
+
+      void run()
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true)
+        {
+          m_cv.wait(lock, [this]()
+                    { return m_terminated || !m_tasks.empty(); });
+          if (m_terminated)
+          {
+            break;
+          }
+          auto task = std::move(m_tasks.front());
+          m_tasks.pop_front();
+          lock.unlock();
+          task();
+          lock.lock();
+        }
+        m_terminated = false;
+        lock.unlock();
+        if (on_destroy)
+        {
+          on_destroy();
+        }
+      }
+
+      // Runs tasks until the queue is empty, including the tasks they post,
+      // without blocking. Benchmarks drive the engine with this.
+      void run1()
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (!m_terminated && !m_tasks.empty())
+        {
+          auto task = std::move(m_tasks.front());
+          m_tasks.pop_front();
+          lock.unlock();
+          task();
+          lock.lock();
+        }
+        if (m_terminated)
+        {
+          m_terminated = false;
+          lock.unlock();
+          if (on_destroy)
+          {
+            on_destroy();
+          }
+        }
+      }
+
+      void set_on_destroy(std::function<void()> f) { on_destroy = f; }
+
+      void terminate()
+      {
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_terminated = true;
+        }
+        m_cv.notify_all();
+      }
+
+      void dispatch(std::function<void()> f)
+      {
+        {
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_tasks.push_back(std::move(f));
+        }
+        m_cv.notify_all();
+      }
+
+      void set_title(const std::string &) {}
+      void set_size(int, int, int) {}
+
+      // A new document starts: the simulated page forgets its calls and
+      // listeners and the dispatcher reports the reset, as a real page would.
+      void navigate(const std::string &url)
+      {
+        dispatch([this, url]()
+                 {
+          m_url = m_virtual_hosts.rewrite(url);
+          m_calls.clear();
+          m_next_seq = 1;
+          m_page = std::to_string(++m_pages);
+          m_listeners.clear();
+          // The simulated document loads at once.
+          auto escaped = json_escape(m_url);
+          on_message("{\"event\":\"timing\",\"phase\":\"started\",\"url\":" + escaped + "}");
+          on_message("{\"event\":\"reset\",\"page\":" + json_escape(m_page) + "}");
+          for (const char *phase : {"committed", "dom-content-loaded", "load-finished"})
+          {
+            on_message(std::string("{\"event\":\"timing\",\"phase\":\"") + phase + "\"}");
+          } });
+      }
+
+      void set_html(const std::string &) { navigate("about:blank"); }
+
+      bool set_html_file(const std::string &path)
+      {
+        auto file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr)
+        {
+          return false;
+        }
+        std::fclose(file);
+        navigate("about:blank");
+        return true;
+      }
+
+      void init(const std::string &js) { m_user_scripts.add(js); }
+
+      void set_init_script(const std::string &id, const std::string &js)
+      {
+        m_user_scripts.set(id, js);
+      }
+
+      void remove_init_script(const std::string &id)
+      {
+        m_user_scripts.remove(id);
+      }
+
+      // Scripts are not run, but the calls of the dispatcher they contain are
+      // handed to the simulated page on the next loop iteration, as the
+      // evaluation would be asynchronous in a browser.
+      void eval(const std::string &js)
+      {
+        dispatch([this, js]()
+                 { simulate_eval(js); });
+      }
+
+      bool set_virtual_host_name(const std::string &host,
+                                 const std::string &folder, const int access)
+      {
+        if (m_virtual_hosts.set(host, folder, access))
+        {
+          register_scheme(virtual_hosts::scheme, [this](scheme_request *r)
+                          { m_virtual_hosts.serve(r); });
+        }
+        return true;
+      }
+
+      bool set_virtual_host_bundle(const std::string &host,
+                                   const std::string &path, const int access)
+      {
+        auto bundle = asset_bundle::open(path);
+        if (!bundle)
+        {
+          return false;
+        }
+        if (m_virtual_hosts.set_bundle(host, std::move(bundle), access))
+        {
+          register_scheme(virtual_hosts::scheme, [this](scheme_request *r)
+                          { m_virtual_hosts.serve(r); });
+        }
+        return true;
+      }
+
+      bool register_scheme(const std::string &scheme, scheme_handler_t handler)
+      {
+        m_scheme_handlers[scheme] = std::move(handler);
+        return true;
+      }
+
+      // Requests uri from the handler of its scheme, as fetch() would. fn sees
+      // the response once the handler answers it. Safe to call from any
+      // thread.
+      void simulate_fetch(
+          const std::string &uri, headless_scheme_request::response_fn_t fn,
+          std::vector<std::pair<std::string, std::string>> headers = {})
+      {
+        dispatch([this, uri, fn, headers]()
+                 {
+          auto r = new headless_scheme_request(uri, fn, headers);
+          auto found = m_scheme_handlers.find(uri.substr(0, uri.find(':')));
+          if (found == m_scheme_handlers.end())
+          {
+            r->fail("No handler for " + uri);
+            return;
+          }
+          found->second(r); });
+      }
+
+      // Sends a call from the simulated page, as `window[method](...params)`
+      // would. params is the JSON array of arguments. Like the dispatcher,
+      // the page numbers its calls from 1 in every document; the returned id
+      // identifies the call for simulate_cancel instead. Safe to call from any
+      // thread.
+      unsigned long long simulate_call(const std::string &method,
+                                       const std::string &params,
+                                       settle_fn_t on_settle,
+                                       json_fn_t on_chunk = nullptr)
+      {
+        auto id = m_next_id.fetch_add(1, std::memory_order_relaxed);
+        dispatch([this, id, method, params, on_settle, on_chunk]()
+                 {
+          auto seq = m_next_seq++;
+          m_calls[seq] = {on_settle, on_chunk, id};
+          on_message("{\"id\":" + std::to_string(seq) + ",\"method\":" +
+                     json_escape(method) + ",\"params\":" + params + "}"); });
+        return id;
+      }
+
+      // Abandons a simulated call, as a timeout or an AbortSignal would.
+      void simulate_cancel(unsigned long long id)
+      {
+        dispatch([this, id]()
+                 {
+          for (auto it = m_calls.begin(); it != m_calls.end(); ++it)
+          {
+            if (it->second.id == id)
+            {
+              auto seq = it->first;
+              m_calls.erase(it);
+              on_message("{\"cancel\":\"abort\",\"id\":" +
+                         std::to_string(seq) + "}");
+              return;
+            }
+          } });
+      }
+
+      // Starts receiving a push channel, as window._rpc.listen would. Credits
+      // are granted back as soon as fn has seen a batch.
+      void simulate_listen(const std::string &channel, json_fn_t fn)
+      {
+        dispatch([this, channel, fn]()
+                 {
+          m_listeners[channel] = fn;
+          on_message("{\"credit\":-1,\"channel\":" + json_escape(channel) +
+                     "}"); });
+      }
+
+      // Sends any message the dispatcher could send, ex: a subscription.
+      void simulate_message(const std::string &msg)
+      {
+        dispatch([this, msg]()
+                 { on_message(msg); });
+      }
+
+      // Sees every script the native side evaluates, after the simulated page
+      // has handled it.
+      void set_eval_observer(json_fn_t fn)
+      {
+        dispatch([this, fn]()
+                 { m_eval_observer = fn; });
+      }
+
+      // Number of simulated calls that have not been settled yet. Must be
+      // called on the loop thread or while the loop is not running.
+      std::size_t simulated_pending() const { return m_calls.size(); }
+
+    private:
+      virtual void on_message(const std::string &msg) = 0;
+
+      struct simulated_call
+      {
+        settle_fn_t on_settle;
+        json_fn_t on_chunk;
+        // The id simulate_call returned.
+        unsigned long long id;
+      };
+
+      // Splits the arguments of a call to a window._rpc function.
+      static bool split_call(const std::string &js, const std::string &prefix,
+                             std::string &first, std::string &rest)
+      {
+        if (js.compare(0, prefix.size(), prefix) != 0 || js.back() != ')')
+        {
+          return false;
+        }
+        auto comma = js.find(',', prefix.size());
+        if (comma == std::string::npos)
+        {
+          return false;
+        }
+        first = js.substr(prefix.size(), comma - prefix.size());
+        rest = js.substr(comma + 1, js.size() - comma - 2);
+        return true;
+      }
+
+      // Checks that a settle or chunk, whose first argument is the page
+      // token, is meant for this page, and moves on to the next argument.
+      bool for_this_page(std::string &first, std::string &rest) const
+      {
+        auto comma = rest.find(',');
+        if (first != json_escape(m_page) || comma == std::string::npos)
+        {
+          return false;
+        }
+        first = rest.substr(0, comma);
+        rest = rest.substr(comma + 1);
+        return true;
+      }
+
+      static std::size_t json_array_size(const std::string &json)
+      {
+        std::size_t n = 0;
+        const char *value = nullptr;
+        std::size_t value_sz = 0;
+        while (json_parse_c(json.c_str(), json.size(), nullptr, n, &value,
+                            &value_sz) == 0 &&
+               value != nullptr)
+        {
+          n++;
+        }
+        return n;
+      }
+
+      void simulate_eval(const std::string &js)
+      {
+        std::string first, rest;
+        if (split_call(js, "window._rpc.settle(", first, rest))
+        {
+          auto found = m_calls.end();
+          if (for_this_page(first, rest))
+          {
+            found = m_calls.find(std::strtoull(first.c_str(), nullptr, 10));
+          }
+          auto comma = rest.find(',');
+          if (comma != std::string::npos && found != m_calls.end())
+          {
+            auto call = std::move(found->second);
+            m_calls.erase(found);
+            if (call.on_settle)
+            {
+              call.on_settle(std::atoi(rest.c_str()), rest.substr(comma + 1));
+            }
+          }
+        }
+        else if (split_call(js, "window._rpc.chunk(", first, rest))
+        {
+          auto found = m_calls.end();
+          if (for_this_page(first, rest))
+          {
+            found = m_calls.find(std::strtoull(first.c_str(), nullptr, 10));
+          }
+          if (found != m_calls.end())
+          {
+            if (found->second.on_chunk)
+            {
+              found->second.on_chunk(rest);
+            }
+            on_message("{\"credit\":1,\"id\":" + first + "}");
+          }
+        }
+        else if (split_call(js, "window._rpc.push(", first, rest))
+        {
+          auto channel = json_parse("[" + first + "]", "", 0);
+          auto found = m_listeners.find(channel);
+          if (found != m_listeners.end())
+          {
+            found->second(rest);
+            on_message("{\"credit\":" + std::to_string(json_array_size(rest)) +
+                       ",\"channel\":" + first + "}");
+          }
+        }
+        if (m_eval_observer)
+        {
+          m_eval_observer(js);
+        }
+      }
+
+      std::mutex m_mutex;
+      std::condition_variable m_cv;
+      std::deque<std::function<void()>> m_tasks;
+      bool m_terminated = false;
+      std::function<void()> on_destroy;
+
+      user_script_registry m_user_scripts;
+      std::map<std::string, scheme_handler_t> m_scheme_handlers;
+      virtual_hosts m_virtual_hosts;
+      std::string m_url;
+
+      // Ids of simulated calls, handed out on any thread.
+      std::atomic<unsigned long long> m_next_id{1};
+      // State of the simulated page, only touched on the loop thread.
+      unsigned long long m_next_seq = 1;
+      // The token of the current page, which is empty until the first
+      // navigation like the webview's own.
+      unsigned long long m_pages = 0;
+      std::string m_page;
+      std::map<unsigned long long, simulated_call> m_calls;
+      std::map<std::string, json_fn_t> m_listeners;
+      json_fn_t m_eval_observer;
+    };
+
+  } // namespace detail
+
+  using browser_engine = detail::headless_engine;
+
+} // namespace webview
+
+#endif /* WEBVIEW_GTK, WEBVIEW_COCOA, WEBVIEW_EDGE, WEBVIEW_HEADLESS */
+
+namespace webview
+{
+
+  class webview : public browser_engine
+  {
+  public:
+    // A webview created with visible set to false keeps its window hidden
+    // until show() is called.
+    webview(bool debug = false, void *wnd = nullptr, bool visible = true)
+        : browser_engine(debug, wnd, visible)
+    {
+      // No page has been loaded yet, so the init script is enough to get the
+      // dispatcher into every document.
+      set_init_script(dispatcher_script_id, dispatcher_js);
+      set_init_script(timing_script_id, timing_js);
+    }
+
+    ~webview()
+    {
+      queue_stats->closed = true;
+      {
+        // Wakes the threads waiting in resolve_chunk, and waits for them to
+        // leave before the mutex goes away.
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        closed = true;
+        pending.clear();
+        pending_space.notify_all();
+        pending_space.wait(lock, [this]()
+                           { return chunk_waiters == 0; });
+      }
+      std::lock_guard<std::mutex> lock(channels_mutex);
+      for (auto &channel : channels)
+      {
+        channel.second->close();
+      }
+    }
+
+    void navigate(const std::string &url)
+    {
+      detail::trace_span span("navigate", url);
+      begin_navigation(url.empty() ? "about:blank" : url);
+      if (url.empty())
+      {
+        browser_engine::navigate("about:blank");
+        return;
+      }
+      browser_engine::navigate(url);
+    }
+
+    void set_html(const std::string &html)
+    {
+      detail::trace_span span("set_html", "bytes", html.size());
+      begin_navigation("");
+      browser_engine::set_html(html);
+    }
+
+    // Loads the HTML of a file without reading it into a string. Returns
+    // false if the file cannot be opened, in which case no navigation starts.
+    // Engines load the file asynchronously, so their own start event still
+    // comes after begin_navigation.
+    bool set_html_file(const std::string &path)
+    {
+      detail::trace_span span("set_html_file", path);
+      if (!browser_engine::set_html_file(path))
+      {
+        return false;
+      }
+      begin_navigation("");
+      return true;
+    }
+
+    // Watches folder, served at host by set_virtual_host_name, and pushes
+    // the files that change to the page instead of reloading it: linked
+    // stylesheets of the host are swapped in place, and modules that called
+    // window._webviewHot.accept(import.meta.url, fn) are imported again and
+    // passed to fn. Any other change reloads the page. An empty folder stops
+    // watching host. Returns false if the folder cannot be watched, which is
+    // always the case on the backends without inotify.
+    bool hot_reload(const std::string &name, std::string folder)
+    {
+#if defined(__linux__) && (defined(WEBVIEW_GTK) || defined(WEBVIEW_HEADLESS))
+      // The page compares it with the host of its stylesheets.
+      auto host = detail::virtual_hosts::normalize_host(name);
+      if (folder.empty())
+      {
+        hot_watchers.erase(host);
+        if (hot_watchers.empty())
+        {
+          remove_init_script(hot_script_id);
+        }
+        return true;
+      }
+      while (folder.size() > 1 && folder.back() == '/')
+      {
+        folder.pop_back();
+      }
+      auto watcher = detail::folder_watcher::start(
+          folder, [this, host, folder](const std::vector<std::string> &paths)
+          {
+            std::string js;
+            for (const auto &path : paths)
+            {
+              // The cache sees the change on its own inotify thread, which
+              // may be later than the page asks for the file again.
+              detail::asset_cache::shared().invalidate(folder + path, false);
+              js += (js.empty() ? "" : ",") + detail::json_escape(path);
+            }
+            js = "window._webviewHot&&window._webviewHot.apply(" +
+                 detail::json_escape(host) + ",[" + js + "])";
+            dispatch([this, js]()
+                     { eval(js); },
+                     "hot-reload"); });
+      if (!watcher)
+      {
+        return false;
+      }
+      hot_watchers[host] = std::move(watcher);
+      set_init_script(hot_script_id, hot_client_js);
+      // The current document has not run the init script.
+      eval(hot_client_js);
+      return true;
+#else
+      (void)name;
+      (void)folder;
+      return false;
+#endif
+    }
+
+    // Serves the URIs of scheme from handler. Returns false if the backend
+    // cannot register custom schemes.
+    bool register_scheme(const std::string &scheme,
+                         detail::scheme_handler_t handler)
+    {
+      return browser_engine::register_scheme(
+          scheme, [handler](detail::scheme_request *r)
+          {
+            // The handler may answer, and so delete, the request.
+            auto uri = r->uri();
+            detail::trace_span span("scheme", uri);
+            handler(r); });
+    }
+
+    void eval(const std::string &js)
+    {
+      detail::trace_span span("eval", js, "bytes", js.size());
+      WEBVIEW_PROBE2(eval, this, js.size());
+      browser_engine::eval(js);
+    }
+
+    // Runs f on the UI thread. The site names the caller in stall reports.
+    void dispatch(std::function<void()> f, const char *site = "app")
+    {
+      detail::trace_span span("dispatch.enqueue");
+      // Probes pair post, run and done by id, so a tracer can tell queue
+      // wait from run time.
+      auto id = dispatch_seq.fetch_add(1, std::memory_order_relaxed);
+      WEBVIEW_PROBE2(dispatch__post, this, id);
+      auto queued = std::chrono::steady_clock::now();
+      queue_stats->on_post();
+      // The task keeps the counters alive and checks them before it touches
+      // the webview, which may have been destroyed while the task waited.
+      browser_engine::dispatch([f = std::move(f), queued, id, site,
+                                stats = queue_stats, this]()
+                               {
+        if (stats->closed)
+        {
+          return;
+        }
+        (void)id;
+        WEBVIEW_PROBE2(dispatch__run, this, id);
+        {
+          auto waited = std::chrono::steady_clock::now() - queued;
+          stats->on_run(waited);
+          auto watched = watchdog.watch("dispatch", site);
+          detail::trace_span span(
+              "dispatch.run", "wait_us",
+              std::chrono::duration_cast<std::chrono::microseconds>(waited)
+                  .count());
+          f();
+        }
+        WEBVIEW_PROBE2(dispatch__done, this, id); });
+    }
+
+    // Copies the counters of the dispatch queue.
+    void dispatch_stats(webview_dispatch_stats_t &out)
+    {
+      out.posted = queue_stats->posted.load(std::memory_order_relaxed);
+      out.run = queue_stats->run.load(std::memory_order_relaxed);
+      out.depth = out.posted > out.run ? out.posted - out.run : 0;
+      out.max_depth = queue_stats->max_depth.load(std::memory_order_relaxed);
+      queue_stats->wait.snapshot(out.wait_histogram, &out.wait_total_us);
+      unsigned long long tasks;
+      queue_stats->batch.snapshot(out.batch_histogram, &tasks);
+    }
+
+    using binding_t = std::function<void(std::string, std::string, void *)>;
+    using cancel_t = std::function<void(std::string, void *)>;
+    class binding_ctx_t
+    {
+    public:
+      binding_ctx_t(binding_t callback, void *arg)
+          : callback(callback), arg(arg) {}
+      // This function is called upon execution of the bound JS function
+      binding_t callback;
+      // This user-supplied argument is passed to the callback
+      void *arg;
+      // This function is called when JS abandons a pending call
+      cancel_t cancel;
+      // Default timeout of a call in milliseconds, 0 means no timeout
+      int timeout = 0;
+      // Call counters, shared with the calls that are still pending
+      std::shared_ptr<detail::binding_stats> stats =
+          std::make_shared<detail::binding_stats>();
+    };
+
+    using sync_binding_t = std::function<std::string(std::string)>;
+
+    // Synchronous bind
+    void bind(const std::string &name, sync_binding_t fn)
+    {
+      auto wrapper = [this, fn](const std::string &seq, const std::string &req,
+                                void * /*arg*/)
+      { resolve(seq, 0, fn(req)); };
+      bind(name, wrapper, nullptr);
+    }
+
+    // Asynchronous bind
+    void bind(const std::string &name, binding_t fn, void *arg)
+    {
+      bind_many({{name, binding_ctx_t(fn, arg)}});
+    }
+
+    // Registers several asynchronous bindings at once. The shared dispatcher
+    // script and the list of bound names are injected once per call rather
+    // than once per binding.
+    void bind_many(const std::vector<std::pair<std::string, binding_ctx_t>> &list)
+    {
+      std::vector<std::string> added;
+      for (const auto &binding : list)
+      {
+        if (bindings.count(binding.first) > 0)
+        {
+          continue;
+        }
+        bindings.emplace(binding.first, binding.second);
+        added.push_back(binding.first);
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats_by_name[binding.first] = binding.second.stats;
+      }
+      if (added.empty())
+      {
+        return;
+      }
+      update_binding_script();
+      if (binding_namespace.empty())
+      {
+        eval("window._rpc.bind(" + json_names(added) + ")");
+      }
+    }
+
+    void unbind(const std::string &name)
+    {
+      auto found = bindings.find(name);
+      if (found != bindings.end())
+      {
+        bindings.erase(found);
+        {
+          std::lock_guard<std::mutex> lock(stats_mutex);
+          stats_by_name.erase(name);
+        }
+        update_binding_script();
+        if (binding_namespace.empty())
+        {
+          eval("delete window[" + detail::json_escape(name) + "];");
+        }
+      }
+    }
+
+    // Exposes all bindings as members of window[ns] instead of as globals. A
+    // single constant script installs a Proxy that materializes binding stubs
+    // on first access, so the per-document cost does not grow with the number
+    // of bindings. An empty name switches back to global bindings. Bindings
+    // already created in the current page are left untouched.
+    void set_binding_namespace(const std::string &ns)
+    {
+      if (ns == binding_namespace)
+      {
+        return;
+      }
+      binding_namespace = ns;
+      update_binding_script();
+      if (!binding_namespace.empty())
+      {
+        eval("window._rpc.namespace(" + detail::json_escape(ns) + ")");
+      }
+      else if (!bindings.empty())
+      {
+        std::vector<std::string> names;
+        for (const auto &binding : bindings)
+        {
+          names.push_back(binding.first);
+        }
+        eval("window._rpc.bind(" + json_names(names) + ")");
+      }
+    }
+
+    void resolve(const std::string &seq, int status, const std::string &result)
+    {
+      detail::trace_span span("resolve", seq, "bytes", result.size());
+      WEBVIEW_PROBE4(resolve, this, seq.c_str(), status, result.size());
+      pending_call call;
+      {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        auto found = pending.find(seq);
+        // Calls that were cancelled by JS have nothing left to resolve.
+        if (found == pending.end())
+        {
+          return;
+        }
+        call = std::move(found->second);
+        pending.erase(found);
+      }
+      pending_space.notify_all();
+      auto &stats = *call.stats;
+      stats.bytes_out.fetch_add(result.size(), std::memory_order_relaxed);
+      if (status != 0)
+      {
+        stats.errors.fetch_add(1, std::memory_order_relaxed);
+      }
+      dispatch([status, result, call, this]()
+               {
+        eval("window._rpc.settle(" + detail::json_escape(call.page) + "," +
+             call.js_seq + "," +
+             std::to_string(status) + "," + result + ")");
+        call.stats->in_flight.fetch_sub(1, std::memory_order_relaxed);
+        call.stats->latency.record(std::chrono::steady_clock::now() -
+                                   call.start); },
+               "resolve");
+    }
+
+    // Sends one chunk of a streaming call's result. The call must still be
+    // finished with resolve(), which ends the JS iteration on success or makes
+    // it throw on error. Chunks are delivered in order and each is evaluated
+    // separately, so neither side has to hold the complete result.
+    // The page grants a credit back for every chunk its iterator consumes and
+    // at most stream_window chunks are outstanding. Other threads wait for a
+    // credit; the main thread, which is the one receiving them, is refused
+    // instead. Returns false if the chunk was not sent.
+    bool resolve_chunk(const std::string &seq, const std::string &result)
+    {
+      std::string js_seq;
+      std::string page;
+      {
+        std::unique_lock<std::mutex> lock(pending_mutex);
+        auto has_credit = [&]()
+        {
+          auto found = pending.find(seq);
+          return closed || found == pending.end() ||
+                 found->second.chunks_in_flight < detail::stream_window;
+        };
+        if (std::this_thread::get_id() != main_thread)
+        {
+          chunk_waiters++;
+          pending_space.wait(lock, has_credit);
+          chunk_waiters--;
+          if (closed)
+          {
+            pending_space.notify_all();
           }
-          SetWindowLongPtr(m_window, GWLP_USERDATA, (LONG_PTR)this);
         }
-        else
+        auto found = pending.find(seq);
+        if (closed || found == pending.end() ||
+            found->second.chunks_in_flight >= detail::stream_window)
         {
-          m_window = *(static_cast<HWND *>(window));
+          return false;
         }
+        found->second.chunks_in_flight++;
+        found->second.stats->bytes_out.fetch_add(result.size(),
+                                                 std::memory_order_relaxed);
+        js_seq = found->second.js_seq;
+        page = found->second.page;
+      }
+      auto js = "window._rpc.chunk(" + detail::json_escape(page) + "," +
+                js_seq + "," + result + ")";
+      dispatch([js = std::move(js), this]()
+               { eval(js); },
+               "resolve_chunk");
+      return true;
+    }
 
-        ShowWindow(m_window, SW_SHOW);
-        UpdateWindow(m_window);
-        SetFocus(m_window);
+    // Opens a flow-controlled channel for pushing messages to JS, where the
+    // page receives them with window._rpc.listen(name, fn). At most window
+    // messages are in flight to the page; the rest wait in a queue of the
+    // given capacity handled according to the policy. Reopening a channel
+    // replaces it.
+    void open_channel(const std::string &name, detail::push_channel::policy p,
+                      std::size_t capacity, unsigned int window)
+    {
+      auto channel = std::make_shared<detail::push_channel>(p, capacity, window);
+      std::lock_guard<std::mutex> lock(channels_mutex);
+      auto &slot = channels[name];
+      if (slot)
+      {
+        slot->close();
+      }
+      slot = channel;
+    }
 
-        auto cb =
-            std::bind(&win32_edge_engine::on_message, this, std::placeholders::_1);
+    // Posts a JSON message to a channel. Messages with the same non-empty key
+    // are coalesced if the channel uses the coalesce policy. With the block
+    // policy this waits while the queue is full, so it must not be called
+    // from the UI thread. Returns false if there is no such channel.
+    bool post(const std::string &name, const std::string &key,
+              const std::string &json)
+    {
+      return post(name, key, std::make_shared<const std::string>(json));
+    }
 
-        embed(m_window, debug, cb);
-        resize(m_window);
-        m_controller->MoveFocus(COREWEBVIEW2_MOVE_FOCUS_REASON_PROGRAMMATIC);
+    // Posts a shared payload, see broadcast().
+    bool post(const std::string &name, const std::string &key,
+              const detail::push_channel::payload_t &json)
+    {
+      auto channel = find_channel(name);
+      if (!channel || !channel->post(key, json))
+      {
+        return false;
       }
+      pump(name, channel);
+      return true;
+    }
 
-      virtual ~win32_edge_engine()
+    // Posts one message to the channel of every given webview. The payload is
+    // copied once and shared by all queues; each webview applies the policy
+    // of its own channel. Returns the number of webviews that accepted it.
+    template <typename Iterator>
+    static std::size_t broadcast(Iterator first, Iterator last,
+                                 const std::string &name,
+                                 const std::string &key,
+                                 const std::string &json)
+    {
+      auto payload = std::make_shared<const std::string>(json);
+      std::size_t accepted = 0;
+      for (; first != last; ++first)
       {
-        if (m_com_handler)
-        {
-          m_com_handler->Release();
-          m_com_handler = nullptr;
-        }
-        if (m_webview)
+        if ((*first)->post(name, key, payload))
         {
-          m_webview->Release();
-          m_webview = nullptr;
+          accepted++;
         }
-        if (m_controller)
+      }
+      return accepted;
+    }
+
+    bool channel_stats(const std::string &name,
+                       detail::push_channel::stats &out)
+    {
+      auto channel = find_channel(name);
+      if (!channel)
+      {
+        return false;
+      }
+      out = channel->get_stats();
+      return true;
+    }
+
+    // Emits an event to the page, where it is received by the functions
+    // registered with window._rpc.subscribe(topic, fn). Events of topics
+    // without subscribers are dropped right away. Emits of a topic that are
+    // still waiting for the UI thread are coalesced, only the latest JSON is
+    // delivered. Safe to call from any thread. Returns false if dropped.
+    bool emit(const std::string &topic, const std::string &json)
+    {
+      std::lock_guard<std::mutex> lock(events_mutex);
+      if (subscribed_topics.count(topic) == 0)
+      {
+        return false;
+      }
+      auto found = pending_events.find(topic);
+      if (found != pending_events.end())
+      {
+        found->second = json;
+        return true;
+      }
+      pending_events.emplace(topic, json);
+      pending_topics.push_back(topic);
+      if (!events_flush_scheduled)
+      {
+        events_flush_scheduled = true;
+        dispatch([this]()
+                 { flush_events(); },
+                 "emit");
+      }
+      return true;
+    }
+
+    // Returns true if the page has subscribed to the topic, so that callers
+    // can skip building events nobody listens to. Safe to call from any
+    // thread.
+    bool has_subscribers(const std::string &topic)
+    {
+      std::lock_guard<std::mutex> lock(events_mutex);
+      return subscribed_topics.count(topic) > 0;
+    }
+
+    // Sets the default timeout of calls to a binding. When it elapses the JS
+    // promise is rejected and the call is cancelled on the native side.
+    void set_binding_timeout(const std::string &name, int timeout_ms)
+    {
+      auto found = bindings.find(name);
+      if (found == bindings.end() || found->second.timeout == timeout_ms)
+      {
+        return;
+      }
+      found->second.timeout = timeout_ms;
+      update_binding_script();
+      eval("window._rpc.timeouts[" + detail::json_escape(name) +
+           "]=" + std::to_string(timeout_ms));
+    }
+
+    // Sets the function called when JS abandons a pending call to a binding,
+    // either because it timed out or because its AbortSignal fired.
+    void set_binding_cancel(const std::string &name, cancel_t fn)
+    {
+      auto found = bindings.find(name);
+      if (found != bindings.end())
+      {
+        found->second.cancel = fn;
+      }
+    }
+
+    // Copies the counters of a binding. Returns false if there is no such
+    // binding. Safe to call from any thread.
+    bool binding_stats(const std::string &name, webview_binding_stats_t &out)
+    {
+      std::shared_ptr<detail::binding_stats> stats;
+      {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        auto found = stats_by_name.find(name);
+        if (found == stats_by_name.end())
         {
-          m_controller->Release();
-          m_controller = nullptr;
+          return false;
         }
+        stats = found->second;
       }
+      copy_stats(*stats, out);
+      return true;
+    }
 
-      win32_edge_engine(const win32_edge_engine &other) = delete;
-      win32_edge_engine &operator=(const win32_edge_engine &other) = delete;
-      win32_edge_engine(win32_edge_engine &&other) = delete;
-      win32_edge_engine &operator=(win32_edge_engine &&other) = delete;
+    // Copies the counters of the calls to names that are not bound.
+    void unknown_binding_stats(webview_binding_stats_t &out)
+    {
+      copy_stats(*unknown_stats, out);
+    }
 
-      void run()
+    // Starts watching the UI thread for bound callbacks and dispatched
+    // functions that run for threshold_ms or longer, and for heartbeats of the
+    // main loop that wait as long. Stalls are reported on the watchdog thread.
+    // A threshold of 0 stops the watchdog. Must be called on the UI thread.
+    void set_stall_watchdog(int threshold_ms,
+                            detail::stall_watchdog::report_t on_report)
+    {
+      if (threshold_ms <= 0)
       {
-        MSG msg;
-        BOOL res;
-        while ((res = GetMessage(&msg, nullptr, 0, 0)) != -1)
-        {
-          if (msg.hwnd)
-          {
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
-            continue;
+        watchdog.stop();
+        return;
+      }
+      watchdog.start(std::chrono::milliseconds(threshold_ms),
+                     std::move(on_report), [this](std::function<void()> f)
+                     { browser_engine::dispatch(std::move(f)); });
+    }
+
+    detail::stall_watchdog::counters stall_stats() { return watchdog.stats(); }
+
+    // Timing of the latest navigation. Safe to call from any thread.
+    detail::navigation_timing timing()
+    {
+      std::lock_guard<std::mutex> lock(timing_mutex);
+      return current_timing;
+    }
+
+    // Calls on_timing on the UI thread with each milestone the latest
+    // navigation reaches, see the WEBVIEW_NAVIGATION_* constants.
+    void set_navigation_timing_callback(detail::timing_fn_t on_timing)
+    {
+      std::lock_guard<std::mutex> lock(timing_mutex);
+      timing_callback = std::move(on_timing);
+    }
+
+    // Returns true if the call is no longer pending, i.e. JS has cancelled it
+    // or it has already been resolved. Safe to call from any thread.
+    bool is_cancelled(const std::string &seq)
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex);
+      return pending.count(seq) == 0;
+    }
+
+  private:
+    // The RPC dispatcher shared by all bindings. Every binding stub is a thin
+    // wrapper around RPC.call().
+    static constexpr const char *dispatcher_js = R""((function() {
+      var RPC = window._rpc = (window._rpc || {nextSeq: 1});
+      if (RPC.call) {
+        return;
+      }
+      // Sent back with every result, so that a result queued for the
+      // previous document is not taken for a call of this one.
+      RPC.page = Math.random().toString(36).slice(2);
+      RPC.timeouts = RPC.timeouts || {};
+      RPC.call = function(name, params, options) {
+        options = options || {};
+        var timeout = options.timeout !== undefined ? options.timeout
+                                                    : RPC.timeouts[name];
+        var signal = options.signal;
+        if (signal && signal.aborted) {
+          var aborted = Promise.reject(signal.reason || new Error('Aborted'));
+          aborted.cancel = aborted.ack = function() {};
+          return aborted;
+        }
+        var seq = RPC.nextSeq++;
+        var stop, ack;
+        var promise = new Promise(function(resolve, reject) {
+          var call = RPC[seq] = {};
+          var onabort = function() {
+            cancel('abort', signal.reason || new Error('Aborted'));
+          };
+          var done = function() {
+            delete RPC[seq];
+            clearTimeout(call.timer);
+            if (signal) {
+              signal.removeEventListener('abort', onabort);
+            }
+          };
+          // Rejects the call and tells the native side to stop working on it.
+          var cancel = function(reason, error) {
+            done();
+            window.external.invoke(JSON.stringify({cancel: reason, id: seq}));
+            reject(error);
+          };
+          call.resolve = function(value) {
+            done();
+            resolve(value);
+          };
+          call.reject = function(error) {
+            done();
+            reject(error);
+          };
+          // Streaming calls receive chunks before the final result and can
+          // be cancelled by their consumer.
+          call.chunk = options.onchunk || function() {
+            ack(1);
+          };
+          stop = function() {
+            if (RPC[seq] === call) {
+              cancel('return', new Error('Cancelled'));
+            }
+          };
+          // Lets the native side send more chunks once they are consumed.
+          ack = function(n) {
+            if (RPC[seq] === call) {
+              window.external.invoke(JSON.stringify({credit: n, id: seq}));
+            }
+          };
+          if (timeout > 0) {
+            call.timer = setTimeout(function() {
+              cancel('timeout', new Error('RPC timeout: ' + name));
+            }, timeout);
           }
-          if (msg.message == WM_APP)
-          {
-            auto f = (dispatch_fn_t *)(msg.lParam);
-            (*f)();
-            delete f;
+          if (signal) {
+            signal.addEventListener('abort', onabort);
           }
-          else if (msg.message == WM_QUIT)
-          {
-            if (on_destroy)
-            {
-              on_destroy();
+        });
+        window.external.invoke(JSON.stringify({
+          id: seq,
+          method: name,
+          params: params,
+        }));
+        // Per call, so that options objects can be shared between calls.
+        promise.cancel = stop;
+        promise.ack = ack;
+        return promise;
+      };
+      RPC.settle = function(page, seq, status, result) {
+        var call = page === RPC.page && RPC[seq];
+        if (call) {
+          status === 0 ? call.resolve(result) : call.reject(result);
+        }
+      };
+      RPC.chunk = function(page, seq, value) {
+        var call = page === RPC.page && RPC[seq];
+        if (call && call.chunk) {
+          call.chunk(value);
+        }
+      };
+      // Calls a binding whose native side answers with a series of chunks.
+      // Returns an async iterator over the chunks; the call's final result
+      // ends the iteration, an error makes it throw.
+      RPC.stream = function(name, params, options) {
+        var items = [];
+        var waiters = [];
+        var end = null;
+        var opts = Object.assign({}, options);
+        var call;
+        var push = function(item) {
+          if (waiters.length) {
+            waiters.shift().resolve(item);
+            call.ack(1);
+          } else {
+            items.push(item);
+          }
+        };
+        var finish = function(result) {
+          end = end || result;
+          waiters.splice(0).forEach(function(waiter) {
+            end.error ? waiter.reject(end.error) : waiter.resolve(end);
+          });
+        };
+        opts.onchunk = function(value) {
+          push({value: value, done: false});
+        };
+        call = RPC.call(name, params, opts);
+        call.then(function(value) {
+          finish({value: value, done: true});
+        }, function(error) {
+          finish({error: error});
+        });
+        var iterator = {
+          next: function() {
+            if (items.length) {
+              call.ack(1);
+              return Promise.resolve(items.shift());
             }
-            return;
+            if (end) {
+              return end.error ? Promise.reject(end.error) : Promise.resolve(end);
+            }
+            return new Promise(function(resolve, reject) {
+              waiters.push({resolve: resolve, reject: reject});
+            });
+          },
+          // Called when the consumer stops early, e.g. break in for await.
+          return: function(value) {
+            items = [];
+            finish({value: value, done: true});
+            call.cancel();
+            return Promise.resolve({value: value, done: true});
+          },
+        };
+        iterator[Symbol.asyncIterator] = function() {
+          return iterator;
+        };
+        return iterator;
+      };
+      RPC.channels = {};
+      // Starts receiving the messages native code posts to a channel. The
+      // native side is granted a credit for every message once fn has
+      // handled it, or once the promise fn returns has settled.
+      RPC.listen = function(name, fn) {
+        RPC.channels[name] = fn;
+        window.external.invoke(JSON.stringify({credit: -1, channel: name}));
+      };
+      RPC.push = function(name, messages) {
+        var fn = RPC.channels[name];
+        var handled = messages.map(function(message) {
+          try {
+            return Promise.resolve(fn && fn(message)).catch(console.error);
+          } catch (e) {
+            console.error(e);
           }
+        });
+        Promise.all(handled).then(function() {
+          window.external.invoke(
+              JSON.stringify({credit: messages.length, channel: name}));
+        });
+      };
+      RPC.topics = {};
+      // Subscribes to events native code emits for the topic. The native side
+      // only serializes events of topics that have subscribers. Returns a
+      // function that removes the subscription.
+      RPC.subscribe = function(topic, fn) {
+        var list = RPC.topics[topic] || (RPC.topics[topic] = []);
+        list.push(fn);
+        if (list.length === 1) {
+          window.external.invoke(
+              JSON.stringify({event: 'subscribe', topic: topic}));
         }
-      }
-      void run1()
-      {
-        MSG msg;
-        while (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE))
-        {
-          if (msg.hwnd)
-          {
-            TranslateMessage(&msg);
-            DispatchMessage(&msg);
+        return function() {
+          var i = list.indexOf(fn);
+          if (i < 0) {
+            return;
           }
-          if (msg.message == WM_APP)
-          {
-            auto f = (dispatch_fn_t *)(msg.lParam);
-            (*f)();
-            delete f;
+          list.splice(i, 1);
+          if (!list.length && RPC.topics[topic] === list) {
+            delete RPC.topics[topic];
+            window.external.invoke(
+                JSON.stringify({event: 'unsubscribe', topic: topic}));
           }
-          else if (msg.message == WM_QUIT)
-          {
-            if (on_destroy)
-            {
-              on_destroy();
+        };
+      };
+      RPC.emit = function(events) {
+        events.forEach(function(event) {
+          (RPC.topics[event[0]] || []).slice().forEach(function(fn) {
+            try {
+              fn(event[1]);
+            } catch (e) {
+              console.error(e);
             }
-            return;
-          }
+          });
+        });
+      };
+      // A new document starts without subscriptions.
+      window.external.invoke(JSON.stringify({event: 'reset', page: RPC.page}));
+      RPC.stub = function(name, options) {
+        var stub = function() {
+          return RPC.call(name, Array.prototype.slice.call(arguments), options);
+        };
+        // Calls with per-call options, e.g.
+        // fn.withOptions({timeout: 1000, signal: controller.signal})(args...)
+        stub.withOptions = function(options) {
+          return RPC.stub(name, options);
+        };
+        // Streaming calls, e.g. for await (const rows of fn.stream(args...))
+        stub.stream = function() {
+          return RPC.stream(name, Array.prototype.slice.call(arguments), options);
+        };
+        return stub;
+      };
+      RPC.bind = function(names) {
+        names.forEach(function(name) {
+          window[name] = RPC.stub(name);
+        });
+      };
+      RPC.namespace = function(ns) {
+        var stubs = {};
+        window[ns] = new Proxy({}, {
+          get: function(target, name) {
+            // Keep the namespace from looking like a thenable.
+            if (typeof name !== 'string' || name === 'then') {
+              return undefined;
+            }
+            return stubs[name] || (stubs[name] = RPC.stub(name));
+          },
+        });
+      };
+    })())"";
+
+    // Reports the milestones of the document native code cannot see. Only
+    // the top frame reports, and each milestone with how long ago it was
+    // reached, so the time spent reaching native code is not counted, and
+    // how long ago the navigation started.
+    static constexpr const char *timing_js = R""((function() {
+      if (window.top !== window || window._webviewTiming) {
+        return;
+      }
+      window._webviewTiming = true;
+      var report = function(phase, at) {
+        var now = performance.now();
+        var ago = at === undefined ? 0 : Math.max(0, now - at);
+        window.external.invoke(JSON.stringify({
+          event: 'timing',
+          phase: phase,
+          url: location.href,
+          ago: ago,
+          origin: now,
+        }));
+      };
+      report('committed');
+      document.addEventListener('DOMContentLoaded', function() {
+        report('dom-content-loaded');
+      });
+      window.addEventListener('load', function() {
+        report('load-finished');
+      });
+      var painted = false;
+      var paint = function(at) {
+        if (!painted) {
+          painted = true;
+          report('first-paint', at);
         }
+      };
+      var types = window.PerformanceObserver &&
+                  PerformanceObserver.supportedEntryTypes || [];
+      if (types.indexOf('paint') >= 0) {
+        new PerformanceObserver(function(list) {
+          list.getEntries().forEach(function(entry) {
+            paint(entry.startTime);
+          });
+        }).observe({type: 'paint', buffered: true});
+      } else {
+        // The frame after the first one with content has been painted.
+        document.addEventListener('DOMContentLoaded', function() {
+          requestAnimationFrame(function() {
+            requestAnimationFrame(function() {
+              paint();
+            });
+          });
+        });
       }
+    })())"";
 
-      void set_on_destroy(std::function<void()> f) { on_destroy = f; }
-      void *window() { return (void *)m_window; }
-      void terminate() { PostQuitMessage(0); }
-      void dispatch(dispatch_fn_t f)
-      {
-        PostThreadMessage(m_main_thread, WM_APP, 0, (LPARAM) new dispatch_fn_t(f));
+    // Applies the changes hot_reload reports for a host.
+    static constexpr const char *hot_client_js = R""((function() {
+      if (window._webviewHot) {
+        return;
       }
+      var hot = window._webviewHot = {version: 0, accepted: {}};
+      var pathOf = function(url) {
+        return decodeURIComponent(new URL(url, location.href).pathname);
+      };
+      var fresh = function(url) {
+        var u = new URL(url, location.href);
+        u.searchParams.set('webview-hot', hot.version);
+        return u.href;
+      };
+      // Accepts updates of the module at url, fn receives the namespace of
+      // the new module. Modules that do not accept updates reload the page.
+      hot.accept = function(url, fn) {
+        hot.accepted[pathOf(url)] = fn;
+      };
+      hot.apply = function(host, paths) {
+        hot.version++;
+        var reload = false;
+        paths.forEach(function(path) {
+          if (/\.css$/i.test(path)) {
+            var links = document.querySelectorAll('link[rel~="stylesheet"]');
+            var swapped = false;
+            Array.prototype.forEach.call(links, function(link) {
+              var u = new URL(link.href, location.href);
+              if (link.webviewHotStale || u.host !== host ||
+                  pathOf(u.href) !== path) {
+                return;
+              }
+              swapped = true;
+              // The old sheet stays until the new one has loaded, so the
+              // page never shows unstyled.
+              link.webviewHotStale = true;
+              var next = link.cloneNode();
+              next.href = fresh(link.href);
+              next.onload = next.onerror = function() {
+                link.remove();
+              };
+              link.after(next);
+            });
+            // Sheets that are not linked, ex: through @import, need a reload.
+            reload = reload || !swapped;
+          } else if (/\.m?js$/i.test(path) && hot.accepted[path]) {
+            var url = location.protocol + '//' + host + path;
+            import(fresh(url)).then(hot.accepted[path], function(e) {
+              console.error(e);
+              location.reload();
+            });
+          } else {
+            reload = true;
+          }
+        });
+        if (reload) {
+          location.reload();
+        }
+      };
+    })())"";
 
-      void set_title(const std::string &title)
-      {
-        SetWindowTextW(m_window, widen_string(title).c_str());
-      }
+    static constexpr const char *dispatcher_script_id = "webview:rpc";
+    static constexpr const char *hot_script_id = "webview:hot";
+    static constexpr const char *timing_script_id = "webview:timing";
+    static constexpr const char *binding_script_id = "webview:bindings";
 
-      void set_size(int width, int height, int hints)
+    static std::string json_names(const std::vector<std::string> &names)
+    {
+      std::string js = "[";
+      for (const auto &name : names)
       {
-        auto style = GetWindowLong(m_window, GWL_STYLE);
-        if (hints == WEBVIEW_HINT_FIXED)
-        {
-          style &= ~(WS_THICKFRAME | WS_MAXIMIZEBOX);
-        }
-        else
-        {
-          style |= (WS_THICKFRAME | WS_MAXIMIZEBOX);
-        }
-        SetWindowLong(m_window, GWL_STYLE, style);
-
-        if (hints == WEBVIEW_HINT_MAX)
-        {
-          m_maxsz.x = width;
-          m_maxsz.y = height;
-        }
-        else if (hints == WEBVIEW_HINT_MIN)
-        {
-          m_minsz.x = width;
-          m_minsz.y = height;
-        }
-        else
+        if (js.size() > 1)
         {
-          RECT r;
-          r.left = r.top = 0;
-          r.right = width;
-          r.bottom = height;
-          AdjustWindowRect(&r, WS_OVERLAPPEDWINDOW, 0);
-          SetWindowPos(
-              m_window, nullptr, r.left, r.top, r.right - r.left, r.bottom - r.top,
-              SWP_NOZORDER | SWP_NOACTIVATE | SWP_NOMOVE | SWP_FRAMECHANGED);
-          resize(m_window);
+          js += ",";
         }
+        js += detail::json_escape(name);
       }
+      return js + "]";
+    }
 
-      void navigate(const std::string &url)
+    // Rebuilds the init script that recreates the bindings in new documents.
+    void update_binding_script()
+    {
+      std::string timeouts;
+      for (const auto &binding : bindings)
       {
-        auto wurl = widen_string(url);
-        m_webview->Navigate(wurl.c_str());
+        if (binding.second.timeout > 0)
+        {
+          timeouts += (timeouts.empty() ? "" : ",") +
+                      detail::json_escape(binding.first) + ":" +
+                      std::to_string(binding.second.timeout);
+        }
       }
-
-      void init(const std::string &js)
+      auto js = "window._rpc.timeouts={" + timeouts + "};";
+      if (!binding_namespace.empty())
       {
-        auto wjs = widen_string(js);
-        m_webview->AddScriptToExecuteOnDocumentCreated(wjs.c_str(), nullptr);
+        set_init_script(binding_script_id,
+                        js + "window._rpc.namespace(" +
+                            detail::json_escape(binding_namespace) + ")");
+        return;
       }
-
-      void eval(const std::string &js)
+      if (bindings.empty())
       {
-        auto wjs = widen_string(js);
-        m_webview->ExecuteScript(wjs.c_str(), nullptr);
+        remove_init_script(binding_script_id);
+        return;
       }
-
-      void set_html(const std::string &html)
+      std::vector<std::string> names;
+      names.reserve(bindings.size());
+      for (const auto &binding : bindings)
       {
-        m_webview->NavigateToString(widen_string(html).c_str());
+        names.push_back(binding.first);
       }
+      set_init_script(binding_script_id,
+                      js + "window._rpc.bind(" + json_names(names) + ")");
+    }
 
-      bool set_virtual_host_name(const std::string &url, const std::string &folder, const int option)
-      {
-        static auto wstring_conv = [](const std::string &input_string, std::wstring &output_string) -> bool
-        {
-          const auto size = MultiByteToWideChar(CP_UTF8, 0, input_string.data(), input_string.length(), nullptr, 0);
-
-          if (size == 0)
-          {
-            return false;
-          }
-
-          output_string = std::wstring(size, '\0');
-
-          const auto result = MultiByteToWideChar(CP_UTF8, 0, input_string.data(), input_string.length(), output_string.data(), size);
-
-          if (result <= 0)
-          {
-            return false;
-          }
+    static void copy_stats(const detail::binding_stats &stats,
+                           webview_binding_stats_t &out)
+    {
+      out.calls = stats.calls.load(std::memory_order_relaxed);
+      out.errors = stats.errors.load(std::memory_order_relaxed);
+      out.cancelled = stats.cancelled.load(std::memory_order_relaxed);
+      out.bytes_in = stats.bytes_in.load(std::memory_order_relaxed);
+      out.bytes_out = stats.bytes_out.load(std::memory_order_relaxed);
+      out.in_flight = stats.in_flight.load(std::memory_order_relaxed);
+      stats.latency.snapshot(out.latency_histogram, &out.latency_total_us);
+    }
 
-          return true;
-        };
+    std::shared_ptr<detail::push_channel> find_channel(const std::string &name)
+    {
+      std::lock_guard<std::mutex> lock(channels_mutex);
+      auto found = channels.find(name);
+      return found != channels.end() ? found->second : nullptr;
+    }
 
-        std::wstring w_url;
-        std::wstring w_folder;
+    // Hands as many queued messages to the page as the channel has credits.
+    void pump(const std::string &name,
+              const std::shared_ptr<detail::push_channel> &channel)
+    {
+      channel->take([&](const std::string &batch)
+                    {
+        auto js = "window._rpc.push(" + detail::json_escape(name) + "," +
+                  batch + ")";
+        dispatch([js = std::move(js), this]()
+                 { eval(js); },
+                 "push"); });
+    }
 
-        if (wstring_conv(url, w_url) && wstring_conv(folder, w_folder))
+    // Handles {"credit":n,"channel":name} messages sent by the dispatcher,
+    // and {"credit":n,"id":seq} for the chunks of a streaming call.
+    void on_credit(const std::string &msg)
+    {
+      auto js_seq = detail::json_parse(msg, "id", 0);
+      if (!js_seq.empty())
+      {
+        auto credits = std::atoi(detail::json_parse(msg, "credit", 0).c_str());
         {
-          const auto hResult = static_cast<ICoreWebView2_3 *>(m_webview)->SetVirtualHostNameToFolderMapping(
-              w_url.data(),
-              w_folder.data(),
-              static_cast<COREWEBVIEW2_HOST_RESOURCE_ACCESS_KIND>(option));
-
-          if (hResult != S_OK)
+          std::lock_guard<std::mutex> lock(pending_mutex);
+          auto found = pending.find(std::to_string(document) + ":" + js_seq);
+          if (found == pending.end() || credits <= 0)
           {
-            return false;
+            return;
           }
-
-          return true;
+          auto &in_flight = found->second.chunks_in_flight;
+          in_flight -= std::min(static_cast<unsigned int>(credits), in_flight);
         }
-
-        return false;
+        pending_space.notify_all();
+        return;
       }
-
-    private:
-      bool embed(HWND wnd, bool debug, msg_cb_t cb)
+      auto name = detail::json_parse(msg, "channel", 0);
+      auto channel = find_channel(name);
+      if (!channel)
       {
-        std::atomic_flag flag = ATOMIC_FLAG_INIT;
-        flag.test_and_set();
-
-        wchar_t currentExePath[MAX_PATH];
-        GetModuleFileNameW(nullptr, currentExePath, MAX_PATH);
-        wchar_t *currentExeName = PathFindFileNameW(currentExePath);
+        return;
+      }
+      channel->grant(std::atoi(detail::json_parse(msg, "credit", 0).c_str()));
+      pump(name, channel);
+    }
 
-        wchar_t dataPath[MAX_PATH];
-        if (!SUCCEEDED(
-                SHGetFolderPathW(nullptr, CSIDL_APPDATA, nullptr, 0, dataPath)))
+    // Delivers all pending events in a single evaluation.
+    void flush_events()
+    {
+      std::string js;
+      {
+        std::lock_guard<std::mutex> lock(events_mutex);
+        events_flush_scheduled = false;
+        for (const auto &topic : pending_topics)
         {
-          return false;
+          auto found = pending_events.find(topic);
+          if (found == pending_events.end())
+          {
+            continue;
+          }
+          js += (js.empty() ? "[" : ",");
+          js += "[" + detail::json_escape(topic) + "," + found->second + "]";
         }
-        wchar_t userDataFolder[MAX_PATH];
-        PathCombineW(userDataFolder, dataPath, currentExeName);
-
-        m_com_handler = new webview2_com_handler(
-            wnd, cb,
-            [&](ICoreWebView2Controller *controller, ICoreWebView2 *webview)
-            {
-              if (!controller || !webview)
-              {
-                flag.clear();
-                return;
-              }
-              controller->AddRef();
-              webview->AddRef();
-              m_controller = controller;
-              m_webview = webview;
-              flag.clear();
-            });
+        pending_topics.clear();
+        pending_events.clear();
+      }
+      if (!js.empty())
+      {
+        eval("window._rpc.emit(" + js + "])");
+      }
+    }
 
-        m_com_handler->set_attempt_handler([&]
-                                           { return m_webview2_loader.create_environment_with_options(
-                                                 nullptr, userDataFolder, nullptr, m_com_handler); });
-        m_com_handler->try_create_environment();
+    // Handles {"event":"subscribe"|"unsubscribe","topic":topic} and
+    // {"event":"reset","page":token} messages sent by the dispatcher.
+    void on_event(const std::string &msg)
+    {
+      auto event = detail::json_parse(msg, "event", 0);
+      if (event == "timing")
+      {
+        on_timing(msg);
+        return;
+      }
+      if (event == "reset")
+      {
+        cancel_document(detail::json_parse(msg, "page", 0));
+      }
+      std::lock_guard<std::mutex> lock(events_mutex);
+      if (event == "reset")
+      {
+        subscribed_topics.clear();
+        pending_events.clear();
+        return;
+      }
+      auto topic = detail::json_parse(msg, "topic", 0);
+      if (event == "subscribe")
+      {
+        subscribed_topics.insert(topic);
+      }
+      else if (event == "unsubscribe")
+      {
+        subscribed_topics.erase(topic);
+        pending_events.erase(topic);
+      }
+    }
 
-        MSG msg = {};
-        while (flag.test_and_set() && GetMessage(&msg, nullptr, 0, 0))
-        {
-          TranslateMessage(&msg);
-          DispatchMessage(&msg);
-        }
-        if (!m_controller || !m_webview)
-        {
-          return false;
-        }
-        ICoreWebView2Settings *settings = nullptr;
-        auto res = m_webview->get_Settings(&settings);
-        if (res != S_OK)
-        {
-          return false;
-        }
-        res = settings->put_AreDevToolsEnabled(debug ? TRUE : FALSE);
-        if (res != S_OK)
+    // Starts a new document. The dispatcher of the new page numbers its calls
+    // from 1 again, so calls still pending from the previous page can never
+    // be settled and are cancelled instead. Results of the previous page that
+    // are still queued carry its token, which the new page ignores.
+    void cancel_document(const std::string &new_page)
+    {
+      std::map<std::string, pending_call> abandoned;
+      {
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        ++document;
+        page = new_page;
+        abandoned.swap(pending);
+      }
+      pending_space.notify_all();
+      for (auto &entry : abandoned)
+      {
+        auto &call = entry.second;
+        call.stats->cancelled.fetch_add(1, std::memory_order_relaxed);
+        call.stats->in_flight.fetch_sub(1, std::memory_order_relaxed);
+        auto binding = bindings.find(call.name);
+        if (binding != bindings.end() && binding->second.cancel)
         {
-          return false;
+          binding->second.cancel(entry.first, binding->second.arg);
         }
-        init("window.external={invoke:s=>window.chrome.webview.postMessage(s)}");
-        return true;
       }
+    }
 
-      void resize(HWND wnd)
+    // Handles {"cancel":reason,"id":seq} messages sent by the dispatcher.
+    void on_cancel(const std::string &msg)
+    {
+      auto js_seq = detail::json_parse(msg, "id", 0);
+      std::string seq;
+      std::string name;
       {
-        if (m_controller == nullptr)
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        seq = std::to_string(document) + ":" + js_seq;
+        auto found = pending.find(seq);
+        if (found == pending.end())
         {
           return;
         }
-        RECT bounds;
-        GetClientRect(wnd, &bounds);
-        m_controller->put_Bounds(bounds);
+        name = found->second.name;
+        found->second.stats->cancelled.fetch_add(1, std::memory_order_relaxed);
+        found->second.stats->in_flight.fetch_sub(1, std::memory_order_relaxed);
+        pending.erase(found);
+      }
+      pending_space.notify_all();
+      auto binding = bindings.find(name);
+      if (binding != bindings.end() && binding->second.cancel)
+      {
+        binding->second.cancel(seq, binding->second.arg);
       }
+    }
 
-      bool is_webview2_available() const noexcept
+    void on_message(const std::string &msg)
+    {
+      WEBVIEW_PROBE2(message, this, msg.size());
+      // JSON.stringify keeps the key order, so a prefix check is enough to
+      // tell cancellations apart without scanning the whole message.
+      static const std::string cancel_prefix = "{\"cancel\":";
+      static const std::string credit_prefix = "{\"credit\":";
+      static const std::string event_prefix = "{\"event\":";
+      if (msg.compare(0, cancel_prefix.size(), cancel_prefix) == 0)
       {
-        LPWSTR version_info = nullptr;
-        auto res = m_webview2_loader.get_available_browser_version_string(
-            nullptr, &version_info);
-        // The result will be equal to HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND)
-        // if the WebView2 runtime is not installed.
-        auto ok = SUCCEEDED(res) && version_info;
-        if (version_info)
+        on_cancel(msg);
+        return;
+      }
+      if (msg.compare(0, credit_prefix.size(), credit_prefix) == 0)
+      {
+        on_credit(msg);
+        return;
+      }
+      if (msg.compare(0, event_prefix.size(), event_prefix) == 0)
+      {
+        on_event(msg);
+        return;
+      }
+      detail::trace_span span("on_message", "bytes", msg.size());
+      auto start = std::chrono::steady_clock::now();
+      auto js_seq = detail::json_parse(msg, "id", 0);
+      auto name = detail::json_parse(msg, "method", 0);
+      auto args = detail::json_parse(msg, "params", 0);
+      auto found = bindings.find(name);
+      auto stats = found != bindings.end() ? found->second.stats : unknown_stats;
+      stats->calls.fetch_add(1, std::memory_order_relaxed);
+      stats->bytes_in.fetch_add(msg.size(), std::memory_order_relaxed);
+      // Native code sees the JS seq prefixed with the document, so that a
+      // call from a previous page is never confused with one from this page.
+      std::string seq;
+      if (!js_seq.empty())
+      {
+        stats->in_flight.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(pending_mutex);
+        seq = std::to_string(document) + ":" + js_seq;
+        pending.emplace(seq, pending_call{name, js_seq, page, start, stats});
+      }
+      if (found == bindings.end())
+      {
+        // Namespace stubs exist for any name, so calls to names that are not
+        // bound must be rejected rather than left pending forever.
+        if (!seq.empty())
         {
-          CoTaskMemFree(version_info);
+          resolve(seq, 1,
+                  detail::json_escape("Binding not found: " + name));
         }
-        return ok;
+        return;
       }
+      const auto &context = found->second;
+      detail::trace_span call_span("binding", name);
+      auto watched = watchdog.watch("binding", name.c_str());
+      WEBVIEW_PROBE4(callback__entry, this, seq.c_str(), name.c_str(),
+                     args.size());
+      context.callback(seq, args, context.arg);
+      WEBVIEW_PROBE2(callback__return, this, seq.c_str());
+    }
 
-      virtual void on_message(const std::string &msg) = 0;
-
-      // The app is expected to call CoInitializeEx before
-      // CreateCoreWebView2EnvironmentWithOptions.
-      // Source: https://docs.microsoft.com/en-us/microsoft-edge/webview2/reference/win32/webview2-idl#createcorewebview2environmentwithoptions
-      com_init_wrapper m_com_init{COINIT_APARTMENTTHREADED};
-      HWND m_window = nullptr;
-      POINT m_minsz = POINT{0, 0};
-      POINT m_maxsz = POINT{0, 0};
-      DWORD m_main_thread = GetCurrentThreadId();
-      ICoreWebView2 *m_webview = nullptr;
-      ICoreWebView2Controller *m_controller = nullptr;
-      webview2_com_handler *m_com_handler = nullptr;
-      mswebview2::loader m_webview2_loader;
-
-      std::function<void()> on_destroy;
-    };
-
-  } // namespace detail
-
-  using browser_engine = detail::win32_edge_engine;
-
-} // namespace webview
-
-#endif /* WEBVIEW_GTK, WEBVIEW_COCOA, WEBVIEW_EDGE */
-
-namespace webview
-{
+    // Starts recording a navigation that native code asked for. The
+    // engine's own start event, if it has one, is then not a new navigation.
+    void begin_navigation(const std::string &url)
+    {
+      detail::timing_fn_t callback;
+      detail::navigation_timing started;
+      {
+        std::lock_guard<std::mutex> lock(timing_mutex);
+        restart_timing(url, std::chrono::steady_clock::now());
+        timing_requested = true;
+        callback = timing_callback;
+        started = current_timing;
+      }
+      if (callback)
+      {
+        callback(WEBVIEW_NAVIGATION_STARTED, started);
+      }
+    }
 
-  class webview : public browser_engine
-  {
-  public:
-    webview(bool debug = false, void *wnd = nullptr)
-        : browser_engine(debug, wnd) {}
+    void restart_timing(const std::string &url,
+                        std::chrono::steady_clock::time_point start)
+    {
+      auto id = current_timing.id + 1;
+      current_timing = detail::navigation_timing();
+      current_timing.id = id;
+      current_timing.url = url;
+      timing_start = start;
+    }
 
-    void navigate(const std::string &url)
+    // Handles {"event":"timing","phase":phase} messages, which the engine
+    // sends for its load events and the timing script for the milestones of
+    // the document. The script also sends how many milliseconds ago the
+    // milestone was reached, and how long ago the navigation of the document
+    // started.
+    void on_timing(const std::string &msg)
     {
-      if (url.empty())
+      auto now = std::chrono::steady_clock::now();
+      auto phase = detail::json_parse(msg, "phase", 0);
+      auto url = detail::json_parse(msg, "url", 0);
+      auto ago = std::chrono::duration<double, std::milli>(
+          std::atof(detail::json_parse(msg, "ago", 0).c_str()));
+      auto origin = std::chrono::duration<double, std::milli>(
+          std::atof(detail::json_parse(msg, "origin", 0).c_str()));
+      int milestone = -1;
+      bool restarted = false;
+      detail::timing_fn_t callback;
+      detail::navigation_timing started, reached;
       {
-        browser_engine::navigate("about:blank");
-        return;
+        std::lock_guard<std::mutex> lock(timing_mutex);
+        if (phase == "started")
+        {
+          if (!timing_requested)
+          {
+            restart_timing(url, now);
+            milestone = WEBVIEW_NAVIGATION_STARTED;
+          }
+          else if (!url.empty())
+          {
+            current_timing.url = url;
+          }
+          timing_requested = false;
+        }
+        else
+        {
+          // A document that reports its start after the previous one has
+          // loaded comes from a navigation the engine did not report, which
+          // started at the time origin of the new document.
+          if (phase == "committed" && !timing_requested &&
+              current_timing.dom_content_loaded_ms >= 0)
+          {
+            restart_timing(url, std::chrono::time_point_cast<
+                                    std::chrono::steady_clock::duration>(
+                                    now - origin));
+            restarted = true;
+            started = current_timing;
+          }
+          timing_requested = false;
+          auto elapsed =
+              std::chrono::duration<double, std::milli>(now - timing_start) -
+              ago;
+          auto ms = std::max(0.0, elapsed.count());
+          double *field = nullptr;
+          if (phase == "committed")
+          {
+            field = &current_timing.committed_ms;
+            milestone = WEBVIEW_NAVIGATION_COMMITTED;
+          }
+          else if (phase == "dom-content-loaded")
+          {
+            field = &current_timing.dom_content_loaded_ms;
+            milestone = WEBVIEW_NAVIGATION_DOM_CONTENT_LOADED;
+          }
+          else if (phase == "load-finished")
+          {
+            field = &current_timing.load_finished_ms;
+            milestone = WEBVIEW_NAVIGATION_LOAD_FINISHED;
+          }
+          else if (phase == "first-paint")
+          {
+            field = &current_timing.first_paint_ms;
+            milestone = WEBVIEW_NAVIGATION_FIRST_PAINT;
+          }
+          // The engine and the script both report some milestones, the
+          // first report wins.
+          if (field == nullptr || (*field >= 0 && !restarted))
+          {
+            return;
+          }
+          *field = ms;
+          if (current_timing.url.empty() && !url.empty())
+          {
+            current_timing.url = url;
+          }
+        }
+        callback = timing_callback;
+        reached = current_timing;
+      }
+      if (callback && restarted)
+      {
+        callback(WEBVIEW_NAVIGATION_STARTED, started);
+      }
+      if (callback && milestone >= 0)
+      {
+        callback(milestone, reached);
       }
-      browser_engine::navigate(url);
     }
 
-    using binding_t = std::function<void(std::string, std::string, void *)>;
-    class binding_ctx_t
+    std::map<std::string, binding_ctx_t> bindings;
+    // The counters of the bindings, which binding_stats reads from other
+    // threads while bindings changes on the UI thread.
+    std::map<std::string, std::shared_ptr<detail::binding_stats>> stats_by_name;
+    std::mutex stats_mutex;
+    std::string binding_namespace;
+    std::atomic<unsigned long long> dispatch_seq{0};
+    detail::stall_watchdog watchdog;
+    std::shared_ptr<detail::dispatch_stats> queue_stats =
+        std::make_shared<detail::dispatch_stats>();
+    // Counters of the calls to names that are not bound.
+    std::shared_ptr<detail::binding_stats> unknown_stats =
+        std::make_shared<detail::binding_stats>();
+    struct pending_call
     {
-    public:
-      binding_ctx_t(binding_t callback, void *arg)
-          : callback(callback), arg(arg) {}
-      // This function is called upon execution of the bound JS function
-      binding_t callback;
-      // This user-supplied argument is passed to the callback
-      void *arg;
+      std::string name;
+      std::string js_seq;
+      // The token of the page that made the call.
+      std::string page;
+      std::chrono::steady_clock::time_point start;
+      std::shared_ptr<detail::binding_stats> stats;
+      // Chunks sent that the page has not granted a credit for yet.
+      unsigned int chunks_in_flight = 0;
     };
+    // Calls that have been received but not resolved or cancelled yet, by seq.
+    std::map<std::string, pending_call> pending;
+    // Counts the pages that have loaded the dispatcher, guarded by
+    // pending_mutex.
+    unsigned long long document = 0;
+    // The token the dispatcher of the current page sent with its reset,
+    // guarded by pending_mutex.
+    std::string page;
+    // Set once the webview is being destroyed, and the number of threads
+    // waiting for credits in resolve_chunk, both guarded by pending_mutex.
+    bool closed = false;
+    unsigned int chunk_waiters = 0;
+    std::mutex pending_mutex;
+    // Signalled when a call ends or gets credits for more chunks.
+    std::condition_variable pending_space;
+    // The thread that created the webview and runs its loop.
+    std::thread::id main_thread = std::this_thread::get_id();
+    std::map<std::string, std::shared_ptr<detail::push_channel>> channels;
+    std::mutex channels_mutex;
+    // Topics the current page has subscribed to, and the latest JSON of the
+    // events waiting to be flushed in the order they were first emitted.
+    std::set<std::string> subscribed_topics;
+    std::unordered_map<std::string, std::string> pending_events;
+    std::vector<std::string> pending_topics;
+    bool events_flush_scheduled = false;
+    std::mutex events_mutex;
+    // The latest navigation, and whether native code started it and the
+    // engine has not reported its start yet.
+    detail::navigation_timing current_timing;
+    std::chrono::steady_clock::time_point timing_start;
+    bool timing_requested = false;
+    detail::timing_fn_t timing_callback;
+    std::mutex timing_mutex;
+#if defined(__linux__) && (defined(WEBVIEW_GTK) || defined(WEBVIEW_HEADLESS))
+    // Folders watched by hot_reload, by host.
+    std::map<std::string, std::unique_ptr<detail::folder_watcher>> hot_watchers;
+#endif
+  };
 
-    using sync_binding_t = std::function<std::string(std::string)>;
-
-    // Synchronous bind
-    void bind(const std::string &name, sync_binding_t fn)
+  // Keeps hidden webviews ready, so that opening a window does not wait for
+  // the engine to create its view and start its web process. Webviews are
+  // created one at a time when the main loop is idle, and each is prepared
+  // with the bindings and init scripts every window needs. All functions
+  // must be called on the UI thread.
+  class webview_pool
+  {
+  public:
+    using prepare_fn_t = std::function<void(webview &)>;
+    // Called with the address of a webview that has been destroyed, to
+    // release what was kept for it. It must not be used.
+    using discard_fn_t = std::function<void(webview *)>;
+
+    // The pool of the process. Never destroyed, set its size to 0 to
+    // destroy the idle webviews.
+    static webview_pool &shared()
     {
-      auto wrapper = [this, fn](const std::string &seq, const std::string &req,
-                                void * /*arg*/)
-      { resolve(seq, 0, fn(req)); };
-      bind(name, wrapper, nullptr);
+      static auto pool = new webview_pool();
+      return *pool;
     }
 
-    // Asynchronous bind
-    void bind(const std::string &name, binding_t fn, void *arg)
+    // Keeps size webviews ready. prepare is called with every new webview,
+    // discard after every idle webview the pool destroys when it shrinks.
+    void configure(std::size_t size, bool debug, prepare_fn_t prepare,
+                   discard_fn_t discard)
     {
-      if (bindings.count(name) > 0)
+      m_size = size;
+      m_debug = debug;
+      m_prepare = std::move(prepare);
+      m_discard = std::move(discard);
+      while (m_ready.size() > m_size)
       {
-        return;
-      }
-      bindings.emplace(name, binding_ctx_t(fn, arg));
-      auto js = "(function() { var name = '" + name + "';" + R""(
-      var RPC = window._rpc = (window._rpc || {nextSeq: 1});
-      window[name] = function() {
-        var seq = RPC.nextSeq++;
-        var promise = new Promise(function(resolve, reject) {
-          RPC[seq] = {
-            resolve: resolve,
-            reject: reject,
-          };
-        });
-        window.external.invoke(JSON.stringify({
-          id: seq,
-          method: name,
-          params: Array.prototype.slice.call(arguments),
-        }));
-        return promise;
+        std::unique_ptr<webview> w = std::move(m_ready.back());
+        m_ready.pop_back();
+        auto destroyed = w.get();
+        w.reset();
+        if (m_discard)
+        {
+          m_discard(destroyed);
+        }
       }
-    })())"";
-      init(js);
-      eval(js);
+      refill();
     }
 
-    void unbind(const std::string &name)
+    // Hands out a ready webview, shown, and starts creating its
+    // replacement. A webview is created on the spot if none is ready.
+    // Returns nullptr if it cannot be created.
+    webview *acquire()
     {
-      auto found = bindings.find(name);
-      if (found != bindings.end())
+      std::unique_ptr<webview> w;
+      if (!m_ready.empty())
       {
-        auto js = "delete window['" + name + "'];";
-        init(js);
-        eval(js);
-        bindings.erase(found);
+        w = std::move(m_ready.front());
+        m_ready.pop_front();
+      }
+      else
+      {
+        w = create();
+      }
+      if (w)
+      {
+        w->show();
       }
+      refill();
+      return w.release();
     }
 
-    void resolve(const std::string &seq, int status, const std::string &result)
+    std::size_t ready() const { return m_ready.size(); }
+
+  private:
+    webview_pool() = default;
+
+    std::unique_ptr<webview> create()
     {
-      dispatch([seq, status, result, this]()
-               {
-      if (status == 0) {
-        eval("window._rpc[" + seq + "].resolve(" + result +
-             "); delete window._rpc[" + seq + "]");
-      } else {
-        eval("window._rpc[" + seq + "].reject(" + result +
-             "); delete window._rpc[" + seq + "]");
-      } });
+      detail::trace_span span("pool.create");
+      std::unique_ptr<webview> w(new webview(m_debug, nullptr, false));
+      if (!w->window())
+      {
+        return nullptr;
+      }
+      if (m_prepare)
+      {
+        m_prepare(*w);
+      }
+      // Starts the web process now rather than on the first navigation.
+      w->navigate("about:blank");
+      return w;
     }
 
-  private:
-    void on_message(const std::string &msg)
+    // Creates one webview per idle iteration until the pool is full.
+    void refill()
     {
-      auto seq = detail::json_parse(msg, "id", 0);
-      auto name = detail::json_parse(msg, "method", 0);
-      auto args = detail::json_parse(msg, "params", 0);
-      auto found = bindings.find(name);
-      if (found == bindings.end())
+      if (m_refilling || m_ready.size() >= m_size)
       {
         return;
       }
-      const auto &context = found->second;
-      context.callback(seq, args, context.arg);
+      m_refilling = true;
+      browser_engine::post_idle([this]()
+                                {
+        m_refilling = false;
+        if (m_ready.size() >= m_size)
+        {
+          return;
+        }
+        auto w = create();
+        // Failing now fails the same way on the next idle iteration.
+        if (!w)
+        {
+          return;
+        }
+        m_ready.push_back(std::move(w));
+        refill(); });
     }
 
-    std::map<std::string, binding_ctx_t> bindings;
+    std::deque<std::unique_ptr<webview>> m_ready;
+    std::size_t m_size = 0;
+    bool m_debug = false;
+    bool m_refilling = false;
+    prepare_fn_t m_prepare;
+    discard_fn_t m_discard;
   };
 } // namespace webview
 
@@ -2659,6 +8062,33 @@ WEBVIEW_API webview_t webview_create(int debug, void *wnd)
   return w;
 }
 
+WEBVIEW_API void webview_pool_set_size(int size, int debug,
+                                       void (*prepare)(webview_t w, void *arg),
+                                       void (*discard)(webview_t w, void *arg),
+                                       void *arg)
+{
+  webview::webview_pool::prepare_fn_t on_prepare;
+  webview::webview_pool::discard_fn_t on_discard;
+  if (prepare != nullptr)
+  {
+    on_prepare = [=](webview::webview &w)
+    { prepare(&w, arg); };
+  }
+  if (discard != nullptr)
+  {
+    on_discard = [=](webview::webview *w)
+    { discard(w, arg); };
+  }
+  webview::webview_pool::shared().configure(
+      static_cast<std::size_t>(std::max(0, size)), debug != 0,
+      std::move(on_prepare), std::move(on_discard));
+}
+
+WEBVIEW_API webview_t webview_pool_acquire(void)
+{
+  return webview::webview_pool::shared().acquire();
+}
+
 WEBVIEW_API void webview_destroy(webview_t w)
 {
   delete static_cast<webview::webview *>(w);
@@ -2718,11 +8148,27 @@ WEBVIEW_API void webview_set_html(webview_t w, const char *html)
   static_cast<webview::webview *>(w)->set_html(html);
 }
 
+WEBVIEW_API int webview_set_html_file(webview_t w, const char *path)
+{
+  return static_cast<webview::webview *>(w)->set_html_file(path) ? 1 : 0;
+}
+
 WEBVIEW_API void webview_init(webview_t w, const char *js)
 {
   static_cast<webview::webview *>(w)->init(js);
 }
 
+WEBVIEW_API void webview_set_init_script(webview_t w, const char *id,
+                                         const char *js)
+{
+  static_cast<webview::webview *>(w)->set_init_script(id, js);
+}
+
+WEBVIEW_API void webview_remove_init_script(webview_t w, const char *id)
+{
+  static_cast<webview::webview *>(w)->remove_init_script(id);
+}
+
 WEBVIEW_API void webview_eval(webview_t w, const char *js)
 {
   static_cast<webview::webview *>(w)->eval(js);
@@ -2742,11 +8188,200 @@ WEBVIEW_API void webview_bind(webview_t w, const char *name,
       arg);
 }
 
+WEBVIEW_API void webview_bind_many(webview_t w,
+                                   const webview_binding_t *bindings,
+                                   size_t count)
+{
+  using webview_class = webview::webview;
+  std::vector<std::pair<std::string, webview_class::binding_ctx_t>> list;
+  list.reserve(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    auto fn = bindings[i].fn;
+    list.emplace_back(
+        bindings[i].name,
+        webview_class::binding_ctx_t(
+            [=](const std::string &seq, const std::string &req, void *arg)
+            {
+              fn(seq.c_str(), req.c_str(), arg);
+            },
+            bindings[i].arg));
+  }
+  static_cast<webview_class *>(w)->bind_many(list);
+}
+
+WEBVIEW_API void webview_set_binding_namespace(webview_t w, const char *ns)
+{
+  static_cast<webview::webview *>(w)->set_binding_namespace(ns);
+}
+
 WEBVIEW_API void webview_unbind(webview_t w, const char *name)
 {
   static_cast<webview::webview *>(w)->unbind(name);
 }
 
+WEBVIEW_API int webview_return_chunk(webview_t w, const char *seq,
+                                     const char *result)
+{
+  return static_cast<webview::webview *>(w)->resolve_chunk(seq, result) ? 1
+                                                                        : 0;
+}
+
+WEBVIEW_API int webview_emit(webview_t w, const char *topic,
+                             const char *json)
+{
+  return static_cast<webview::webview *>(w)->emit(topic, json) ? 1 : 0;
+}
+
+WEBVIEW_API int webview_has_subscribers(webview_t w, const char *topic)
+{
+  return static_cast<webview::webview *>(w)->has_subscribers(topic) ? 1 : 0;
+}
+
+WEBVIEW_API int webview_channel_open(webview_t w, const char *name,
+                                     int policy, int capacity, int window)
+{
+  if (policy < WEBVIEW_CHANNEL_BLOCK || policy > WEBVIEW_CHANNEL_COALESCE)
+  {
+    return 0;
+  }
+  static_cast<webview::webview *>(w)->open_channel(
+      name, static_cast<webview::detail::push_channel::policy>(policy),
+      capacity > 0 ? capacity : 1, window > 0 ? window : 1);
+  return 1;
+}
+
+WEBVIEW_API int webview_channel_post(webview_t w, const char *name,
+                                     const char *key, const char *json)
+{
+  return static_cast<webview::webview *>(w)->post(name, key ? key : "", json)
+             ? 1
+             : 0;
+}
+
+WEBVIEW_API int webview_channel_broadcast(const webview_t *ws, size_t count,
+                                          const char *name, const char *key,
+                                          const char *json)
+{
+  std::vector<webview::webview *> group;
+  group.reserve(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    group.push_back(static_cast<webview::webview *>(ws[i]));
+  }
+  return static_cast<int>(webview::webview::broadcast(
+      group.begin(), group.end(), name, key ? key : "", json));
+}
+
+WEBVIEW_API int webview_channel_stats(webview_t w, const char *name,
+                                      webview_channel_stats_t *stats)
+{
+  webview::detail::push_channel::stats result;
+  if (!static_cast<webview::webview *>(w)->channel_stats(name, result))
+  {
+    return 0;
+  }
+  stats->posted = result.posted;
+  stats->delivered = result.delivered;
+  stats->dropped = result.dropped;
+  stats->coalesced = result.coalesced;
+  stats->depth = result.depth;
+  stats->max_depth = result.max_depth;
+  stats->credits = result.credits;
+  stats->in_flight = result.in_flight;
+  return 1;
+}
+
+WEBVIEW_API void webview_bind_timeout(webview_t w, const char *name,
+                                      int timeout_ms)
+{
+  static_cast<webview::webview *>(w)->set_binding_timeout(name, timeout_ms);
+}
+
+WEBVIEW_API void webview_bind_cancel(webview_t w, const char *name,
+                                     void (*fn)(const char *seq, void *arg))
+{
+  static_cast<webview::webview *>(w)->set_binding_cancel(
+      name, [=](const std::string &seq, void *arg)
+      { fn(seq.c_str(), arg); });
+}
+
+WEBVIEW_API void webview_dispatch_stats(webview_t w,
+                                        webview_dispatch_stats_t *stats)
+{
+  static_cast<webview::webview *>(w)->dispatch_stats(*stats);
+}
+
+WEBVIEW_API int webview_binding_stats(webview_t w, const char *name,
+                                      webview_binding_stats_t *stats)
+{
+  if (name == nullptr)
+  {
+    static_cast<webview::webview *>(w)->unknown_binding_stats(*stats);
+    return 1;
+  }
+  return static_cast<webview::webview *>(w)->binding_stats(name, *stats) ? 1
+                                                                        : 0;
+}
+
+WEBVIEW_API void webview_set_stall_watchdog(
+    webview_t w, int threshold_ms,
+    void (*fn)(webview_t w, const char *site, long long elapsed_ms,
+               int finished, void *arg),
+    void *arg)
+{
+  static_cast<webview::webview *>(w)->set_stall_watchdog(
+      fn ? threshold_ms : 0,
+      [=](const std::string &site, long long elapsed_ms, bool finished)
+      { fn(w, site.c_str(), elapsed_ms, finished ? 1 : 0, arg); });
+}
+
+WEBVIEW_API void webview_stall_stats(webview_t w,
+                                     webview_stall_stats_t *stats)
+{
+  auto counters = static_cast<webview::webview *>(w)->stall_stats();
+  stats->stalls = counters.stalls;
+  stats->main_loop_stalls = counters.main_loop_stalls;
+  stats->longest_ms = counters.longest_ms;
+}
+
+WEBVIEW_API void webview_navigation_timing(webview_t w,
+                                           webview_navigation_timing_t *timing)
+{
+  auto current = static_cast<webview::webview *>(w)->timing();
+  timing->id = current.id;
+  timing->committed_ms = current.committed_ms;
+  timing->dom_content_loaded_ms = current.dom_content_loaded_ms;
+  timing->load_finished_ms = current.load_finished_ms;
+  timing->first_paint_ms = current.first_paint_ms;
+}
+
+WEBVIEW_API void webview_set_navigation_timing_callback(
+    webview_t w,
+    void (*fn)(webview_t w, int milestone, const char *url,
+               const webview_navigation_timing_t *timing, void *arg),
+    void *arg)
+{
+  if (fn == nullptr)
+  {
+    static_cast<webview::webview *>(w)->set_navigation_timing_callback(nullptr);
+    return;
+  }
+  static_cast<webview::webview *>(w)->set_navigation_timing_callback(
+      [=](int milestone, const webview::detail::navigation_timing &current)
+      {
+        webview_navigation_timing_t timing{
+            current.id, current.committed_ms, current.dom_content_loaded_ms,
+            current.load_finished_ms, current.first_paint_ms};
+        fn(w, milestone, current.url.c_str(), &timing, arg);
+      });
+}
+
+WEBVIEW_API int webview_is_cancelled(webview_t w, const char *seq)
+{
+  return static_cast<webview::webview *>(w)->is_cancelled(seq) ? 1 : 0;
+}
+
 WEBVIEW_API void webview_return(webview_t w, const char *seq, int status,
                                 const char *result)
 {
@@ -2759,11 +8394,127 @@ WEBVIEW_API int webview_set_virtual_host_name(webview_t w, const char *url, cons
   return static_cast<int>(is_set);
 }
 
+WEBVIEW_API int webview_set_virtual_host_bundle(webview_t w, const char *host,
+                                                const char *bundle,
+                                                const int option)
+{
+  return static_cast<webview::webview *>(w)->set_virtual_host_bundle(
+             host, bundle, option)
+             ? 1
+             : 0;
+}
+
+WEBVIEW_API int webview_hot_reload(webview_t w, const char *host,
+                                   const char *folder)
+{
+  return static_cast<webview::webview *>(w)->hot_reload(
+             host, folder != nullptr ? folder : "")
+             ? 1
+             : 0;
+}
+
+WEBVIEW_API void webview_set_asset_cache_capacity(size_t bytes)
+{
+#if defined(WEBVIEW_GTK) || defined(WEBVIEW_HEADLESS)
+  webview::detail::asset_cache::shared().set_capacity(bytes);
+#else
+  (void)bytes;
+#endif
+}
+
+WEBVIEW_API void webview_asset_cache_stats(webview_asset_cache_stats_t *stats)
+{
+#if defined(WEBVIEW_GTK) || defined(WEBVIEW_HEADLESS)
+  auto st = webview::detail::asset_cache::shared().snapshot();
+  stats->hits = st.hits;
+  stats->misses = st.misses;
+  stats->evictions = st.evictions;
+  stats->invalidations = st.invalidations;
+  stats->entries = st.entries;
+  stats->bytes = st.bytes;
+  stats->capacity = st.capacity;
+#else
+  *stats = webview_asset_cache_stats_t{};
+#endif
+}
+
+WEBVIEW_API int webview_register_scheme(
+    webview_t w, const char *scheme,
+    void (*fn)(webview_t w, webview_scheme_request_t *req, void *arg),
+    void *arg)
+{
+  return static_cast<webview::webview *>(w)->register_scheme(
+             scheme, [=](webview::detail::scheme_request *r)
+             { fn(w, reinterpret_cast<webview_scheme_request_t *>(r), arg); })
+             ? 1
+             : 0;
+}
+
+WEBVIEW_API const char *webview_scheme_request_uri(webview_scheme_request_t *req)
+{
+  return reinterpret_cast<webview::detail::scheme_request *>(req)->uri().c_str();
+}
+
+WEBVIEW_API const char *webview_scheme_request_path(webview_scheme_request_t *req)
+{
+  return reinterpret_cast<webview::detail::scheme_request *>(req)->path().c_str();
+}
+
+WEBVIEW_API void webview_scheme_set_header(webview_scheme_request_t *req,
+                                           const char *name, const char *value)
+{
+  reinterpret_cast<webview::detail::scheme_request *>(req)->set_header(name,
+                                                                       value);
+}
+
+WEBVIEW_API void webview_scheme_respond(webview_scheme_request_t *req,
+                                        int status, const char *mime,
+                                        const void *data, size_t size,
+                                        void (*release)(void *arg), void *arg)
+{
+  reinterpret_cast<webview::detail::scheme_request *>(req)->respond(
+      status, mime, data, size, release, arg);
+}
+
+WEBVIEW_API void webview_scheme_respond_stream(
+    webview_scheme_request_t *req, int status, const char *mime,
+    long long size, long long (*read)(void *buf, size_t size, void *arg),
+    void (*close)(void *arg), void *arg)
+{
+  reinterpret_cast<webview::detail::scheme_request *>(req)->respond_stream(
+      status, mime, size, read, close, arg);
+}
+
+WEBVIEW_API void webview_scheme_fail(webview_scheme_request_t *req,
+                                     const char *message)
+{
+  reinterpret_cast<webview::detail::scheme_request *>(req)->fail(message);
+}
+
 WEBVIEW_API const webview_version_info_t *webview_version()
 {
   return &webview::detail::library_version_info;
 }
 
+WEBVIEW_API void webview_trace_start(size_t events_per_thread)
+{
+  webview::detail::tracer::start(events_per_thread);
+}
+
+WEBVIEW_API void webview_trace_stop(void) { webview::detail::tracer::stop(); }
+
+WEBVIEW_API int webview_trace_dump(const char *path)
+{
+  auto json = webview::detail::tracer::dump();
+  auto file = std::fopen(path, "wb");
+  if (file == nullptr)
+  {
+    return 0;
+  }
+  auto written = std::fwrite(json.data(), 1, json.size(), file);
+  return std::fclose(file) == 0 && written == json.size() ? 1 : 0;
+}
+
 #endif /* WEBVIEW_HEADER */
 #endif /* __cplusplus */
 #endif /* WEBVIEW_H */
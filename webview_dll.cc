@@ -1,6 +1,8 @@
 #include "webview_dll.h"
 #include <webview.h>
 
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include <string.h>
 #include <vector>
@@ -10,15 +12,62 @@
 #include <stdlib.h>
 #include <stdio.h>
 
+using StallContext = struct stallContext
+{
+    void (*stallCallback)(const WebViewHandle, const char *, long long, int, void *) = nullptr;
+    void *arg = nullptr;
+};
+
+using TimingContext = struct timingContext
+{
+    void (*timingCallback)(const WebViewHandle, int, const char *, const WebViewNavigationTiming *, void *) = nullptr;
+    void *arg = nullptr;
+};
+
+using SchemeContext = struct schemeContext
+{
+    void (*schemeCallback)(const WebViewHandle, WebViewSchemeRequest, void *) = nullptr;
+    void *arg = nullptr;
+};
+
 using ContextStore = struct contextStore
 {
     void (*dispatchCallback)(const WebViewHandle, void *) = nullptr;
     void (*destroyCallback)(const WebViewHandle) = nullptr;
+    // Passed as the argument of the stall callback, which runs on the watchdog thread and must not touch the mapping
+    StallContext stallContext;
+    TimingContext timingContext;
+    // One per registered scheme, passed as the argument of the scheme callback
+    std::unordered_map<std::string, SchemeContext> schemeContexts;
     // void (*bindCallback)(const char *, const char *, void *) = nullptr;
 };
 
 std::unordered_map<WebViewHandle, std::unique_ptr<ContextStore>> contextStoreMapping;
 
+// Contexts of the idle pooled instances, moved to contextStoreMapping once they are handed out
+std::unordered_map<WebViewHandle, std::unique_ptr<ContextStore>> pooledContextMapping;
+
+using PoolContext = struct poolContext
+{
+    void (*prepareCallback)(const WebViewHandle, void *) = nullptr;
+    void *arg = nullptr;
+    int debug = 0;
+};
+
+PoolContext poolContext;
+
+// The context of an instance, whether handed out or still idle in the pool
+ContextStore *FindContextStore(const WebViewHandle handle)
+{
+    auto found = contextStoreMapping.find(handle);
+    if (found != contextStoreMapping.end())
+    {
+        return found->second.get();
+    }
+    auto pooled = pooledContextMapping.find(handle);
+    return pooled != pooledContextMapping.end() ? pooled->second.get() : nullptr;
+}
+
 WebViewHandle CreateWebViewInstance(int debug, void *wnd)
 {
     auto webviewInstance = webview_create(debug, wnd);
@@ -40,9 +89,81 @@ void DestroyWebView(const WebViewHandle handle)
 {
     const auto webviewInstance = reinterpret_cast<webview_t>(handle);
 
+    // The instance may still call back into its context while being destroyed
+    webview_destroy(webviewInstance);
+
     contextStoreMapping.erase(handle);
+}
+
+void SetWebViewPoolSize(int size, int debug, void (*prepare)(const WebViewHandle, void *), void *arg)
+{
+    const auto discard = [](webview_t _w, void *) -> void
+    {
+        // Called once an idle instance is destroyed, as in DestroyWebView
+        pooledContextMapping.erase(reinterpret_cast<WebViewHandle>(_w));
+    };
 
-    return webview_destroy(webviewInstance);
+    // Idle instances were prepared by the previous callback, or with another debug flag
+    if (prepare != poolContext.prepareCallback || arg != poolContext.arg || debug != poolContext.debug)
+    {
+        webview_pool_set_size(0, poolContext.debug, nullptr, discard, nullptr);
+    }
+
+    poolContext.prepareCallback = prepare;
+    poolContext.arg = arg;
+    poolContext.debug = debug;
+
+    webview_pool_set_size(
+        size,
+        debug,
+        [](webview_t _w, void *_arg) -> void
+        {
+            // Pooled instances get their context while prepare runs, so that it can bind functions,
+            // and stay out of the mapping until AcquireWebViewFromPool hands them out
+            const auto handle = reinterpret_cast<WebViewHandle>(_w);
+            contextStoreMapping.insert(std::pair<WebViewHandle, std::unique_ptr<ContextStore>>(handle, std::make_unique<ContextStore>()));
+
+            const auto _poolContext = static_cast<PoolContext *>(_arg);
+            if (_poolContext->prepareCallback)
+            {
+                (_poolContext->prepareCallback)(handle, _poolContext->arg);
+            }
+
+            auto found = contextStoreMapping.find(handle);
+            if (found != contextStoreMapping.end())
+            {
+                pooledContextMapping[handle] = std::move(found->second);
+                contextStoreMapping.erase(found);
+            }
+        },
+        discard,
+        &poolContext);
+}
+
+WebViewHandle AcquireWebViewFromPool()
+{
+    auto webviewInstance = webview_pool_acquire();
+
+    if (webviewInstance == nullptr)
+    {
+        return HANDLE_ERROR;
+    }
+
+    const auto handle = reinterpret_cast<WebViewHandle>(webviewInstance);
+
+    // Prepared instances bring the context prepare used, others are created without one
+    auto pooled = pooledContextMapping.find(handle);
+    if (pooled != pooledContextMapping.end())
+    {
+        contextStoreMapping[handle] = std::move(pooled->second);
+        pooledContextMapping.erase(pooled);
+    }
+    else
+    {
+        contextStoreMapping.insert(std::pair<WebViewHandle, std::unique_ptr<ContextStore>>(handle, std::make_unique<ContextStore>()));
+    }
+
+    return handle;
 }
 
 int CheckWebViewExists(const WebViewHandle handle)
@@ -72,8 +193,11 @@ void SetWebViewOnDestroy(const WebViewHandle handle, void (*fn)(const WebViewHan
     webview_set_on_destroy(webviewInstance, [](webview_t w) -> void
                            {
         const auto _handle = reinterpret_cast<WebViewHandle>(w);
-        auto& _contextStore = contextStoreMapping[_handle];
-        (_contextStore->destroyCallback)(_handle); });
+        const auto _contextStore = FindContextStore(_handle);
+        if (_contextStore != nullptr)
+        {
+            (_contextStore->destroyCallback)(_handle);
+        } });
 }
 
 void TerminateWebView(const WebViewHandle handle)
@@ -93,8 +217,11 @@ void DispatchWebView(const WebViewHandle handle, void (*fn)(const WebViewHandle,
         [](webview_t _w, void *_arg) -> void
         {
             const auto _handle = reinterpret_cast<WebViewHandle>(_w);
-            auto &_contextStore = contextStoreMapping[_handle];
-            (_contextStore->dispatchCallback)(_handle, _arg);
+            const auto _contextStore = FindContextStore(_handle);
+            if (_contextStore != nullptr)
+            {
+                (_contextStore->dispatchCallback)(_handle, _arg);
+            }
         },
         arg);
 }
@@ -131,60 +258,279 @@ void SetWebViewHTML(const WebViewHandle handle, const char *html)
 
 int SetWebViewHTMLFromFile(const WebViewHandle handle, const char *htmlFile)
 {
-    if (!std::filesystem::exists(htmlFile))
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    return webview_set_html_file(webviewInstance, htmlFile);
+}
+
+void InitWebView(const WebViewHandle handle, const char *js)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    webview_init(webviewInstance, js);
+}
+
+void SetWebViewInitScript(const WebViewHandle handle, const char *id, const char *js)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    webview_set_init_script(webviewInstance, id, js);
+}
+
+void RemoveWebViewInitScript(const WebViewHandle handle, const char *id)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    webview_remove_init_script(webviewInstance, id);
+}
+
+void EvalWebView(const WebViewHandle handle, const char *js)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    webview_eval(webviewInstance, js);
+}
+
+void BindWebView(const WebViewHandle handle, const char *name, void (*fn)(const char *, const char *, void *), void *arg)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+
+    webview_bind(
+        webviewInstance,
+        name,
+        fn,
+        arg);
+}
+
+int BindWebViewMany(const WebViewHandle handle, const WebViewBinding *bindings, int count)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+
+    if (count < 0 || (count > 0 && bindings == nullptr))
     {
         return 0;
     }
 
-    const auto absPath = std::filesystem::absolute(htmlFile).string();
+    std::vector<webview_binding_t> webviewBindings;
+    webviewBindings.reserve(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        webviewBindings.push_back({bindings[i].name, bindings[i].fn, bindings[i].arg});
+    }
+
+    webview_bind_many(webviewInstance, webviewBindings.data(), webviewBindings.size());
+    return 1;
+}
+
+void SetWebViewBindingNamespace(const WebViewHandle handle, const char *ns)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    webview_set_binding_namespace(webviewInstance, ns);
+}
+
+void UnBindWebView(const WebViewHandle handle, const char *name)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    webview_unbind(webviewInstance, name);
+}
+
+int EmitWebViewEvent(const WebViewHandle handle, const char *topic, const char *json)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    return webview_emit(webviewInstance, topic, json);
+}
 
-    auto fp = fopen(absPath.data(), "rb");
+int CheckWebViewEventSubscribed(const WebViewHandle handle, const char *topic)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    return webview_has_subscribers(webviewInstance, topic);
+}
 
-    if (fp == nullptr)
+int OpenWebViewChannel(const WebViewHandle handle, const char *name, int policy, int capacity, int window)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    return webview_channel_open(webviewInstance, name, policy, capacity, window);
+}
+
+int PostWebViewChannel(const WebViewHandle handle, const char *name, const char *key, const char *json)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    return webview_channel_post(webviewInstance, name, key, json);
+}
+
+int BroadcastWebViewChannel(const WebViewHandle *handles, int count, const char *name, const char *key, const char *json)
+{
+    if (count < 0 || (count > 0 && handles == nullptr))
     {
         return 0;
     }
 
-    fseek(fp, 0, SEEK_END);
-    const size_t bufSize = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    std::vector<webview_t> webviewInstances;
+    webviewInstances.reserve(count);
+
+    for (int i = 0; i < count; i++)
+    {
+        webviewInstances.push_back(reinterpret_cast<webview_t>(handles[i]));
+    }
+
+    return webview_channel_broadcast(webviewInstances.data(), webviewInstances.size(), name, key, json);
+}
+
+int GetWebViewChannelStats(const WebViewHandle handle, const char *name, WebViewChannelStats *outStats)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+
+    webview_channel_stats_t stats;
 
-    auto buffer = std::make_unique<char[]>(bufSize);
-    fread(buffer.get(), sizeof(char), bufSize, fp);
-    fclose(fp);
+    if (!webview_channel_stats(webviewInstance, name, &stats))
+    {
+        return 0;
+    }
 
-    SetWebViewHTML(handle, buffer.get());
+    outStats->posted = stats.posted;
+    outStats->delivered = stats.delivered;
+    outStats->dropped = stats.dropped;
+    outStats->coalesced = stats.coalesced;
+    outStats->depth = stats.depth;
+    outStats->max_depth = stats.max_depth;
+    outStats->credits = stats.credits;
+    outStats->in_flight = stats.in_flight;
 
     return 1;
 }
 
-void InitWebView(const WebViewHandle handle, const char *js)
+void SetWebViewBindingTimeout(const WebViewHandle handle, const char *name, int timeoutMs)
 {
     const auto webviewInstance = reinterpret_cast<webview_t>(handle);
-    webview_init(webviewInstance, js);
+    webview_bind_timeout(webviewInstance, name, timeoutMs);
 }
 
-void EvalWebView(const WebViewHandle handle, const char *js)
+void SetWebViewBindingCancel(const WebViewHandle handle, const char *name, void (*fn)(const char *, void *))
 {
     const auto webviewInstance = reinterpret_cast<webview_t>(handle);
-    webview_eval(webviewInstance, js);
+    webview_bind_cancel(webviewInstance, name, fn);
 }
 
-void BindWebView(const WebViewHandle handle, const char *name, void (*fn)(const char *, const char *, void *), void *arg)
+int CheckWebViewCancelled(const WebViewHandle handle, const char *seq)
 {
     const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    return webview_is_cancelled(webviewInstance, seq);
+}
 
-    webview_bind(
+void SetWebViewStallWatchdog(const WebViewHandle handle, int thresholdMs, void (*fn)(const WebViewHandle, const char *, long long, int, void *), void *arg)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    auto &contextStore = contextStoreMapping[handle];
+    // Joins the watchdog thread, which reads the context, before it is changed
+    webview_set_stall_watchdog(webviewInstance, 0, nullptr, nullptr);
+    if (thresholdMs <= 0 || fn == nullptr)
+    {
+        return;
+    }
+    contextStore->stallContext.stallCallback = fn;
+    contextStore->stallContext.arg = arg;
+
+    webview_set_stall_watchdog(
         webviewInstance,
-        name,
-        fn,
-        arg);
+        thresholdMs,
+        [](webview_t _w, const char *_site, long long _elapsedMs, int _finished, void *_arg) -> void
+        {
+            const auto _stallContext = static_cast<StallContext *>(_arg);
+            (_stallContext->stallCallback)(reinterpret_cast<WebViewHandle>(_w), _site, _elapsedMs, _finished, _stallContext->arg);
+        },
+        &contextStore->stallContext);
 }
 
-void UnBindWebView(const WebViewHandle handle, const char *name)
+void GetWebViewNavigationTiming(const WebViewHandle handle, WebViewNavigationTiming *outTiming)
 {
     const auto webviewInstance = reinterpret_cast<webview_t>(handle);
-    webview_unbind(webviewInstance, name);
+
+    webview_navigation_timing_t timing;
+    webview_navigation_timing(webviewInstance, &timing);
+
+    outTiming->id = timing.id;
+    outTiming->committed_ms = timing.committed_ms;
+    outTiming->dom_content_loaded_ms = timing.dom_content_loaded_ms;
+    outTiming->load_finished_ms = timing.load_finished_ms;
+    outTiming->first_paint_ms = timing.first_paint_ms;
+}
+
+void SetWebViewNavigationTimingCallback(const WebViewHandle handle, void (*fn)(const WebViewHandle, int, const char *, const WebViewNavigationTiming *, void *), void *arg)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    auto &contextStore = contextStoreMapping[handle];
+    contextStore->timingContext.timingCallback = fn;
+    contextStore->timingContext.arg = arg;
+
+    if (fn == nullptr)
+    {
+        webview_set_navigation_timing_callback(webviewInstance, nullptr, nullptr);
+        return;
+    }
+
+    webview_set_navigation_timing_callback(
+        webviewInstance,
+        [](webview_t _w, int _milestone, const char *_url, const webview_navigation_timing_t *_timing, void *_arg) -> void
+        {
+            const auto _timingContext = static_cast<TimingContext *>(_arg);
+            WebViewNavigationTiming timing{_timing->id, _timing->committed_ms, _timing->dom_content_loaded_ms,
+                                           _timing->load_finished_ms, _timing->first_paint_ms};
+            (_timingContext->timingCallback)(reinterpret_cast<WebViewHandle>(_w), _milestone, _url, &timing, _timingContext->arg);
+        },
+        &contextStore->timingContext);
+}
+
+void GetWebViewDispatchStats(const WebViewHandle handle, WebViewDispatchStats *outStats)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+
+    static_assert(sizeof(outStats->wait_histogram) == sizeof(webview_dispatch_stats_t::wait_histogram),
+                  "WebViewDispatchStats must have WEBVIEW_LATENCY_BUCKETS buckets");
+
+    webview_dispatch_stats_t stats;
+    webview_dispatch_stats(webviewInstance, &stats);
+
+    outStats->posted = stats.posted;
+    outStats->run = stats.run;
+    outStats->depth = stats.depth;
+    outStats->max_depth = stats.max_depth;
+    outStats->wait_total_us = stats.wait_total_us;
+    std::copy(std::begin(stats.wait_histogram), std::end(stats.wait_histogram), outStats->wait_histogram);
+    std::copy(std::begin(stats.batch_histogram), std::end(stats.batch_histogram), outStats->batch_histogram);
+}
+
+void GetWebViewStallStats(const WebViewHandle handle, WebViewStallStats *outStats)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+
+    webview_stall_stats_t stats;
+    webview_stall_stats(webviewInstance, &stats);
+
+    outStats->stalls = stats.stalls;
+    outStats->main_loop_stalls = stats.main_loop_stalls;
+    outStats->longest_ms = stats.longest_ms;
+}
+
+int GetWebViewBindingStats(const WebViewHandle handle, const char *name, WebViewBindingStats *outStats)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+
+    static_assert(sizeof(outStats->latency_histogram) == sizeof(webview_binding_stats_t::latency_histogram),
+                  "WebViewBindingStats must have WEBVIEW_LATENCY_BUCKETS buckets");
+
+    webview_binding_stats_t stats;
+
+    if (!webview_binding_stats(webviewInstance, name, &stats))
+    {
+        return 0;
+    }
+
+    outStats->calls = stats.calls;
+    outStats->errors = stats.errors;
+    outStats->cancelled = stats.cancelled;
+    outStats->bytes_in = stats.bytes_in;
+    outStats->bytes_out = stats.bytes_out;
+    outStats->in_flight = stats.in_flight;
+    outStats->latency_total_us = stats.latency_total_us;
+    std::copy(std::begin(stats.latency_histogram), std::end(stats.latency_histogram), outStats->latency_histogram);
+
+    return 1;
 }
 
 void ReturnWebView(const WebViewHandle handle, const char *seq, int status, const char *result)
@@ -193,6 +539,12 @@ void ReturnWebView(const WebViewHandle handle, const char *seq, int status, cons
     webview_return(webviewInstance, seq, status, result);
 }
 
+int ReturnWebViewChunk(const WebViewHandle handle, const char *seq, const char *result)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    return webview_return_chunk(webviewInstance, seq, result);
+}
+
 int SetWebViewVituralHostName(const WebViewHandle handle, const char *url, const char *folder, const int option)
 {
     const auto webviewInstance = reinterpret_cast<webview_t>(handle);
@@ -207,6 +559,95 @@ int SetWebViewVituralHostName(const WebViewHandle handle, const char *url, const
     return webview_set_virtual_host_name(webviewInstance, url, absPath.data(), option);
 }
 
+int SetWebViewVirtualHostBundle(const WebViewHandle handle, const char *url, const char *bundle, const int option)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    return webview_set_virtual_host_bundle(webviewInstance, url, bundle, option);
+}
+
+int SetWebViewHotReload(const WebViewHandle handle, const char *url, const char *folder)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+
+    if (folder == nullptr)
+    {
+        return webview_hot_reload(webviewInstance, url, nullptr);
+    }
+
+    // Absolute, like the folder SetWebViewVituralHostName maps.
+    const auto absPath = std::filesystem::absolute(folder).string();
+
+    return webview_hot_reload(webviewInstance, url, absPath.data());
+}
+
+void SetWebViewAssetCacheCapacity(size_t bytes)
+{
+    webview_set_asset_cache_capacity(bytes);
+}
+
+void GetWebViewAssetCacheStats(WebViewAssetCacheStats *outStats)
+{
+    webview_asset_cache_stats_t stats;
+    webview_asset_cache_stats(&stats);
+
+    outStats->hits = stats.hits;
+    outStats->misses = stats.misses;
+    outStats->evictions = stats.evictions;
+    outStats->invalidations = stats.invalidations;
+    outStats->entries = stats.entries;
+    outStats->bytes = stats.bytes;
+    outStats->capacity = stats.capacity;
+}
+
+int RegisterWebViewScheme(const WebViewHandle handle, const char *scheme, void (*fn)(const WebViewHandle, WebViewSchemeRequest, void *), void *arg)
+{
+    const auto webviewInstance = reinterpret_cast<webview_t>(handle);
+    auto &contextStore = contextStoreMapping[handle];
+    auto &schemeContext = contextStore->schemeContexts[scheme];
+    schemeContext.schemeCallback = fn;
+    schemeContext.arg = arg;
+
+    return webview_register_scheme(
+        webviewInstance,
+        scheme,
+        [](webview_t _w, webview_scheme_request_t *_req, void *_arg) -> void
+        {
+            const auto _schemeContext = static_cast<SchemeContext *>(_arg);
+            (_schemeContext->schemeCallback)(reinterpret_cast<WebViewHandle>(_w), _req, _schemeContext->arg);
+        },
+        &schemeContext);
+}
+
+const char *GetWebViewSchemeRequestUri(WebViewSchemeRequest request)
+{
+    return webview_scheme_request_uri(static_cast<webview_scheme_request_t *>(request));
+}
+
+const char *GetWebViewSchemeRequestPath(WebViewSchemeRequest request)
+{
+    return webview_scheme_request_path(static_cast<webview_scheme_request_t *>(request));
+}
+
+void SetWebViewSchemeHeader(WebViewSchemeRequest request, const char *name, const char *value)
+{
+    webview_scheme_set_header(static_cast<webview_scheme_request_t *>(request), name, value);
+}
+
+void RespondWebViewScheme(WebViewSchemeRequest request, int status, const char *mime, const void *data, size_t size, void (*release)(void *), void *arg)
+{
+    webview_scheme_respond(static_cast<webview_scheme_request_t *>(request), status, mime, data, size, release, arg);
+}
+
+void RespondWebViewSchemeStream(WebViewSchemeRequest request, int status, const char *mime, long long size, long long (*read)(void *, size_t, void *), void (*close)(void *), void *arg)
+{
+    webview_scheme_respond_stream(static_cast<webview_scheme_request_t *>(request), status, mime, size, read, close, arg);
+}
+
+void FailWebViewScheme(WebViewSchemeRequest request, const char *message)
+{
+    webview_scheme_fail(static_cast<webview_scheme_request_t *>(request), message);
+}
+
 void GetWebViewVersionInfo(WebViewVersionInfo *outInfo)
 {
     auto info = webview_version();
@@ -218,4 +659,19 @@ void GetWebViewVersionInfo(WebViewVersionInfo *outInfo)
     strcpy(outInfo->version_number, info->version_number);
     strcpy(outInfo->pre_release, info->pre_release);
     strcpy(outInfo->build_metadata, info->build_metadata);
+}
+
+void StartWebViewTrace(unsigned int eventsPerThread)
+{
+    webview_trace_start(eventsPerThread);
+}
+
+void StopWebViewTrace()
+{
+    webview_trace_stop();
+}
+
+int DumpWebViewTrace(const char *path)
+{
+    return webview_trace_dump(path);
 }
\ No newline at end of file
@@ -1,11 +1,18 @@
 #ifndef __WEBVIEW_DLL_H__
 #define __WEBVIEW_DLL_H__
 
+#include <stddef.h>
+
+#if defined(_WIN32)
 #ifdef BUILDWEBVIEWDLL
 #define EXPORTWEBVIEWDLL __declspec(dllexport)
 #else
 #define EXPORTWEBVIEWDLL __declspec(dllimport)
 #endif
+#else
+// Shared objects are built with -fvisibility=hidden, only these functions are exported
+#define EXPORTWEBVIEWDLL __attribute__((visibility("default")))
+#endif
 
 #ifdef BUILDSTATIC
 #undef EXPORTWEBVIEWDLL
@@ -101,6 +108,234 @@ typedef struct _webViewVersionInfo
     char build_metadata[48];
 } WebViewVersionInfo;
 
+/**
+ * @brief The overflow policy of a push channel
+ *
+ * This enumeration defines what happens when native code posts to a channel whose queue is full
+ */
+typedef enum _webViewChannelPolicy
+{
+    /*! Posting waits until the page has consumed messages, do not post from the main thread */
+    WebViewChannelBlock = 0,
+
+    /*! The oldest queued message is dropped */
+    WebViewChannelDropOldest,
+
+    /*! A queued message is replaced by a newer message with the same key, otherwise the oldest is dropped */
+    WebViewChannelCoalesce
+} WebViewChannelPolicy;
+
+/**
+ * @brief A milestone of a navigation
+ *
+ * This enumeration defines the milestones reported by SetWebViewNavigationTimingCallback
+ */
+typedef enum _webViewNavigationMilestone
+{
+    /*! NavigateWebView or SetWebViewHTML was called, or the page navigated by itself */
+    WebViewNavigationStarted = 0,
+
+    /*! The new document started */
+    WebViewNavigationCommitted,
+
+    /*! The DOMContentLoaded event fired */
+    WebViewNavigationDomContentLoaded,
+
+    /*! The load event fired */
+    WebViewNavigationLoadFinished,
+
+    /*! The first content was painted */
+    WebViewNavigationFirstPaint
+} WebViewNavigationMilestone;
+
+/**
+ * @brief This type holds the counters of a push channel
+ *
+ * this structure describes the queue depth and message counts of a push channel, See GetWebViewChannelStats
+ */
+typedef struct _webViewChannelStats
+{
+    /*! Messages posted by native code */
+    unsigned long long posted;
+
+    /*! Messages handed to the page */
+    unsigned long long delivered;
+
+    /*! Messages dropped because the queue was full */
+    unsigned long long dropped;
+
+    /*! Messages replaced by a newer message with the same key */
+    unsigned long long coalesced;
+
+    /*! Messages currently waiting in the queue */
+    unsigned long long depth;
+
+    /*! Largest number of messages that waited in the queue at once */
+    unsigned long long max_depth;
+
+    /*! Messages the page can still receive before it has to grant credits */
+    unsigned int credits;
+
+    /*! Messages handed to the page but not consumed yet */
+    unsigned int in_flight;
+} WebViewChannelStats;
+
+/**
+ * @brief This type holds the counters of a bound native function
+ *
+ * this structure describes the call counts, traffic and latency of a binding, See GetWebViewBindingStats
+ */
+typedef struct _webViewBindingStats
+{
+    /*! Calls received from JavaScript */
+    unsigned long long calls;
+
+    /*! Calls returned with a non-zero status */
+    unsigned long long errors;
+
+    /*! Calls cancelled by JavaScript, because of a timeout or an AbortSignal */
+    unsigned long long cancelled;
+
+    /*! Bytes of the received call messages */
+    unsigned long long bytes_in;
+
+    /*! Bytes of the returned results, including streamed chunks */
+    unsigned long long bytes_out;
+
+    /*! Calls received but not returned or cancelled yet */
+    unsigned int in_flight;
+
+    /*! Sum of the latencies of all returned calls in microseconds */
+    unsigned long long latency_total_us;
+
+    /*! Returned calls by latency: bucket 0 is below 2us, bucket i is [2^i, 2^(i+1)) us, the last bucket is anything longer */
+    unsigned long long latency_histogram[24];
+} WebViewBindingStats;
+
+/**
+ * @brief This type holds the counters of the dispatch queue
+ *
+ * this structure describes how long dispatched functions wait before they run and how deep the queue gets,
+ * See GetWebViewDispatchStats
+ */
+typedef struct _webViewDispatchStats
+{
+    /*! Functions posted with DispatchWebView or internally */
+    unsigned long long posted;
+
+    /*! Functions that have run */
+    unsigned long long run;
+
+    /*! Functions waiting in the queue */
+    unsigned long long depth;
+
+    /*! Largest number of functions that waited in the queue at once */
+    unsigned long long max_depth;
+
+    /*! Sum of the waits of all functions that have run in microseconds */
+    unsigned long long wait_total_us;
+
+    /*! Functions by wait from posting to running: bucket 0 is below 2us, bucket i is [2^i, 2^(i+1)) us, the last bucket is anything longer */
+    unsigned long long wait_histogram[24];
+
+    /*! Times the queue drained by the number of functions run since it was last empty: bucket 0 is a single function, bucket i is [2^i, 2^(i+1)) functions */
+    unsigned long long batch_histogram[24];
+} WebViewDispatchStats;
+
+/**
+ * @brief This type holds the counters of the stall watchdog
+ *
+ * this structure describes how often and how long the UI thread was blocked, See GetWebViewStallStats
+ */
+typedef struct _webViewStallStats
+{
+    /*! Bound functions and dispatched functions that ran over the threshold */
+    unsigned long long stalls;
+
+    /*! Main loop heartbeats that waited over the threshold outside of bound or dispatched functions */
+    unsigned long long main_loop_stalls;
+
+    /*! Longest stall seen in milliseconds */
+    long long longest_ms;
+} WebViewStallStats;
+
+/**
+ * @brief This type holds the timing of a navigation
+ *
+ * this structure describes when a navigation reached each milestone, See GetWebViewNavigationTiming
+ */
+typedef struct _webViewNavigationTiming
+{
+    /*! Increases with every navigation */
+    unsigned long long id;
+
+    /*! Milliseconds from the start of the navigation to the start of the new document, -1 until reached */
+    double committed_ms;
+
+    /*! Milliseconds from the start of the navigation to DOMContentLoaded, -1 until reached */
+    double dom_content_loaded_ms;
+
+    /*! Milliseconds from the start of the navigation to the load event, -1 until reached */
+    double load_finished_ms;
+
+    /*! Milliseconds from the start of the navigation to the first paint, -1 until reached */
+    double first_paint_ms;
+} WebViewNavigationTiming;
+
+/**
+ * @brief This type holds the counters of the asset cache
+ *
+ * this structure describes the cache of files served from virtual host folders, which all
+ * WebView instances share, See GetWebViewAssetCacheStats
+ */
+typedef struct _webViewAssetCacheStats
+{
+    /*! Lookups answered from memory */
+    unsigned long long hits;
+
+    /*! Lookups that read the file */
+    unsigned long long misses;
+
+    /*! Entries dropped to stay within the capacity */
+    unsigned long long evictions;
+
+    /*! Entries dropped because the file or its folder changed on disk */
+    unsigned long long invalidations;
+
+    /*! Files held, including files known to be absent */
+    unsigned long long entries;
+
+    /*! Bytes held */
+    unsigned long long bytes;
+
+    /*! Capacity in bytes */
+    unsigned long long capacity;
+} WebViewAssetCacheStats;
+
+/**
+ * @brief Describes a native function to be bound by BindWebViewMany
+ *
+ * this structure holds the same arguments as a single BindWebView call
+ */
+typedef struct _webViewBinding
+{
+    /*! Name of the function to be called from JavaScript */
+    const char *name;
+
+    /*! Native function to be called from JavaScript, see BindWebView */
+    void (*fn)(const char *, const char *, void *);
+
+    /*! Context to be passed to the function */
+    void *arg;
+} WebViewBinding;
+
+/**
+ * @brief A request to a custom URI scheme, see RegisterWebViewScheme
+ *
+ * It is valid from the call of the scheme callback until it is answered.
+ */
+typedef void *WebViewSchemeRequest;
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -132,6 +367,37 @@ extern "C"
      */
     EXPORTWEBVIEWDLL void DestroyWebView(const WebViewHandle handle);
 
+    /**
+     * @brief Keeps hidden WebView instances ready for AcquireWebViewFromPool.
+     *
+     * Creating an instance creates its window and web view and starts the web process of the engine, which
+     * can take hundreds of milliseconds. The pool does this ahead of time, one instance at a time when the
+     * main loop is idle, and loads a blank page in each so that the web process is running when the
+     * instance is handed out. Idle instances are not reported by CheckWebViewExists until they are handed
+     * out, and are replaced when prepare, arg or debug change.
+     *
+     * @param size The number of instances to keep ready, 0 destroys the idle instances
+     * @param debug If debug is non-zero - developer tools will be enabled (if the platform supports them)
+     * @param prepare Called with each new instance to bind the functions and add the init scripts every
+     *                window needs, ex: `void prepare(const WebViewHandle handle, void *arg)`, may be NULL
+     * @param arg Context to be passed to the callback
+     *
+     * @note Must be called on the main thread. The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void SetWebViewPoolSize(int size, int debug, void (*prepare)(const WebViewHandle, void *), void *arg);
+
+    /**
+     * @brief Takes a ready WebView instance from the pool.
+     *
+     * The window of the instance is shown and the pool starts creating its replacement. If no instance is
+     * ready, one is created on the spot, as CreateWebViewInstance would. See SetWebViewPoolSize.
+     *
+     * @note Must be called on the main thread. The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return The handle, to be destroyed with DestroyWebView, or HANDLE_ERROR if creation fails.
+     */
+    EXPORTWEBVIEWDLL WebViewHandle AcquireWebViewFromPool();
+
     /**
      * @brief Check if a webview instance is exists
      *
@@ -306,8 +572,9 @@ extern "C"
      * @brief Loads the HTML content of a WebView instance from a file.
      *
      * This function sets the HTML content of the specified WebView instance to the
-     * contents of the file specified by the `htmlFile` parameter. The contents of the
-     * file are loaded into memory and used as the HTML content of the WebView instance.
+     * contents of the file specified by the `htmlFile` parameter. The file is memory-mapped
+     * and the mapping is handed to the browser engine, so the page is not read into a
+     * string first. WebView2 still converts it to UTF-16 once.
      *
      * @param handle A handle to the WebView instance you want to set html file to
      * @param htmlFile The path to the HTML file to load.
@@ -335,6 +602,34 @@ extern "C"
      */
     EXPORTWEBVIEWDLL void InitWebView(const WebViewHandle handle, const char *js);
 
+    /**
+     * @brief Adds or replaces a named initialization script.
+     *
+     * Like `InitWebView`, the JavaScript code is executed at the initialization of every new page,
+     * before window.onload. Scripts are kept in registration order; setting an id that already exists
+     * replaces that script in place. Each registered script is injected as a user script of its own.
+     *
+     * @param handle A handle to the WebView instance that you want to set the script for.
+     * @param id The identifier of the script, used to replace or remove it later.
+     * @param js The JavaScript code to execute at the initialization of every new page.
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void SetWebViewInitScript(const WebViewHandle handle, const char *id, const char *js);
+
+    /**
+     * @brief Removes a named initialization script.
+     *
+     * Removes a script previously set by `SetWebViewInitScript`. The script is no longer executed
+     * on the pages opened afterwards; the current page is not affected.
+     *
+     * @param handle A handle to the WebView instance that you want to remove the script from.
+     * @param id The identifier the script was registered with.
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void RemoveWebViewInitScript(const WebViewHandle handle, const char *id);
+
     /**
      * @brief Executes the specified JavaScript code in the context of the specified WebView instance.
      *
@@ -374,6 +669,39 @@ extern "C"
      */
     EXPORTWEBVIEWDLL void BindWebView(const WebViewHandle handle, const char *name, void (*fn)(const char *, const char *, void *), void *arg);
 
+    /**
+     * @brief Bind several native functions to be called from JavaScript.
+     *
+     * Equivalent to calling BindWebView for every entry of the array, but the RPC dispatcher script is
+     * shared by all bindings and the bound names are injected into the page once for the whole array,
+     * so the startup cost does not grow with one script injection per binding.
+     *
+     * @param handle A handle to the WebView instance that you want to bind the Native code to
+     * @param bindings An array of bindings, See structure type "WebViewBinding"
+     * @param count The number of entries in the array
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns 1 if the functions are bound, 0 if count is negative or bindings is NULL
+     */
+    EXPORTWEBVIEWDLL int BindWebViewMany(const WebViewHandle handle, const WebViewBinding *bindings, int count);
+
+    /**
+     * @brief Expose the bound native functions under a namespace object.
+     *
+     * After calling this function the bound functions are not created as global JavaScript functions
+     * but are reached as members of the global object with the given name, ex: `window.native.myFunction()`.
+     * The members are created lazily on first access, so a new page only runs one constant script no matter
+     * how many functions are bound. Calling a name that is not bound rejects the returned promise.
+     * This function should be called before binding functions.
+     *
+     * @param handle A handle to the WebView instance
+     * @param ns Name of the global namespace object, or an empty string to use global functions again
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void SetWebViewBindingNamespace(const WebViewHandle handle, const char *ns);
+
     /**
      * @brief Removes a native C callback that was previously set by webview_bind.
      *
@@ -384,6 +712,246 @@ extern "C"
      */
     EXPORTWEBVIEWDLL void UnBindWebView(const WebViewHandle handle, const char *name);
 
+    /**
+     * @brief Emits an event to JavaScript.
+     *
+     * The page receives events with `window._rpc.subscribe(topic, fn)`, which returns a function to unsubscribe.
+     * The native side keeps track of the subscribed topics: events of a topic without subscribers are dropped
+     * without being evaluated, and several events of the same topic emitted before the main thread delivers
+     * them are coalesced so that only the latest is delivered.
+     * It is safe to call this function from any thread.
+     *
+     * @param handle A handle to the WebView instance
+     * @param topic The topic of the event
+     * @param json The JSON string of the event
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns 1 if the event is delivered, 0 if the topic has no subscribers
+     */
+    EXPORTWEBVIEWDLL int EmitWebViewEvent(const WebViewHandle handle, const char *topic, const char *json);
+
+    /**
+     * @brief Check if the page has subscribed to a topic
+     *
+     * Use this function to skip serializing events nobody listens to. It is safe to call this function from any thread.
+     *
+     * @param handle A handle to the WebView instance
+     * @param topic The topic of the event
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns 1 if the topic has subscribers, otherwise, returns 0
+     */
+    EXPORTWEBVIEWDLL int CheckWebViewEventSubscribed(const WebViewHandle handle, const char *topic);
+
+    /**
+     * @brief Opens a flow-controlled channel to push messages to JavaScript.
+     *
+     * The page receives the messages with `window._rpc.listen(name, fn)`. At most `window` messages are handed
+     * to the page before it grants credits back, which it does for every message once `fn` has handled it
+     * (or once the promise returned by `fn` has settled). Until then posted messages wait in a queue of
+     * `capacity` messages that overflows according to `policy`. Opening an existing channel replaces it.
+     *
+     * @param handle A handle to the WebView instance
+     * @param name Name of the channel
+     * @param policy The overflow policy, See enum type "WebViewChannelPolicy"
+     * @param capacity Maximum number of messages waiting in the queue
+     * @param window Maximum number of messages handed to the page but not consumed yet
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns 1 if the channel is opened, 0 if the policy is not a WebViewChannelPolicy value
+     */
+    EXPORTWEBVIEWDLL int OpenWebViewChannel(const WebViewHandle handle, const char *name, int policy, int capacity, int window);
+
+    /**
+     * @brief Posts a message to a push channel.
+     *
+     * It is safe to call this function from any thread. With the WebViewChannelBlock policy this function waits
+     * while the queue is full, so it must not be called from the main thread.
+     *
+     * @param handle A handle to the WebView instance
+     * @param name Name of the channel
+     * @param key The coalescing key of the message, can be NULL, used with the WebViewChannelCoalesce policy
+     * @param json The JSON string of the message
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns 1 if the message is queued, 0 if the channel does not exist
+     */
+    EXPORTWEBVIEWDLL int PostWebViewChannel(const WebViewHandle handle, const char *name, const char *key, const char *json);
+
+    /**
+     * @brief Posts one message to the push channel of several WebView instances.
+     *
+     * The JSON string is copied once and the copy is shared by the queues of all instances, instead of building
+     * one script per instance. Each instance applies the policy its channel was opened with (See OpenWebViewChannel),
+     * so a slow window drops or coalesces its own messages without affecting the others. With the WebViewChannelBlock
+     * policy a full queue of one instance delays the following instances.
+     * It is safe to call this function from any thread.
+     *
+     * @param handles An array of handles to the WebView instances
+     * @param count The number of handles in the array
+     * @param name Name of the channel
+     * @param key The coalescing key of the message, can be NULL, used with the WebViewChannelCoalesce policy
+     * @param json The JSON string of the message
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns the number of instances that queued the message, 0 if count is negative or handles is NULL
+     */
+    EXPORTWEBVIEWDLL int BroadcastWebViewChannel(const WebViewHandle *handles, int count, const char *name, const char *key, const char *json);
+
+    /**
+     * @brief Get the queue depth and message counters of a push channel
+     *
+     * @param handle A handle to the WebView instance
+     * @param name Name of the channel
+     * @param outStats Pointer to a WebViewChannelStats structure to receive the counters
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns 1 if the channel exists, otherwise, returns 0
+     */
+    EXPORTWEBVIEWDLL int GetWebViewChannelStats(const WebViewHandle handle, const char *name, WebViewChannelStats *outStats);
+
+    /**
+     * @brief Set the default timeout of calls to a bound native function.
+     *
+     * When a call is not returned within the timeout, the JavaScript promise is rejected and the call is
+     * cancelled on the native side (See SetWebViewBindingCancel and CheckWebViewCancelled).
+     * JavaScript can override the timeout or pass an AbortSignal for a single call,
+     * ex: `myFunction.withOptions({timeout: 1000, signal: controller.signal})(arg1, arg2)`
+     *
+     * @param handle A handle to the WebView instance
+     * @param name Name of the bound function
+     * @param timeoutMs Timeout in milliseconds, 0 disables the timeout
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void SetWebViewBindingTimeout(const WebViewHandle handle, const char *name, int timeoutMs);
+
+    /**
+     * @brief Set the cancel callback of a bound native function.
+     *
+     * The callback is called on the main thread when JavaScript abandons a pending call, because it timed out
+     * or because its AbortSignal fired. It can be used to stop long-running native work and free its resources.
+     * Returning a cancelled call with ReturnWebView is allowed and does nothing.
+     *
+     * @param handle A handle to the WebView instance
+     * @param name Name of the bound function
+     * @param fn The callback function, ex: `void onCancel(const char *seq, void *arg)`.
+     *            seq is the identifier of the cancelled call, arg is the context the function was bound with
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void SetWebViewBindingCancel(const WebViewHandle handle, const char *name, void (*fn)(const char *, void *));
+
+    /**
+     * @brief Check if a call of a bound native function has been cancelled
+     *
+     * This function can be polled from any thread by long-running native work to stop early.
+     *
+     * @param handle A handle to the WebView instance
+     * @param seq Sequence be a identifier string representing a specific call (See BindWebView details)
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns 1 if the call is no longer pending (cancelled or already returned), otherwise, returns 0
+     */
+    EXPORTWEBVIEWDLL int CheckWebViewCancelled(const WebViewHandle handle, const char *seq);
+
+    /**
+     * @brief Get the counters of the dispatch queue.
+     *
+     * Every function posted to the main thread is timestamped, so the wait until it runs can be used as a measure
+     * of UI responsiveness. The counters are kept for the lifetime of the WebView instance,
+     * compare two reads to measure an interval.
+     *
+     * @param handle A handle to the WebView instance
+     * @param outStats Pointer to a WebViewDispatchStats structure to receive the counters
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void GetWebViewDispatchStats(const WebViewHandle handle, WebViewDispatchStats *outStats);
+
+    /**
+     * @brief Start a watchdog that reports functions blocking the UI thread.
+     *
+     * A watchdog thread watches every bound function and dispatched function running on the UI thread,
+     * and posts heartbeats to the main loop. When one of them takes the threshold or longer, the callback is
+     * called on the watchdog thread while the UI thread is still blocked, and once more when the function returns.
+     * Handlers that show up here should move their work off the UI thread.
+     *
+     * @param handle A handle to the WebView instance
+     * @param thresholdMs Threshold in milliseconds, 0 stops the watchdog, as does a NULL fn
+     * @param fn The callback function, ex: `void onStall(const WebViewHandle handle, const char *site, long long elapsedMs, int finished, void *arg)`.
+     *            site is "binding:<name>" for bound functions, "dispatch:<site>" for dispatched functions or "main loop",
+     *            finished is 0 when the stall is detected and 1 when the function returns
+     * @param arg Context to be passed to the callback
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void SetWebViewStallWatchdog(const WebViewHandle handle, int thresholdMs, void (*fn)(const WebViewHandle, const char *, long long, int, void *), void *arg);
+
+    /**
+     * @brief Get the counters of the stall watchdog.
+     *
+     * @param handle A handle to the WebView instance
+     * @param outStats Pointer to a WebViewStallStats structure to receive the counters
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void GetWebViewStallStats(const WebViewHandle handle, WebViewStallStats *outStats);
+
+    /**
+     * @brief Get the timing of the latest navigation.
+     *
+     * A navigation starts when NavigateWebView, SetWebViewHTML or SetWebViewHTMLFromFile is called, or when
+     * the page navigates by itself. On Linux the committed and load finished milestones come from the load
+     * events of WebKitGTK; the other milestones, and all of them on the other platforms,
+     * are reported by a script injected into every document.
+     *
+     * @param handle A handle to the WebView instance
+     * @param outTiming Pointer to a WebViewNavigationTiming structure to receive the timing
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void GetWebViewNavigationTiming(const WebViewHandle handle, WebViewNavigationTiming *outTiming);
+
+    /**
+     * @brief Set a callback for the milestones of navigations.
+     *
+     * The callback is called on the main thread each time the latest navigation reaches a milestone, at most
+     * once per milestone and navigation, so startup times can be tracked per page.
+     *
+     * @param handle A handle to the WebView instance
+     * @param fn The callback function, ex: `void onTiming(const WebViewHandle handle, int milestone, const char *url, const WebViewNavigationTiming *timing, void *arg)`.
+     *            milestone is one of enum type "WebViewNavigationMilestone", NULL removes the callback
+     * @param arg Context to be passed to the callback
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void SetWebViewNavigationTimingCallback(const WebViewHandle handle, void (*fn)(const WebViewHandle, int, const char *, const WebViewNavigationTiming *, void *), void *arg);
+
+    /**
+     * @brief Get the counters of a bound native function.
+     *
+     * The counters are kept for every binding with relaxed atomic increments, so they can be read
+     * from any thread at any time. The latency of a call is measured from receiving it to
+     * evaluating its result in the page.
+     *
+     * @param handle A handle to the WebView instance
+     * @param name Name of the bound function, or NULL for the calls to names that are not bound
+     * @param outStats Pointer to a WebViewBindingStats structure to receive the counters
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns 1 if the function is bound, otherwise, returns 0
+     */
+    EXPORTWEBVIEWDLL int GetWebViewBindingStats(const WebViewHandle handle, const char *name, WebViewBindingStats *outStats);
+
     /**
      * @brief Return a value from local bindings.
      *
@@ -398,6 +966,25 @@ extern "C"
      */
     EXPORTWEBVIEWDLL void ReturnWebView(const WebViewHandle handle, const char *seq, int status, const char *result);
 
+    /**
+     * @brief Return one chunk of a streaming call from local bindings.
+     *
+     * When JavaScript calls a bound function as a stream, ex: `for await (const rows of myFunction.stream(arg))`,
+     * the native function can send its result in several chunks instead of one large JSON string.
+     * Each chunk is delivered to the JavaScript async iterator in order. The call must be ended with ReturnWebView:
+     * a zero status ends the iteration, a non-zero status makes the iterator throw the result.
+     * At most 16 chunks can be waiting for the iterator. Called from a worker thread, this function then blocks
+     * until the page has consumed a chunk; called from the UI thread, it refuses the chunk instead.
+     *
+     * @param handle The handle of the WebView that you want to receive data
+     * @param seq Sequence be a identifier string representing a specific native function (See BindWebView details)
+     * @param result The JSON string of this chunk
+     * @return 1 if the chunk was sent, 0 if the call is no longer pending or the page lags behind.
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL int ReturnWebViewChunk(const WebViewHandle handle, const char *seq, const char *result);
+
     /**
      * @brief Binds a custom URI to a local folder for a WebView instance.
      *
@@ -413,12 +1000,182 @@ extern "C"
      * @param folder The path to the local folder to bind to the custom URI.
      * @param option An integer value indicating the binding options, See enum type "WebViewResourceAccessType"
      *
+     * On Linux the host is served from the "webview" scheme, e.g. webview://appassets.example/my-local-file.html,
+     * and NavigateWebView rewrites https:// URLs of the host to it. Files are memory-mapped rather than read,
+     * and HTTP Range requests are honored for media. Status codes, headers and the Origin checks of
+     * KIND_DENY need WebKitGTK 2.36 or newer. A pre-compressed sibling "file.br" or "file.gz" is read
+     * instead of "file" (brotli needs a build with -DWEBVIEW_BROTLI and -lbrotlidec).
+     *
      * @return Returns 0 if the operation succeeds, or a negative value if it fails.
      *
      * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
      */
     EXPORTWEBVIEWDLL int SetWebViewVituralHostName(const WebViewHandle handle, const char *url, const char *folder, const int option);
 
+    /**
+     * @brief Serves a virtual host from an asset bundle instead of a folder.
+     *
+     * Works like SetWebViewVituralHostName, but the files come from a single bundle built with
+     * tools/bundle/webview_bundle (`make bundle`). The bundle is memory-mapped once and entries are
+     * found by a hash of their path, so serving a file costs no system call. Entries packed with
+     * `--gzip` are decoded while the page reads them.
+     *
+     * @param handle A handle to the WebView instance
+     * @param url The host name, such as "appassets.example"
+     * @param bundle The path to the bundle file
+     * @param option An integer value indicating the binding options, See enum type "WebViewResourceAccessType"
+     *
+     * @return Returns 1 if the host is served, 0 if the bundle is invalid or the backend has no custom
+     *         schemes (only WebKitGTK has)
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL int SetWebViewVirtualHostBundle(const WebViewHandle handle, const char *url, const char *bundle, const int option);
+
+    /**
+     * @brief Updates the page in place when files of a virtual host folder change.
+     *
+     * Watches the folder, including its subfolders, and when a file is written: stylesheets linked
+     * from the host are swapped by replacing their `<link>`, keeping the old sheet until the new one
+     * has loaded; modules that accepted updates with
+     * `window._webviewHot.accept(import.meta.url, (module) => ...)` are imported again and the new
+     * module is passed to the callback; any other change reloads the page. The page state and the
+     * bindings are kept unless the page reloads. Call it after SetWebViewVituralHostName.
+     *
+     * @param handle A handle to the WebView instance
+     * @param url The host name, such as "appassets.example"
+     * @param folder The folder served at the host, NULL to stop watching it
+     *
+     * @return Returns 1 if the folder is watched, 0 if it cannot be, or if the backend is not WebKitGTK
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL int SetWebViewHotReload(const WebViewHandle handle, const char *url, const char *folder);
+
+    /**
+     * @brief Bounds the cache of files served from virtual host folders.
+     *
+     * Files served by SetWebViewVituralHostName on Linux are kept in memory, shared by all WebView
+     * instances, so that reloads and other windows do not read them again. The folders are watched
+     * with inotify, and an entry is dropped as soon as its file changes on disk. The least recently
+     * used files are evicted first.
+     *
+     * @param bytes The capacity in bytes, 32 MiB by default, 0 disables the cache. Files larger than
+     *              1/16 of it are read from disk every time.
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void SetWebViewAssetCacheCapacity(size_t bytes);
+
+    /**
+     * @brief Get the counters of the asset cache.
+     *
+     * @param outStats Pointer to a WebViewAssetCacheStats structure to receive the counters
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void GetWebViewAssetCacheStats(WebViewAssetCacheStats *outStats);
+
+    /**
+     * @brief Serves a custom URI scheme from native code.
+     *
+     * Every request to the scheme, such as `fetch("app://assets/data.bin")` for the scheme "app",
+     * calls `fn` on the UI thread with the request. The callback answers it exactly once with
+     * RespondWebViewScheme, RespondWebViewSchemeStream or FailWebViewScheme, before returning or
+     * later on the UI thread. Binary data reaches the page as is, without JSON or base64 encoding.
+     *
+     * @param handle A handle to the WebView instance
+     * @param scheme The scheme to serve, without "://"
+     * @param fn The callback, it receives the handle, the request and `arg`
+     * @param arg Context to be passed to the callback
+     *
+     * @return Returns 1 if the scheme is registered, 0 if the backend cannot register custom schemes.
+     *         Only WebKitGTK can, use SetWebViewVituralHostName on Windows.
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL int RegisterWebViewScheme(const WebViewHandle handle, const char *scheme, void (*fn)(const WebViewHandle, WebViewSchemeRequest, void *), void *arg);
+
+    /**
+     * @brief Get the URI of a scheme request.
+     *
+     * @param request The request passed to the scheme callback
+     *
+     * @return The full URI, valid until the request is answered
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL const char *GetWebViewSchemeRequestUri(WebViewSchemeRequest request);
+
+    /**
+     * @brief Get the path of a scheme request.
+     *
+     * @param request The request passed to the scheme callback
+     *
+     * @return The path of the URI, such as "/data.bin", valid until the request is answered
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL const char *GetWebViewSchemeRequestPath(WebViewSchemeRequest request);
+
+    /**
+     * @brief Add a header to the response of a scheme request.
+     *
+     * Must be called before answering. Headers and status codes other than 200 need WebKitGTK 2.36 or newer.
+     *
+     * @param request The request passed to the scheme callback
+     * @param name Name of the header
+     * @param value Value of the header
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void SetWebViewSchemeHeader(WebViewSchemeRequest request, const char *name, const char *value);
+
+    /**
+     * @brief Answer a scheme request with a complete buffer.
+     *
+     * @param request The request passed to the scheme callback
+     * @param status The HTTP status code
+     * @param mime The content type, such as "application/octet-stream"
+     * @param data The body of the response
+     * @param size Size of the body in bytes
+     * @param release If NULL the data is copied, otherwise the data is used in place and
+     *                `release(arg)` is called once the browser engine no longer needs it
+     * @param arg Context to be passed to `release`
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void RespondWebViewScheme(WebViewSchemeRequest request, int status, const char *mime, const void *data, size_t size, void (*release)(void *), void *arg);
+
+    /**
+     * @brief Answer a scheme request with a stream.
+     *
+     * The browser engine pulls the body with `read(buf, size, arg)`, which fills `buf` with up to
+     * `size` bytes and returns the number of bytes read, 0 at the end or -1 on error. It may be
+     * called on a worker thread. Large responses are never held in memory at once.
+     *
+     * @param request The request passed to the scheme callback
+     * @param status The HTTP status code
+     * @param mime The content type
+     * @param size Size of the body in bytes, or -1 if unknown
+     * @param read The reader of the body
+     * @param close Called with `arg` once the engine is done with the stream, may be NULL
+     * @param arg Context to be passed to `read` and `close`
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void RespondWebViewSchemeStream(WebViewSchemeRequest request, int status, const char *mime, long long size, long long (*read)(void *, size_t, void *), void (*close)(void *), void *arg);
+
+    /**
+     * @brief Fail a scheme request, the page sees a network error.
+     *
+     * @param request The request passed to the scheme callback
+     * @param message Description of the error
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void FailWebViewScheme(WebViewSchemeRequest request, const char *message);
+
     /**
      * @brief Retrieves version information for the webview library.
      *
@@ -429,6 +1186,42 @@ extern "C"
      * version information. See structure type "WebViewVersionInfo"
      */
     EXPORTWEBVIEWDLL void GetWebViewVersionInfo(WebViewVersionInfo *outInfo);
+
+    /**
+     * @brief Start recording a trace of the native hot path.
+     *
+     * Spans of message handling, bound functions, returns, dispatch, script evaluation and navigation
+     * of every WebView instance are written to a ring buffer owned by the recording thread.
+     * When the trace is stopped, recording costs a single branch per span.
+     *
+     * @param eventsPerThread Number of most recent spans each thread keeps
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void StartWebViewTrace(unsigned int eventsPerThread);
+
+    /**
+     * @brief Stop recording a trace of the native hot path.
+     *
+     * The recorded spans are kept until StartWebViewTrace is called again.
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     */
+    EXPORTWEBVIEWDLL void StopWebViewTrace();
+
+    /**
+     * @brief Write the recorded trace to a file.
+     *
+     * The file is in the Chrome trace-event JSON format and can be opened in https://ui.perfetto.dev
+     * or chrome://tracing. Call StopWebViewTrace first to get a consistent snapshot.
+     *
+     * @param path Path of the JSON file to write
+     *
+     * @note The `EXPORTWEBVIEWDLL` attribute indicates that this function is exported from a DLL.
+     *
+     * @return Returns 1 if the file is written, otherwise, returns 0
+     */
+    EXPORTWEBVIEWDLL int DumpWebViewTrace(const char *path);
 #ifdef __cplusplus
 }
 #endif